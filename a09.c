@@ -25,6 +25,9 @@
 #include <stdarg.h>
 #include <limits.h>
 #include <errno.h>
+
+#include <pthread.h>
+
 #include "a09.h"
 
 /**************************************************************************
@@ -43,9 +46,12 @@ enum
 /**************************************************************************/
 
 char const MSG_DEBUG[]   = "debug";
+char const MSG_NOTE[]    = "note";
 char const MSG_WARNING[] = "warning";
 char const MSG_ERROR[]   = "error";
 
+static pthread_mutex_t msglock = PTHREAD_MUTEX_INITIALIZER; /* see message() */
+
 /**************************************************************************/
 
 bool labeled(struct opcdata *opd)
@@ -132,6 +138,7 @@ bool message(struct a09 *a09,char const *restrict tag,char const *restrict fmt,.
              ((tag == MSG_WARNING) && (fmt[0] == 'W'))
           || ((tag == MSG_ERROR)   && (fmt[0] == 'E'))
           || ((tag == MSG_DEBUG))
+          || ((tag == MSG_NOTE))
         );
         
   va_list ap;
@@ -159,6 +166,12 @@ bool message(struct a09 *a09,char const *restrict tag,char const *restrict fmt,.
       a09->warning = true;
   }
   
+  /*-----------------------------------------------------------------------
+  ; Test workers can call this at the same time, so keep each message in
+  ; one piece.
+  ;------------------------------------------------------------------------*/
+  
+  pthread_mutex_lock(&msglock);
   if (a09->lnum > 0)
     fprintf(stderr,"%s:%zu: %s: ",a09->infile,a09->lnum,tag);
   else
@@ -174,6 +187,7 @@ bool message(struct a09 *a09,char const *restrict tag,char const *restrict fmt,.
 #endif
   va_end(ap);
   fprintf(stderr,"\n");
+  pthread_mutex_unlock(&msglock);
   a09->error = tag == MSG_ERROR;
   return !a09->error;
 }
@@ -497,7 +511,7 @@ bool print_list(struct a09 *a09,struct opcdata *opd,bool labelonly)
 
 /**************************************************************************/
 
-static bool parse_line(struct a09 *a09,struct buffer *buffer,int pass)
+bool parse_line(struct a09 *a09,struct buffer *buffer,int pass)
 {
   assert(a09    != NULL);
   assert(buffer != NULL);
@@ -570,6 +584,9 @@ static bool parse_line(struct a09 *a09,struct buffer *buffer,int pass)
     char *p    = memchr(a09->label.text,'.',a09->label.len);
     if (p != NULL)
       a09->label.len = (unsigned char)(p - a09->label.text);
+      
+    if (a09->peep != NULL)
+      peep_label(a09);
   }
   
   c = skip_space(&a09->inbuf);
@@ -585,9 +602,12 @@ static bool parse_line(struct a09 *a09,struct buffer *buffer,int pass)
   opd.cycles  = opd.op->cycles;
   rc          = opd.op->func(&opd);
   
+  if (rc && (a09->peep != NULL))
+    rc = peep_line(&opd);
+    
   if (pass == 2)
   {
-    if (!labeled(&opd) && (opd.op->cycles > 0))
+    if (!labeled(&opd) && (opd.op->cycles > 0) && (opd.sz > 0))
     {
       if (
               (a09->prevop == 0x16) /* LBRA         */
@@ -629,6 +649,17 @@ static bool parse_line(struct a09 *a09,struct buffer *buffer,int pass)
   {
     print_list(a09,&opd,false);
     
+    if ((pass == 2) && (a09->flow != NULL))
+      if (!flow_record(&opd))
+        return false;
+        
+    if ((pass == 2) && (a09->dpvars != NULL))
+      if (!dpvar_record(&opd))
+        return false;
+        
+    if (pass == 2)
+      timing_record(&opd);
+        
     if (opd.data)
       a09->pc += opd.datasz;
     else
@@ -718,83 +749,155 @@ static bool nowarnlist(struct a09 *a09,char const *warnings)
 
 /**************************************************************************/
 
-static bool notest(struct a09 *a09,char const *list)
+static bool addselect(
+        struct a09   *a09,
+        enum selkind  kind,
+        bool          exclude,
+        char const   *pattern,
+        size_t        low,
+        size_t        high
+)
 {
-  assert(a09  != NULL);
+  assert(a09 != NULL);
+  assert(low <= high);
+  
+  struct testsel *new = realloc(a09->selects,(a09->nselects + 1) * sizeof(struct testsel));
   
-  if (list == NULL) // XXX
+  if (new == NULL)
   {
-    fprintf(stderr,"-x: missing list of tests\n");
+    fprintf(stderr,"-%c: out of memory\n",exclude ? 'x' : 'y');
     return false;
   }
   
-  for (char const *p = list ; ; )
+  a09->selects                 = new;
+  a09->selects[a09->nselects++] = (struct testsel){
+    .kind    = kind,
+    .exclude = exclude,
+    .pattern = pattern,
+    .low     = low,
+    .high    = high,
+  };
+  return true;
+}
+
+/**************************************************************************/
+
+static bool selrange(char const **pp,size_t *plow,size_t *phigh)
+{
+  assert(pp    != NULL);
+  assert(*pp   != NULL);
+  assert(plow  != NULL);
+  assert(phigh != NULL);
+  
+  unsigned long int v;
+  
+  if (!isdigit(**pp))
+    return false;
+  errno = 0;
+  v     = strtoul(*pp,(char **)pp,0);
+  if ((errno != 0) || (v == 0))
+    return false;
+  *plow  = v;
+  *phigh = v;
+  
+  if (**pp == '-')
   {
-    unsigned long int  v;
-    div_t              res;
-    
+    (*pp)++;
+    if (!isdigit(**pp))
+      return false;
     errno = 0;
-    v     = strtoul(p,(char **)&p,0);
-    if ((errno != 0) || (v > 1023uL))
-    {
-      fprintf(stderr,"-x: invalid test number\n");
+    v     = strtoul(*pp,(char **)pp,0);
+    if ((errno != 0) || (v <= *plow))
       return false;
-    }
-    res = div((int)v - 1,CHAR_BIT);
-    a09->notest[res.quot] |= 1 << res.rem;
-    
-    if (*p == '\0')
-      break;
-    else if (*p == ',')
-    {
-      p++;
-      continue;
-    }
-    else if (*p == '-')
+    *phigh = v;
+  }
+  
+  return true;
+}
+
+/**************************************************************************/
+
+static bool selecttest(struct a09 *a09,char const *spec,bool exclude)
+{
+  assert(a09 != NULL);
+  
+  char        opt = exclude ? 'x' : 'y';
+  char const *colon;
+  
+  if (spec == NULL)
+  {
+    fprintf(stderr,"-%c: missing test specification\n",opt);
+    return false;
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; A specification is one of:
+  ;
+  ;	N1,N2,N3-N4	test numbers (as given in the TAP output)
+  ;	file:		all tests in the file (a glob)
+  ;	file:L1-L2	tests defined in the file between the given lines
+  ;	name		tests with a name matching the glob
+  ;------------------------------------------------------------------------*/
+  
+  if (isdigit(*spec))
+  {
+    for (char const *p = spec ; ; )
     {
-      unsigned long int v2;
+      size_t low;
+      size_t high;
       
-      p++;
-      errno = 0;
-      v2    = strtoul(p,(char **)&p,0);
-      if ((errno != 0) || (v2 > 1023uL))
+      if (!selrange(&p,&low,&high))
       {
-        fprintf(stderr,"-x: invalid test number\n");
+        fprintf(stderr,"-%c: invalid test number or range '%s'\n",opt,spec);
         return false;
       }
       
-      if (v2 <= v)
-      {
-        fprintf(stderr,"-x: not a valid range\n");
+      if (!addselect(a09,SEL_INDEX,exclude,NULL,low,high))
         return false;
-      }
-      
-      for ( v = v + 1 ; v <= v2 ; v++)
-      {
-        res = div((int)v - 1,CHAR_BIT);
-        a09->notest[res.quot] |= 1 << res.rem;
-      }
-      
+        
       if (*p == '\0')
         break;
-      else if (*p == ',')
-      {
-        p++;
-        continue;
-      }
-      else
+      else if (*p++ != ',')
       {
-        fprintf(stderr,"-x: invalid test number\n");
+        fprintf(stderr,"-%c: invalid specification '%s'\n",opt,spec);
         return false;
       }
     }
-    else
+    
+    return true;
+  }
+  else if ((colon = strrchr(spec,':')) != NULL)
+  {
+    char const *p    = colon + 1;
+    size_t      low  = 1;
+    size_t      high = SIZE_MAX;
+    char       *file;
+    
+    if ((*p != '\0') && (!selrange(&p,&low,&high) || (*p != '\0')))
+    {
+      fprintf(stderr,"-%c: invalid line range '%s'\n",opt,spec);
+      return false;
+    }
+    
+    file = malloc((size_t)(colon - spec) + 1);
+    if (file == NULL)
     {
-      fprintf(stderr,"-x: invalid specification '%s'\n",list);
+      fprintf(stderr,"-%c: out of memory\n",opt);
       return false;
     }
+    
+    memcpy(file,spec,(size_t)(colon - spec));
+    file[colon - spec] = '\0';
+    
+    if (!addselect(a09,SEL_FILE,exclude,file,low,high))
+    {
+      free(file);
+      return false;
+    }
+    return true;
   }
-  return true;
+  else
+    return addselect(a09,SEL_NAME,exclude,spec,0,0);
 }
 
 /**************************************************************************/
@@ -804,34 +907,47 @@ static int usage(char const *prog)
   fprintf(
            stdout,
            "usage: %s [options] [file]\n"
+           "\t-D file\t\torder .DPVAR variables by a heat map from -H\n"
+           "\t-H file\t\twrite memory heat map of tests (only if running tests)\n"
            "\t-I dir\t\tadd directory for include files\n"
            "\t-M\t\tgenerate Makefile dependencies on stdout\n"
            "\t-T\t\trun tests with TAP output\n"
+           "\t-V file\t\torder .LAYOUT code by an lcov file from -v\n"
+           "\t-b file\t\tcompare test cycles against baseline file (only if running tests)\n"
            "\t-c file\t\tcore file (of 6809 VM) name (only if running tests)\n"
            "\t-d\t\tdebug output\n"
-           "\t-e ('a'|'c'|'d'|'f'|'t')\n"
+           "\t-e ('a'|'c'|'d'|'f'|'o'|'t')\n"
            "\t\ta\texplicit addressing mode required\n"
            "\t\tc\tadd cycles to listing file\n"
            "\t\td\tadd detailed cycles\n"
            "\t\tf\tadd flags to listing file\n"
+           "\t\to\toptimize calls, returns and branches\n"
            "\t\tt\ttotal cycles\n"
            "\t-f format\toutput format (default bin)\n"
+           "\t-g file\t\twrite control flow and cycle report\n"
            "\t-h\t\thelp (this text)\n"
+           "\t-i count\tlimit instructions per test (only if running tests)\n"
+           "\t-j count\trun tests in count orders on threads to find order dependencies\n"
+           "\t-k file\t\tskip tests unaffected by changes since last run (only if running tests)\n"
            "\t-l file\t\tlist filename\n"
+           "\t-m file[,addr[,prot]]\tload image into test memory (only if running tests)\n"
            "\t-n Wxxxx\tsupress the given warnings\n"
            "\t-o file\t\toutput filename (default a09.obj)\n"
+           "\t-p percent\tcycle regression threshold for baseline (default 10)\n"
            "\t-r\t\trandomize the testing order (only if running tests)\n"
            "\t-s seed\t\tseed randomizer for testing order\n"
            "\t-t\t\trun tests\n"
+           "\t-v file\t\twrite lcov coverage of tests (only if running tests)\n"
            "\t-w\t\tfail assembler if warnings\n"
-           "\t-x numlist\tskip running given tests\n"
+           "\t-x spec\t\tskip running given tests\n"
+           "\t-y spec\t\tonly run given tests\n"
            "\n"
            "\tformats: bin rsdos srec basic dragon\n"
            "\n"
            "\tIf no file given, code read via stdin\n"
            "\tTo generate output on stdout, use '-o-'\n"
            "\n"
-           "\tFormat for numlist: N1,N2,N3-N4\n"
+           "\tFormat for spec: N1,N2,N3-N4 | file: | file:L1-L2 | name-glob\n"
            "%s"
            "%s"
            "%s"
@@ -869,6 +985,22 @@ static int parse_command(int argc,char *argv[],struct a09 *a09)
     
     switch(c)
     {
+      case 'D':
+           if ((a09->dpfile = arg_arg(&arg)) == NULL)
+           {
+             fprintf(stderr,"-D: missing file name\n");
+             return -1;
+           }
+           break;
+           
+      case 'H':
+           if ((a09->heatfile = arg_arg(&arg)) == NULL)
+           {
+             fprintf(stderr,"-H: missing file name\n");
+             return -1;
+           }
+           break;
+           
       case 'I':
            if ((file = arg_arg(&arg)) == NULL)
            {
@@ -888,6 +1020,22 @@ static int parse_command(int argc,char *argv[],struct a09 *a09)
            a09->tapout   = true;
            break;
            
+      case 'V':
+           if ((a09->layfile = arg_arg(&arg)) == NULL)
+           {
+             fprintf(stderr,"-V: missing file name\n");
+             return -1;
+           }
+           break;
+           
+      case 'b':
+           if ((a09->baseline = arg_arg(&arg)) == NULL)
+           {
+             fprintf(stderr,"-b: missing file name\n");
+             return -1;
+           }
+           break;
+           
       case 'c':
            if ((a09->corefile = arg_arg(&arg)) == NULL)
            {
@@ -929,6 +1077,8 @@ static int parse_command(int argc,char *argv[],struct a09 *a09)
                a09->cc        = true;
                a09->list_pad += 8;
              }
+             else if (*extra == 'o')
+               a09->optimize = true;
              else if (*extra == 't')
                a09->cycles_total = true;
              else
@@ -984,9 +1134,41 @@ static int parse_command(int argc,char *argv[],struct a09 *a09)
            }
            break;
            
+      case 'g':
+           if ((a09->flowfile = arg_arg(&arg)) == NULL)
+           {
+             fprintf(stderr,"-g: missing file name\n");
+             return -1;
+           }
+           break;
+           
       case 'h':
            return usage(argv[0]);
            
+      case 'i':
+           if (!arg_unsigned_long(&a09->maxinst,&arg,0,ULONG_MAX))
+           {
+             fprintf(stderr,"-i: value exceeds limit of %lu\n",ULONG_MAX);
+             return -1;
+           }
+           break;
+           
+      case 'j':
+           if (!arg_unsigned_int(&a09->workers,&arg,0,UINT_MAX))
+           {
+             fprintf(stderr,"-j: value exceeds limit of %u\n",UINT_MAX);
+             return -1;
+           }
+           break;
+           
+      case 'k':
+           if ((a09->impactfile = arg_arg(&arg)) == NULL)
+           {
+             fprintf(stderr,"-k: missing file name\n");
+             return -1;
+           }
+           break;
+           
       case 'l':
            if ((a09->listfile = arg_arg(&arg)) == NULL)
            {
@@ -995,6 +1177,25 @@ static int parse_command(int argc,char *argv[],struct a09 *a09)
            }
            break;
            
+      case 'm':
+           if ((file = arg_arg(&arg)) == NULL)
+           {
+             fprintf(stderr,"-m: missing file name\n");
+             return -1;
+           }
+           else
+           {
+             char const **new = realloc(a09->loads,(a09->nloads + 1) * sizeof(char const *));
+             if (new == NULL)
+             {
+               fprintf(stderr,"-m: out of memory\n");
+               return -1;
+             }
+             a09->loads                = new;
+             a09->loads[a09->nloads++] = file;
+           }
+           break;
+           
       case 'n':
           if (!nowarnlist(a09,arg_arg(&arg)))
             return -1;
@@ -1008,6 +1209,14 @@ static int parse_command(int argc,char *argv[],struct a09 *a09)
            }
            break;
            
+      case 'p':
+           if (!arg_unsigned_int(&a09->regress,&arg,0,UINT_MAX))
+           {
+             fprintf(stderr,"-p: value exceeds limit of %u\n",UINT_MAX);
+             return -1;
+           }
+           break;
+           
       case 'r':
            a09->rndtests = true;
            break;
@@ -1024,12 +1233,25 @@ static int parse_command(int argc,char *argv[],struct a09 *a09)
            a09->runtests = true;
            break;
            
+      case 'v':
+           if ((a09->covfile = arg_arg(&arg)) == NULL)
+           {
+             fprintf(stderr,"-v: missing file name\n");
+             return -1;
+           }
+           break;
+           
       case 'w':
            a09->fail_warn = true;
            break;
            
       case 'x':
-           if (!notest(a09,arg_arg(&arg)))
+           if (!selecttest(a09,arg_arg(&arg),true))
+             return -1;
+           break;
+           
+      case 'y':
+           if (!selecttest(a09,arg_arg(&arg),false))
              return -1;
            break;
            
@@ -1108,6 +1330,12 @@ static int cleanup(struct a09 *a09,bool success)
   assert(a09 != NULL);
   
   if (a09->runtests && (a09->tests != NULL)) test_fini(a09);
+  if (a09->flow != NULL)                     flow_fini(a09);
+  if (a09->peep != NULL)                     peep_fini(a09);
+  if (a09->dpvars != NULL)                   dpvar_fini(a09);
+  if (a09->layout != NULL)                   layout_fini(a09);
+  if (a09->pools != NULL)                    pool_fini(a09);
+  if (a09->timing != NULL)                   timing_fini(a09);
   if (a09->out != NULL)                      fclose(a09->out);
   if (a09->in  != NULL)                      fclose(a09->in);
   
@@ -1132,6 +1360,11 @@ static int cleanup(struct a09 *a09,bool success)
   for (size_t i = 0 ; i < a09->nincs ; i++)
     free(a09->includes[i]);
   free(a09->includes);
+  free(a09->loads);
+  for (size_t i = 0 ; i < a09->nselects ; i++)
+    if (a09->selects[i].kind == SEL_FILE)
+      free((char *)a09->selects[i].pattern);
+  free(a09->selects);
   return success ? 0 : 1;
 }
 
@@ -1191,14 +1424,30 @@ int main(int argc,char *argv[])
     .outfile         = "a09.obj",
     .listfile        = NULL,
     .corefile        = NULL,
+    .baseline        = NULL,
+    .heatfile        = NULL,
+    .covfile         = NULL,
+    .impactfile      = NULL,
+    .flowfile        = NULL,
+    .dpfile          = NULL,
+    .layfile         = NULL,
     .deps            = NULL,
     .includes        = NULL,
+    .loads           = NULL,
+    .selects         = NULL,
     .ndeps           = 0,
     .nincs           = 0,
+    .nloads          = 0,
+    .nselects        = 0,
     .in              = NULL,
     .out             = NULL,
     .list            = NULL,
     .tests           = NULL,
+    .flow            = NULL,
+    .peep            = NULL,
+    .dpvars          = NULL,
+    .layout          = NULL,
+    .pools           = NULL,
     .inbuf           = { .buf = {0}, .widx = 0, .ridx = 0 },
     .lnum            = 0,
     .total_cycles    = 0,
@@ -1207,6 +1456,12 @@ int main(int argc,char *argv[])
     .nowarn          = {0},
     .label           = { .len = 0, .text = { '\0' } },
     .seed            = 0,
+    .regress         = 10,
+    .workers         = 0,
+    .maxinst         = 0,
+    .maskmax         = 0,
+    .stackmax        = 0,
+    .dppool          = -1,
     .list_pad        = 0,
     .pc              = 0,
     .phase           = 0,
@@ -1227,7 +1482,8 @@ int main(int argc,char *argv[])
     .fail_warn       = false,
     .warning         = false,
     .exaddr          = false,
-    .notest          = {0},
+    .thread          = true,
+    .optimize        = false,
   };
   
   format_bin_init(&a09);
@@ -1283,9 +1539,34 @@ int main(int argc,char *argv[])
     if (!test_init(&a09))
       return cleanup(&a09,false);
       
+  if (!flow_init(&a09))
+    return cleanup(&a09,false);
+    
+  if (a09.optimize)
+    if (!peep_init(&a09))
+      return cleanup(&a09,false);
+      
+  if (!dpvar_init(&a09))
+    return cleanup(&a09,false);
+    
+  if (!layout_init(&a09))
+    return cleanup(&a09,false);
+    
+  if (!pool_init(&a09))
+    return cleanup(&a09,false);
+    
+  if (!timing_init(&a09))
+    return cleanup(&a09,false);
+    
   if (!assemble_pass(&a09,1))
     return cleanup(&a09,false);
     
+  if (!pool_check(&a09))
+    return cleanup(&a09,false);
+    
+  if (!timing_check(&a09))
+    return cleanup(&a09,false);
+    
   if (a09.mkdeps)
   {
     int len = printf("%s:",a09.outfile);
@@ -1351,6 +1632,15 @@ int main(int argc,char *argv[])
   
   message(&a09,MSG_DEBUG,"Post assembly phases");
   
+  if (rc && (a09.peep != NULL))
+    rc = peep_report(&a09);
+    
+  if (rc && (a09.dpvars != NULL))
+    rc = dpvar_report(&a09);
+    
+  if (rc && (a09.flow != NULL))
+    rc = flow_report(&a09);
+    
   if (rc)
     if (a09.runtests && !a09.error)
       rc = test_run(&a09);
@@ -1363,6 +1653,10 @@ int main(int argc,char *argv[])
     fprintf(a09.list,"\n");
     dump_symbols(a09.list,a09.symtab);
     fclose(a09.list);
+    
+    if (a09.runtests && !a09.error)
+      if (!test_annotate(&a09))
+        rc = false;
   }
   
   return cleanup(&a09,rc);
@@ -116,6 +116,13 @@ enum operator
   OP_EXP,
 };
 
+enum selkind
+{
+  SEL_INDEX,
+  SEL_NAME,
+  SEL_FILE,
+};
+
 typedef struct label
 {
   unsigned char len;
@@ -133,8 +140,23 @@ struct a09;
 struct opcdata;
 struct symbol;
 struct testdata;
+struct flowdata;
+struct peepdata;
+struct dpvardata;
+struct laydata;
+struct pooldata;
+struct cycdata;
 struct arg;
 
+struct testsel
+{
+  enum selkind  kind;
+  bool          exclude;
+  char const   *pattern;
+  size_t        low;
+  size_t        high;
+};
+
 struct format
 {
   enum backend backend;
@@ -166,14 +188,31 @@ struct a09
   char const       *outfile;
   char const       *listfile;
   char const       *corefile;
+  char const       *baseline;
+  char const       *heatfile;
+  char const       *covfile;
+  char const       *impactfile;
+  char const       *flowfile;
+  char const       *dpfile;
+  char const       *layfile;
   char            **deps;
   char            **includes;
+  char const      **loads;
+  struct testsel   *selects;
   size_t            ndeps;
   size_t            nincs;
+  size_t            nloads;
+  size_t            nselects;
   FILE             *in;
   FILE             *out;
   FILE             *list;
   struct testdata  *tests;
+  struct flowdata  *flow;
+  struct peepdata  *peep;
+  struct dpvardata *dpvars;
+  struct laydata   *layout;
+  struct pooldata  *pools;
+  struct cycdata   *timing;
   struct format     format;
   struct buffer     inbuf;
   size_t            lnum;
@@ -183,6 +222,12 @@ struct a09
   unsigned char     nowarn[10000 / CHAR_BIT];
   label             label;
   unsigned int      seed;
+  unsigned int      regress;
+  unsigned int      workers;
+  unsigned long     maxinst;
+  unsigned long     maskmax;
+  unsigned long     stackmax;
+  long              dppool;
   int               list_pad;
   uint16_t          pc;
   uint16_t          phase;
@@ -203,7 +248,8 @@ struct a09
   bool              fail_warn;
   bool              warning;
   bool              exaddr;
-  unsigned char     notest[1024 / CHAR_BIT];
+  bool              thread;
+  bool              optimize;
 };
 
 struct symbol
@@ -305,6 +351,7 @@ struct arg
 /**************************************************************************/
 
 extern char const MSG_DEBUG[];
+extern char const MSG_NOTE[];
 extern char const MSG_WARNING[];
 extern char const MSG_ERROR[];
 
@@ -338,6 +385,7 @@ extern void                  upper_label        (label *);
 extern bool                  parse_op           (struct buffer *,struct opcode const **);
 extern char                  skip_space         (struct buffer *);
 extern bool                  print_list         (struct a09 *,struct opcdata *,bool);
+extern bool                  parse_line         (struct a09 *,struct buffer *,int);
 extern bool                  assemble_pass      (struct a09 *,int);
 extern bool                  s2num              (struct a09 *,uint16_t *,struct buffer *,uint16_t);
 extern struct optable const *get_op             (struct buffer *);
@@ -346,6 +394,8 @@ extern bool                  rexpr              (struct fvalue *,struct a09 *,st
 extern int                   symstrcmp          (void const *restrict,void const *restrict);
 extern struct symbol        *symbol_add         (struct a09 *,label const *,uint16_t);
 extern void                  symbol_freetable   (tree__s *);
+extern struct symbol       **symbol_addrtable   (struct a09 *,size_t *);
+extern struct symbol        *symbol_nearest     (struct symbol **,size_t,uint16_t);
 extern bool                  format_bin_init    (struct a09 *);
 extern bool                  format_rsdos_init  (struct a09 *);
 extern bool                  format_srec_init   (struct a09 *);
@@ -367,7 +417,45 @@ extern bool                  test_pass_start    (struct a09 *,int);
 extern bool                  test_pass_end      (struct a09 *,int);
 extern bool                  test__opt          (struct opcdata *);
 extern bool                  test_run           (struct a09 *);
+extern bool                  test_annotate      (struct a09 *);
 extern bool                  test_fini          (struct a09 *);
+extern bool                  test_intest        (struct a09 const *);
+extern bool                  flow_init          (struct a09 *);
+extern bool                  flow_record        (struct opcdata *);
+extern bool                  flow_word          (struct opcdata *,uint16_t);
+extern bool                  flow_root          (struct a09 *,uint16_t);
+extern bool                  flow_report        (struct a09 *);
+extern bool                  flow_fini          (struct a09 *);
+extern bool                  peep_init          (struct a09 *);
+extern void                  peep_label         (struct a09 *);
+extern bool                  peep_short         (struct opcdata *);
+extern bool                  peep_gone          (struct opcdata *);
+extern bool                  peep_line          (struct opcdata *);
+extern bool                  peep_report        (struct a09 *);
+extern bool                  peep_fini          (struct a09 *);
+extern bool                  dpvar_init         (struct a09 *);
+extern bool                  dpvar_place        (struct opcdata *,uint16_t *,bool *);
+extern bool                  dpvar_record       (struct opcdata *);
+extern bool                  dpvar_direct       (struct a09 *,size_t *,label *,uint16_t *,uint16_t *);
+extern bool                  dpvar_report       (struct a09 *);
+extern bool                  dpvar_fini         (struct a09 *);
+extern bool                  layout_init        (struct a09 *);
+extern bool                  layout_start       (struct opcdata *);
+extern bool                  layout_end         (struct opcdata *);
+extern bool                  layout_fini        (struct a09 *);
+extern bool                  pool_init          (struct a09 *);
+extern bool                  pool_add           (struct opcdata *);
+extern bool                  pool_place         (struct opcdata *);
+extern bool                  pool_check         (struct a09 *);
+extern bool                  pool_fini          (struct a09 *);
+extern bool                  delay_gen          (struct opcdata *);
+extern bool                  timing_init        (struct a09 *);
+extern bool                  timing_start       (struct opcdata *);
+extern bool                  timing_end         (struct opcdata *);
+extern void                  timing_add         (struct a09 *,size_t,size_t);
+extern void                  timing_record      (struct opcdata *);
+extern bool                  timing_check       (struct a09 *);
+extern bool                  timing_fini        (struct a09 *);
 
 /**************************************************************************/
 
@@ -0,0 +1,275 @@
+/****************************************************************************
+*
+*   Generate code for a delay of an exact number of cycles
+*   Copyright (C) 2023 Sean Conner
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*   Comments, questions and criticisms can be sent to: sean@conman.org
+*
+****************************************************************************/
+
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "a09.h"
+
+#define PADMAX 512
+
+/*--------------------------------------------------------------------------
+; The delay is made from at most one counted loop and some padding, and is
+; assembled as ordinary source lines so the listing shows each instruction
+; with its cycles.  The cycle counts here have to match those in opcodes.c.
+;--------------------------------------------------------------------------*/
+
+struct delaypad
+{
+  char const    *text;
+  unsigned char  cycles;
+  unsigned char  bytes;
+};
+
+struct delayloop
+{
+  char           reg;
+  char const    *load;
+  char const    *step;
+  char const    *branch;
+  unsigned char  setup;   /* cycles to load the count */
+  unsigned char  iter;    /* cycles per time around */
+  unsigned char  bytes;
+  unsigned long  max;     /* a count of 0 goes around this many times */
+};
+
+struct delaycost
+{
+  unsigned short bytes;
+  unsigned short insns;
+  unsigned char  pad;     /* last padding used, or 255 if impossible */
+};
+
+static struct delaypad const pads[] =
+{
+  { "NOP"      , 2 , 1 } ,
+  { "BRN\t*+2" , 3 , 2 } ,
+  { "EXG\tX,X" , 8 , 2 } ,
+};
+
+static struct delayloop const loops[] =
+{
+  { 'A' , "LDA" , "DECA"       , "BNE\t*-1" , 2 , 5 , 5 ,   256ul } ,
+  { 'B' , "LDB" , "DECB"       , "BNE\t*-1" , 2 , 5 , 5 ,   256ul } ,
+  { 'D' , "LDD" , "SUBD\t#1"   , "BNE\t*-3" , 3 , 7 , 8 , 65536ul } ,
+  { 'X' , "LDX" , "LEAX\t-1,X" , "BNE\t*-2" , 3 , 8 , 7 , 65536ul } ,
+  { 'Y' , "LDY" , "LEAY\t-1,Y" , "BNE\t*-2" , 4 , 8 , 8 , 65536ul } ,
+};
+
+/**************************************************************************/
+
+static void delay_pads(struct delaycost *cost)
+{
+  assert(cost != NULL);
+  
+  cost[0] = (struct delaycost){ .bytes = 0 , .insns = 0 , .pad = 0 };
+  
+  for (size_t n = 1 ; n <= PADMAX ; n++)
+  {
+    cost[n] = (struct delaycost){ .bytes = 0 , .insns = 0 , .pad = 255 };
+    
+    for (size_t p = 0 ; p < sizeof(pads) / sizeof(pads[0]) ; p++)
+    {
+      struct delaycost const *prev;
+      
+      if (pads[p].cycles > n)
+        continue;
+      prev = &cost[n - pads[p].cycles];
+      if (prev->pad == 255)
+        continue;
+        
+      if (
+              (cost[n].pad == 255)
+           || (prev->bytes + pads[p].bytes < cost[n].bytes)
+           || ((prev->bytes + pads[p].bytes == cost[n].bytes) && (prev->insns + 1u < cost[n].insns))
+         )
+      {
+        cost[n].bytes = prev->bytes + pads[p].bytes;
+        cost[n].insns = prev->insns + 1;
+        cost[n].pad   = p;
+      }
+    }
+  }
+}
+
+/**************************************************************************/
+
+static bool delay_line(struct opcdata *opd,char const *fmt,...) __attribute__((format(printf,2,3)));
+
+static bool delay_line(struct opcdata *opd,char const *fmt,...)
+{
+  assert(opd      != NULL);
+  assert(opd->a09 != NULL);
+  assert(fmt      != NULL);
+  
+  struct a09 *a09 = opd->a09;
+  va_list     args;
+  int         len;
+  
+  va_start(args,fmt);
+  len = vsnprintf(a09->inbuf.buf,sizeof(a09->inbuf.buf),fmt,args);
+  va_end(args);
+  
+  assert((len > 0) && ((size_t)len < sizeof(a09->inbuf.buf)));
+  a09->inbuf.widx = len;
+  a09->inbuf.ridx = 0;
+  return parse_line(a09,&a09->inbuf,opd->pass);
+}
+
+/**************************************************************************/
+
+bool delay_gen(struct opcdata *opd)
+{
+  assert(opd         != NULL);
+  assert(opd->a09    != NULL);
+  assert(opd->buffer != NULL);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  struct delaycost  cost[PADMAX + 1];
+  struct buffer     inbuf   = opd->a09->inbuf;
+  bool              use[sizeof(loops) / sizeof(loops[0])];
+  struct value      value;
+  unsigned long     cycles;
+  size_t            best    = SIZE_MAX; /* loop used, or SIZE_MAX for none */
+  unsigned long     count   = 0;
+  unsigned long     rest;
+  unsigned long     bytes   = ULONG_MAX;
+  unsigned long     insns   = ULONG_MAX;
+  bool              rc      = true;
+  char              c;
+  
+  memset(use,0,sizeof(use));
+  
+  if (!expr(&value,opd->a09,opd->buffer,opd->pass))
+    return false;
+  if (!value.defined || value.unknownpass1)
+    return message(opd->a09,MSG_ERROR,"E0108: value needed on pass 1 not defined on pass 1");
+  cycles = value.value;
+  
+  while(!isEOL(c = skip_space(opd->buffer)))
+  {
+    size_t r;
+    
+    if (c != ',')
+      return message(opd->a09,MSG_ERROR,"E0034: missing comma");
+    c = toupper(skip_space(opd->buffer));
+    for (r = 0 ; r < sizeof(loops) / sizeof(loops[0]) ; r++)
+      if (loops[r].reg == c)
+        break;
+    if ((r == sizeof(loops) / sizeof(loops[0])) || isLabel(opd->buffer->buf[opd->buffer->ridx]))
+      return message(opd->a09,MSG_ERROR,"E0073: bad register");
+    use[r] = true;
+  }
+  
+  if (cycles == 1)
+    return message(opd->a09,MSG_ERROR,"E0129: can't delay for exactly 1 cycle");
+    
+  /*-----------------------------------------------------------------------
+  ; Find the fewest bytes (then fewest instructions) over padding alone and
+  ; a loop on each register given followed by padding.  Only the last few
+  ; counts for a loop need trying, since anything less leaves more padding
+  ; than another time around the loop would take.
+  ;------------------------------------------------------------------------*/
+  
+  delay_pads(cost);
+  
+  if ((cycles <= PADMAX) && (cost[cycles].pad != 255))
+  {
+    bytes = cost[cycles].bytes;
+    insns = cost[cycles].insns;
+  }
+  
+  for (size_t r = 0 ; r < sizeof(loops) / sizeof(loops[0]) ; r++)
+  {
+    unsigned long k;
+    
+    if (!use[r] || (cycles < (unsigned long)loops[r].setup + loops[r].iter))
+      continue;
+      
+    k = min((cycles - loops[r].setup) / loops[r].iter,loops[r].max);
+    
+    for (unsigned long tries = 0 ; (k > 0) && (tries < 16) ; k--,tries++)
+    {
+      unsigned long left = cycles - loops[r].setup - loops[r].iter * k;
+      
+      if ((left > PADMAX) || (cost[left].pad == 255))
+        continue;
+        
+      if (
+              (loops[r].bytes + cost[left].bytes < bytes)
+           || ((loops[r].bytes + cost[left].bytes == bytes) && (3u + cost[left].insns < insns))
+         )
+      {
+        bytes = loops[r].bytes + cost[left].bytes;
+        insns = 3u + cost[left].insns;
+        best  = r;
+        count = k;
+      }
+    }
+  }
+  
+  if (bytes == ULONG_MAX)
+    return message(opd->a09,MSG_ERROR,"E0130: delay of %lu cycles is too long for the registers given",cycles);
+    
+  if (opd->pass == 2)
+  {
+    print_list(opd->a09,opd,false);
+    opd->includehack = true;
+  }
+  
+  rest = cycles;
+  
+  if (best != SIZE_MAX)
+  {
+    struct delayloop const *loop = &loops[best];
+    
+    rest -= loop->setup + loop->iter * count;
+    rc    = delay_line(opd,"\t%s\t#%lu\t; %lu cycles in the loop",loop->load,count % loop->max,cycles - rest)
+         && delay_line(opd,"\t%s",loop->step)
+         && delay_line(opd,"\t%s",loop->branch);
+         
+    /*---------------------------------------------------------------------
+    ; The loop lines only count once towards any .CYCLES region, so add in
+    ; the rest of the times around.
+    ;----------------------------------------------------------------------*/
+    
+    if (rc && (opd->pass == 2))
+      timing_add(opd->a09,loop->iter * (count - 1),loop->iter * (count - 1));
+  }
+  
+  for (bool first = true ; rc && (rest > 0) ; first = false)
+  {
+    struct delaypad const *pad = &pads[cost[rest].pad];
+    
+    if (first)
+      rc = delay_line(opd,"\t%s\t; %lu cycles of padding",pad->text,rest);
+    else
+      rc = delay_line(opd,"\t%s",pad->text);
+    rest -= pad->cycles;
+  }
+  
+  opd->a09->inbuf = inbuf;
+  return rc;
+}
+
+/**************************************************************************/
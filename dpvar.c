@@ -0,0 +1,612 @@
+/****************************************************************************
+*
+*   Allocate variables to the direct page by how often they're used
+*   Copyright (C) 2023 Sean Conner
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*   Comments, questions and criticisms can be sent to: sean@conman.org
+*
+****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "a09.h"
+
+/*--------------------------------------------------------------------------
+; Whether a variable lands in the direct page changes the size of every
+; instruction that uses it, so it has to be known on pass 1 before the first
+; use.  To get there, the first .DPVAR on pass 1 scans the source (and any
+; included files) for all the .DPVAR directives and counts the references to
+; each, then hands out the direct page in order of use.
+;--------------------------------------------------------------------------*/
+
+struct dpvar
+{
+  label               name;
+  char const         *file;
+  size_t              line;
+  struct buffer       operand;
+  unsigned long       refs;     /* static references */
+  unsigned long long  hits;     /* reads and writes from the profile */
+  size_t              order;
+  uint16_t            size;
+  uint16_t            addr;
+  bool                direct;
+};
+
+struct dpvardata
+{
+  struct dpvar       *vars;
+  char const         *infile;
+  size_t              nvars;
+  size_t              bytes;
+  size_t              cycles;
+  unsigned char       used[256]; /* pool bytes given to a variable */
+  unsigned char       page;
+  bool                allocated;
+  bool                counting;
+};
+
+/**************************************************************************/
+
+static int dpvarcmp(void const *restrict needle,void const *restrict haystack)
+{
+  struct dpvar const *l = needle;
+  struct dpvar const *r = haystack;
+  
+  if (l->hits > r->hits)
+    return -1;
+  else if (l->hits < r->hits)
+    return 1;
+  else if (l->refs > r->refs)
+    return -1;
+  else if (l->refs < r->refs)
+    return 1;
+  else if (l->order < r->order)
+    return -1;
+  else if (l->order > r->order)
+    return 1;
+  else
+    return 0;
+}
+
+/**************************************************************************/
+
+static struct dpvar *dpvar_find(struct dpvardata *data,label const *name)
+{
+  assert(data != NULL);
+  assert(name != NULL);
+  
+  for (size_t i = 0 ; i < data->nvars ; i++)
+    if ((data->vars[i].name.len == name->len) && (memcmp(data->vars[i].name.text,name->text,name->len) == 0))
+      return &data->vars[i];
+  return NULL;
+}
+
+/**************************************************************************/
+
+static void dpvar_count(struct a09 *a09,struct dpvardata *data,struct buffer *buffer)
+{
+  assert(a09    != NULL);
+  assert(data   != NULL);
+  assert(buffer != NULL);
+  
+  char quote = '\0';
+  char prev  = ' ';
+  char c     = skip_space(buffer);
+  
+  /*-----------------------------------------------------------------------
+  ; The operand ends at the first space outside of a string; anything after
+  ; that is a comment.  A label can't start in the middle of a number or
+  ; character constant, so the 'F' in '$1F' isn't one.
+  ;------------------------------------------------------------------------*/
+  
+  while(c != '\0')
+  {
+    if (quote != '\0')
+    {
+      if (c == quote)
+        quote = '\0';
+    }
+    else if (isspace(c) || (c == ';'))
+      break;
+    else if (c == '"')
+      quote = c;
+    else if (isID(c) && !isalnum(prev) && (strchr("_.$'",prev) == NULL))
+    {
+      struct dpvar *var;
+      label         name;
+      
+      buffer->ridx--;
+      parse_label(&name,buffer,a09,2);
+      var = dpvar_find(data,&name);
+      if (var != NULL)
+        var->refs++;
+      prev = 'x';
+      c    = buffer->buf[buffer->ridx++];
+      continue;
+    }
+    
+    prev = c;
+    c    = buffer->buf[buffer->ridx++];
+  }
+}
+
+/**************************************************************************/
+
+static FILE *dpvar_open(struct a09 *a09,char const *name,char const **path)
+{
+  assert(a09  != NULL);
+  assert(name != NULL);
+  assert(path != NULL);
+  
+  static char  incfile[FILENAME_MAX];
+  FILE        *fp = fopen(name,"r");
+  
+  *path = name;
+  
+  for (size_t i = 0 ; (fp == NULL) && (i < a09->nincs) ; i++)
+  {
+    snprintf(incfile,sizeof(incfile),"%s/%s",a09->includes[i],name);
+    fp    = fopen(incfile,"r");
+    *path = incfile;
+  }
+  
+  return fp;
+}
+
+/**************************************************************************/
+
+static bool dpvar_scan(struct a09 *a09,struct dpvardata *data,char const *filename,FILE *fp)
+{
+  assert(a09      != NULL);
+  assert(data     != NULL);
+  assert(filename != NULL);
+  assert(fp       != NULL);
+  
+  struct buffer buffer;
+  size_t        lnum = 0;
+  
+  while(!feof(fp))
+  {
+    struct opcode const *op;
+    label                name;
+    bool                 labeled;
+    char                 c;
+    
+    if (!read_line(a09,fp,&buffer))
+      return false;
+    lnum++;
+    
+    labeled = parse_label(&name,&buffer,a09,2);
+    if (labeled)
+    {
+      char *p    = memchr(name.text,'.',name.len);
+      a09->label = name;
+      if (p != NULL)
+        a09->label.len = (unsigned char)(p - name.text);
+    }
+    
+    c = skip_space(&buffer);
+    if (isEOL(c))
+      continue;
+    buffer.ridx--;
+    if (!parse_op(&buffer,&op))
+      continue;
+      
+    if (strcmp(op->name,"INCLUDE") == 0)
+    {
+      struct buffer  incname;
+      char const    *path;
+      FILE          *inc;
+      bool           rc;
+      
+      if (!parse_string(a09,&incname,&buffer))
+        return false;
+      assert(incname.widx < sizeof(incname.buf));
+      incname.buf[incname.widx] = '\0';
+      inc = dpvar_open(a09,incname.buf,&path);
+      if (inc == NULL)
+        return message(a09,MSG_ERROR,"E0042: %s: '%s'",incname.buf,strerror(errno));
+      path = add_file_dep(a09,path);
+      if (path == NULL)
+      {
+        fclose(inc);
+        return false;
+      }
+      rc = dpvar_scan(a09,data,path,inc);
+      fclose(inc);
+      if (!rc)
+        return false;
+    }
+    else if (data->counting)
+      dpvar_count(a09,data,&buffer);
+    else if (strcmp(op->name,".DPVAR") == 0)
+    {
+      struct dpvar *var;
+      
+      if (!labeled)
+        continue;
+        
+      var = realloc(data->vars,(data->nvars + 1) * sizeof(struct dpvar));
+      if (var == NULL)
+        return message(a09,MSG_ERROR,"E0046: out of memory");
+        
+      data->vars   = var;
+      var          = &data->vars[data->nvars];
+      var->name    = name;
+      var->file    = filename;
+      var->line    = lnum;
+      var->operand = buffer;
+      var->refs    = 0;
+      var->hits    = 0;
+      var->order   = data->nvars++;
+      var->size    = 0;
+      var->addr    = 0;
+      var->direct  = false;
+    }
+  }
+  
+  return true;
+}
+
+/**************************************************************************/
+
+static bool dpvar_profile(struct a09 *a09,struct dpvardata *data)
+{
+  assert(a09         != NULL);
+  assert(a09->dpfile != NULL);
+  assert(data        != NULL);
+  
+  char  line[BUFSIZ];
+  FILE *fp = fopen(a09->dpfile,"r");
+  
+  if (fp == NULL)
+    return message(a09,MSG_ERROR,"E0070: %s: %s",a09->dpfile,strerror(errno));
+    
+  /*-----------------------------------------------------------------------
+  ; This reads the memory heat map written by -H.  Only the per-symbol lines
+  ; have six fields; the comments and per-page lines are skipped.
+  ;------------------------------------------------------------------------*/
+  
+  while(fgets(line,sizeof(line),fp) != NULL)
+  {
+    unsigned long long  fetch;
+    unsigned long long  read;
+    unsigned long long  write;
+    unsigned int        addr;
+    size_t              size;
+    char                sym[sizeof(((label *)0)->text) + 1];
+    struct dpvar       *var;
+    label               name;
+    
+    if (line[0] == '#')
+      continue;
+    if (sscanf(line,"%llu %llu %llu %x %zu %63s",&fetch,&read,&write,&addr,&size,sym) != 6)
+      continue;
+      
+    name.len = strlen(sym);
+    memcpy(name.text,sym,name.len);
+    var = dpvar_find(data,&name);
+    if (var != NULL)
+      var->hits = read + write;
+  }
+  
+  fclose(fp);
+  return true;
+}
+
+/**************************************************************************/
+
+static bool dpvar_alloc(struct a09 *a09,struct dpvardata *data)
+{
+  assert(a09  != NULL);
+  assert(data != NULL);
+  
+  char const *infile = a09->infile;
+  size_t      lnum   = a09->lnum;
+  label       saved  = a09->label;
+  uint16_t    low;
+  FILE       *fp;
+  bool        rc;
+  
+  if (strcmp(data->infile,"(stdin)") == 0)
+    return message(a09,MSG_ERROR,"E0121: .DPVAR can't be used when reading from stdin");
+    
+  data->allocated = true;
+  
+  for (int scan = 0 ; scan < 2 ; scan++)
+  {
+    fp = fopen(data->infile,"r");
+    if (fp == NULL)
+      return message(a09,MSG_ERROR,"E0070: %s: %s",data->infile,strerror(errno));
+    data->counting = scan == 1;
+    a09->label     = (label){ .len = 0 , .text = { '\0' } };
+    rc             = dpvar_scan(a09,data,data->infile,fp);
+    fclose(fp);
+    a09->label     = saved;
+    if (!rc)
+      return false;
+  }
+  
+  if (a09->dpfile != NULL)
+    if (!dpvar_profile(a09,data))
+      return false;
+      
+  /*-----------------------------------------------------------------------
+  ; The sizes can only use what's been defined before the first .DPVAR.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t i = 0 ; i < data->nvars ; i++)
+  {
+    struct dpvar *var   = &data->vars[i];
+    struct value  value = { .value = 1 , .defined = true };
+    char          c     = skip_space(&var->operand);
+    
+    if (!isEOL(c))
+    {
+      var->operand.ridx--;
+      a09->infile = var->file;
+      a09->lnum   = var->line;
+      rc          = expr(&value,a09,&var->operand,1);
+      if (rc && (!value.defined || value.unknownpass1))
+        rc = message(a09,MSG_ERROR,"E0108: value needed on pass 1 not defined on pass 1");
+      a09->infile = infile;
+      a09->lnum   = lnum;
+      if (!rc)
+        return false;
+    }
+    
+    var->size = value.value;
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; Busiest first, taking the first hole each will fit in.  The pool is the
+  ; current direct page, or what .OPT * DPPOOL gave.
+  ;------------------------------------------------------------------------*/
+  
+  if (a09->dppool >= 0)
+  {
+    data->page = (unsigned)a09->dppool >> 8;
+    low        = (unsigned)a09->dppool & 255;
+  }
+  else
+  {
+    data->page = a09->dp;
+    low        = 0;
+  }
+  
+  qsort(data->vars,data->nvars,sizeof(struct dpvar),dpvarcmp);
+  
+  for (size_t i = 0 ; i < data->nvars ; i++)
+  {
+    struct dpvar *var = &data->vars[i];
+    
+    if ((var->size == 0) || (var->size > 256 - low))
+      continue;
+      
+    for (size_t addr = low ; addr + var->size <= 256 ; addr++)
+    {
+      size_t n = 0;
+      
+      while((n < var->size) && !data->used[addr + n])
+        n++;
+      if (n == var->size)
+      {
+        memset(&data->used[addr],1,var->size);
+        var->addr   = data->page * 256 + addr;
+        var->direct = true;
+        break;
+      }
+      addr += n;
+    }
+  }
+  
+  return true;
+}
+
+/**************************************************************************/
+
+bool dpvar_init(struct a09 *a09)
+{
+  assert(a09 != NULL);
+  
+  a09->dpvars = calloc(1,sizeof(struct dpvardata));
+  if (a09->dpvars == NULL)
+    return message(a09,MSG_ERROR,"E0046: out of memory");
+  a09->dpvars->infile = a09->infile;
+  return true;
+}
+
+/**************************************************************************/
+
+bool dpvar_place(struct opcdata *opd,uint16_t *addr,bool *direct)
+{
+  assert(opd              != NULL);
+  assert(opd->a09         != NULL);
+  assert(opd->a09->dpvars != NULL);
+  assert(addr             != NULL);
+  assert(direct           != NULL);
+  
+  struct dpvardata *data = opd->a09->dpvars;
+  struct dpvar     *var;
+  
+  if (!data->allocated)
+    if (!dpvar_alloc(opd->a09,data))
+      return false;
+      
+  var = dpvar_find(data,&opd->label);
+  if ((var == NULL) || !var->direct)
+  {
+    *direct = false;
+    return true;
+  }
+  
+  *addr   = var->addr;
+  *direct = true;
+  return true;
+}
+
+/**************************************************************************/
+
+bool dpvar_record(struct opcdata *opd)
+{
+  assert(opd              != NULL);
+  assert(opd->a09         != NULL);
+  assert(opd->a09->dpvars != NULL);
+  assert(opd->pass        == 2);
+  
+  struct dpvardata *data = opd->a09->dpvars;
+  
+  /*-----------------------------------------------------------------------
+  ; Every direct access to a variable would have been a byte longer and a
+  ; cycle slower if extended.
+  ;------------------------------------------------------------------------*/
+  
+  if (
+          (data->nvars > 0)
+       && (opd->op->cycles > 0)
+       && (opd->mode == AM_DIRECT)
+       && ((opd->value.value >> 8) == data->page)
+       && data->used[opd->value.value & 255]
+     )
+  {
+    data->bytes++;
+    data->cycles++;
+  }
+  
+  return true;
+}
+
+/**************************************************************************/
+
+bool dpvar_direct(
+        struct a09 *a09,
+        size_t     *pn,
+        label      *name,
+        uint16_t   *addr,
+        uint16_t   *size
+)
+{
+  assert(a09  != NULL);
+  assert(pn   != NULL);
+  assert(name != NULL);
+  assert(addr != NULL);
+  assert(size != NULL);
+  
+  struct dpvardata *data = a09->dpvars;
+  
+  /*-----------------------------------------------------------------------
+  ; Step through the variables placed in the direct page, starting at *pn.
+  ; Their labels are EQUates, so the heat map has to ask for them here.
+  ;------------------------------------------------------------------------*/
+  
+  if (data == NULL)
+    return false;
+    
+  for ( ; *pn < data->nvars ; (*pn)++)
+  {
+    struct dpvar *var = &data->vars[*pn];
+    
+    if (var->direct)
+    {
+      *name = var->name;
+      *addr = var->addr;
+      *size = var->size;
+      return true;
+    }
+  }
+  
+  return false;
+}
+
+/**************************************************************************/
+
+bool dpvar_report(struct a09 *a09)
+{
+  assert(a09         != NULL);
+  assert(a09->dpvars != NULL);
+  
+  struct dpvardata   *data   = a09->dpvars;
+  char const         *infile = a09->infile;
+  size_t              lnum   = a09->lnum;
+  size_t              direct = 0;
+  unsigned long long  hits   = 0;
+  
+  if (data->nvars == 0)
+    return true;
+    
+  for (size_t i = 0 ; i < data->nvars ; i++)
+  {
+    struct dpvar *var = &data->vars[i];
+    
+    if (var->direct)
+    {
+      direct++;
+      hits += var->hits;
+    }
+    else
+    {
+      a09->infile = var->file;
+      a09->lnum   = var->line;
+      message(
+               a09,
+               MSG_NOTE,
+               "'%.*s' (%u bytes, %lu reference%s) doesn't fit the direct page",
+               var->name.len,var->name.text,
+               var->size,
+               var->refs,
+               var->refs == 1 ? "" : "s"
+             );
+    }
+  }
+  
+  a09->infile = infile;
+  a09->lnum   = 0;
+  message(
+           a09,
+           MSG_NOTE,
+           "%zu of %zu .DPVAR variables in page $%02X, saved %zu bytes and %zu cycles",
+           direct,
+           data->nvars,
+           data->page,
+           data->bytes,
+           data->cycles
+         );
+  if (a09->dpfile != NULL)
+    message(a09,MSG_NOTE,"about %llu cycles over the profiled run",hits);
+  a09->lnum = lnum;
+  return true;
+}
+
+/**************************************************************************/
+
+bool dpvar_fini(struct a09 *a09)
+{
+  assert(a09 != NULL);
+  
+  if (a09->dpvars != NULL)
+  {
+    free(a09->dpvars->vars);
+    free(a09->dpvars);
+    a09->dpvars = NULL;
+  }
+  return true;
+}
+
+/**************************************************************************/
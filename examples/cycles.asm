@@ -0,0 +1,27 @@
+
+;***************************************************************************
+; Example of checking cycle counts at assembly time with .CYCLES and
+; .ENDCYC.  Regions can nest, and a long conditional branch counts its
+; not taken time for the best case and its taken time for the worst.
+; GPL3+ Copyright (C) 2024 by Sean Conner.
+;***************************************************************************
+
+PIA		equ	$FF20
+
+		org	$1000
+
+start		.cycles
+hsync		lda	#$80
+		sta	PIA
+		.cycles
+		.delay	40 , b
+		.endcyc	40 , 40
+		clr	PIA
+		.endcyc	54 , 54
+
+		.cycles
+		deca
+		lbne	hsync
+		.endcyc	8 , 7
+		rts
+		end	start
@@ -0,0 +1,22 @@
+
+;***************************************************************************
+; Example of generating exact delays with .DELAY.  A short delay is just
+; padding; a longer one uses a loop on whichever register given makes for
+; the least code.
+; GPL3+ Copyright (C) 2024 by Sean Conner.
+;***************************************************************************
+
+PIA		equ	$FF20
+
+		org	$1000
+
+start		lda	#$80
+		sta	PIA
+		.delay	7
+		clr	PIA
+		.delay	1000 , b
+		sta	PIA
+		.delay	20000 , a , x
+		clr	PIA
+		rts
+		end	start
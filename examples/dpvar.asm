@@ -0,0 +1,42 @@
+
+;***************************************************************************
+; Example of placing variables in the direct page with .DPVAR.  The most
+; used ones are handed out first, and with only four bytes in the pool,
+; the buffer won't fit and ends up reserved at the current address.  The
+; GNUmakefile runs the test with '-H' and feeds the heat map back in with
+; '-D', checking that the direct variables got their hits.
+; GPL3+ Copyright (C) 2024 by Sean Conner.
+;***************************************************************************
+
+		org	$1000
+		setdp	$10
+	.opt	* dppool $10FC
+	.opt	test prot rw,$10FC,$10FF
+
+count		.dpvar
+flag		.dpvar
+ptr		.dpvar	2
+buffer		.dpvar	4
+	.opt	test prot rw,buffer,buffer + 3
+
+start		lda	#4
+		sta	flag
+		clr	count
+		ldx	#buffer
+		stx	ptr
+loop		lda	,x+
+		adda	count
+		sta	count
+		dec	flag
+		bne	loop
+		rts
+
+		.test	"sum"
+	.opt	test pokew buffer,$0102
+	.opt	test pokew buffer + 2,$0304
+		lbsr	start
+	.assert	@count = 10
+		rts
+		.endtst
+
+		end	start
@@ -0,0 +1,29 @@
+
+;***************************************************************************
+; Example of a .LAYOUT region.  Without a profile ('-V'), the blocks keep
+; their source order; with one, the busy blocks are moved next to each
+; other so more branches can be short.
+; GPL3+ Copyright (C) 2024 by Sean Conner.
+;***************************************************************************
+
+		org	$1000
+
+start		ldx	#0
+
+		.layout
+loop		leax	1,x
+		cmpx	#100
+		lbne	busy
+		lbra	done
+
+rarely		lda	#1
+		sta	,x
+		rts
+
+busy		nop
+		lbra	loop
+
+done		rts
+		.endlay
+
+		end	start
@@ -0,0 +1,26 @@
+
+;***************************************************************************
+; Example of pooling constant data with .INPOOL and .POOL.  "WORLD" is
+; found in the end of "HELLO WORLD", the repeated message is only stored
+; once, and the second table overlaps the end of the first.
+; GPL3+ Copyright (C) 2024 by Sean Conner.
+;***************************************************************************
+
+		org	$1000
+
+start		ldx	#hello
+		ldx	#world
+		ldx	#again
+		ldy	#tab1
+		ldu	#tab2
+		rts
+
+hello		.inpool	text , "HELLO WORLD" , 0
+world		.inpool	text , "WORLD" , 0
+again		.inpool	text , "HELLO WORLD" , 0
+tab1		.inpool	data , 1 , 2 , 3 , 4
+tab2		.inpool	data , 3 , 4 , 5
+
+		.pool	text
+		.pool	data
+		end	start
@@ -0,0 +1,1937 @@
+/****************************************************************************
+*
+*   Static control flow analysis of the assembled code
+*   Copyright (C) 2023 Sean Conner
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*   Comments, questions and criticisms can be sent to: sean@conman.org
+*
+****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "a09.h"
+
+#define NOBLOCK ((size_t)-1)
+
+#define COST_LOOP    0x01  /* a loop (or recursion) was only counted once */
+#define COST_LEAVES  0x02  /* still masked on a return or indirect jump */
+#define COST_UNKNOWN 0x04  /* an indirect jump or call wasn't counted */
+
+/**************************************************************************/
+
+enum flowkind
+{
+  FLOW_NEXT,    /* falls through to the next instruction */
+  FLOW_BRANCH,  /* conditional branch to a known address */
+  FLOW_JUMP,    /* unconditional jump to a known address */
+  FLOW_CALL,    /* call to a known address */
+  FLOW_ICALL,   /* call to an unknown address */
+  FLOW_IJUMP,   /* jump to an unknown address */
+  FLOW_RETURN,  /* RTS, RTI, PULS PC */
+};
+
+enum
+{
+  SCAN_IRQ,
+  SCAN_FIRQ,
+  SCAN_IRQCALL,   /* in a subroutine called with IRQ masked */
+  SCAN_FIRQCALL,  /* in a subroutine called with FIRQ masked */
+  SCAN_max
+};
+
+struct flowinsn
+{
+  char const    *file;
+  size_t         line;
+  size_t         cycles;  /* not taken, or the only count */
+  size_t         taken;   /* taken, or the worst count */
+  size_t         block;
+  uint16_t       addr;
+  uint16_t       target;
+  uint16_t       ref;     /* address the operand refers to */
+  enum flowkind  kind;
+  unsigned char  sz;
+  unsigned char  bytes[6];
+  bool           hasref;
+};
+
+struct flowdatum
+{
+  char const    *file;
+  size_t         line;
+  size_t         size;
+  uint16_t       addr;
+};
+
+struct flowword
+{
+  uint16_t       addr;
+  uint16_t       value;
+};
+
+struct flowblock
+{
+  size_t first;
+  size_t count;
+  size_t bytes;
+  size_t base;    /* cycles for all but the last instruction */
+  size_t next;    /* fall through block */
+  size_t target;  /* branch or jump block */
+};
+
+struct flowpath
+{
+  size_t best;
+  size_t worst;
+  bool   reach;
+};
+
+struct flowcost
+{
+  size_t  worst;
+  size_t  end;    /* last instruction on the worst path */
+  size_t  low;    /* depth of the outermost open block this used, if any */
+  uint8_t flags;
+  uint8_t state;
+};
+
+struct flowstack
+{
+  long    s;
+  long    u;
+  uint8_t flags;
+  uint8_t state;
+};
+
+struct flowdata
+{
+  struct flowinsn   *insns;
+  size_t             ninsns;
+  struct flowblock  *blocks;
+  size_t             nblocks;
+  bool              *entry;
+  bool              *root;
+  struct flowstack  *stack;
+  struct flowcost   *cost[SCAN_max];
+  size_t             depth;
+  struct symbol    **symbols;
+  size_t             nsymbols;
+  struct flowdatum  *data;
+  size_t             ndata;
+  struct flowword   *words;
+  size_t             nwords;
+  uint16_t          *roots;
+  size_t             nroots;
+};
+
+static struct flowstack flow_stack(struct flowdata *,size_t);
+
+/**************************************************************************/
+
+static int insncmp(void const *restrict needle,void const *restrict haystack)
+{
+  struct flowinsn const *key   = needle;
+  struct flowinsn const *value = haystack;
+  
+  if (key->addr < value->addr)
+    return -1;
+  else if (key->addr > value->addr)
+    return  1;
+  else if (key < value)
+    return -1;
+  else if (key > value)
+    return  1;
+  else
+    return  0;
+}
+
+/**************************************************************************/
+
+static int datumcmp(void const *restrict needle,void const *restrict haystack)
+{
+  struct flowdatum const *key   = needle;
+  struct flowdatum const *value = haystack;
+  
+  if (key->addr < value->addr)
+    return -1;
+  else if (key->addr > value->addr)
+    return  1;
+  else if (key < value)
+    return -1;
+  else if (key > value)
+    return  1;
+  else
+    return  0;
+}
+
+/**************************************************************************/
+
+static int wordcmp(void const *restrict needle,void const *restrict haystack)
+{
+  struct flowword const *key   = needle;
+  struct flowword const *value = haystack;
+  
+  if (key->addr < value->addr)
+    return -1;
+  else if (key->addr > value->addr)
+    return  1;
+  else
+    return  0;
+}
+
+/**************************************************************************/
+
+static size_t flow_find(struct flowdata const *flow,uint16_t addr)
+{
+  assert(flow != NULL);
+  
+  size_t low  = 0;
+  size_t high = flow->ninsns;
+  
+  while(low < high)
+  {
+    size_t mid = low + (high - low) / 2;
+    if (flow->insns[mid].addr < addr)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  
+  if ((low < flow->ninsns) && (flow->insns[low].addr == addr))
+    return low;
+  else
+    return NOBLOCK;
+}
+
+/**************************************************************************/
+
+static void flow_kind(struct flowinsn *insn,struct opcdata const *opd)
+{
+  assert(insn != NULL);
+  assert(opd  != NULL);
+  
+  unsigned char  page    = 0;
+  unsigned char  op      = insn->bytes[0];
+  unsigned char *operand = &insn->bytes[1];
+  uint16_t       next    = insn->addr + insn->sz;
+  
+  if ((op == 0x10) || (op == 0x11))
+  {
+    page    = op;
+    op      = insn->bytes[1];
+    operand = &insn->bytes[2];
+  }
+  
+  insn->kind   = FLOW_NEXT;
+  insn->target = 0;
+  
+  if (page == 0x10)
+  {
+    if ((op >= 0x22) && (op <= 0x2F))
+    {
+      insn->kind   = FLOW_BRANCH;
+      insn->target = next + ((operand[0] << 8) | operand[1]);
+    }
+  }
+  else if (page == 0)
+  {
+    switch(op)
+    {
+      case 0x20: /* BRA */
+           insn->kind   = FLOW_JUMP;
+           insn->target = next + (int8_t)operand[0];
+           break;
+           
+      case 0x8D: /* BSR */
+           insn->kind   = FLOW_CALL;
+           insn->target = next + (int8_t)operand[0];
+           break;
+           
+      case 0x16: /* LBRA */
+           insn->kind   = FLOW_JUMP;
+           insn->target = next + ((operand[0] << 8) | operand[1]);
+           break;
+           
+      case 0x17: /* LBSR */
+           insn->kind   = FLOW_CALL;
+           insn->target = next + ((operand[0] << 8) | operand[1]);
+           break;
+           
+      case 0x0E: /* JMP direct */
+           insn->kind   = FLOW_JUMP;
+           insn->target = (opd->a09->dp << 8) | operand[0];
+           break;
+           
+      case 0x7E: /* JMP extended */
+           insn->kind   = FLOW_JUMP;
+           insn->target = (operand[0] << 8) | operand[1];
+           break;
+           
+      case 0x9D: /* JSR direct */
+           insn->kind   = FLOW_CALL;
+           insn->target = (opd->a09->dp << 8) | operand[0];
+           break;
+           
+      case 0xBD: /* JSR extended */
+           insn->kind   = FLOW_CALL;
+           insn->target = (operand[0] << 8) | operand[1];
+           break;
+           
+      case 0x6E: /* JMP indexed */
+           insn->kind = FLOW_IJUMP;
+           break;
+           
+      case 0xAD: /* JSR indexed */
+           insn->kind = FLOW_ICALL;
+           break;
+           
+      case 0x39: /* RTS */
+      case 0x3B: /* RTI */
+           insn->kind = FLOW_RETURN;
+           break;
+           
+      case 0x35: /* PULS */
+           if ((operand[0] & 0x80) == 0x80)
+             insn->kind = FLOW_RETURN;
+           break;
+           
+      case 0x37: /* PULU */
+           if ((operand[0] & 0x80) == 0x80)
+             insn->kind = FLOW_IJUMP;
+           break;
+           
+      case 0x1F: /* TFR */
+           if ((operand[0] & 0x0F) == 0x05)
+             insn->kind = FLOW_IJUMP;
+           break;
+           
+      case 0x1E: /* EXG */
+           if (((operand[0] & 0xF0) == 0x50) || ((operand[0] & 0x0F) == 0x05))
+             insn->kind = FLOW_IJUMP;
+           break;
+           
+      default:
+           if ((op >= 0x22) && (op <= 0x2F))
+           {
+             insn->kind   = FLOW_BRANCH;
+             insn->target = next + (int8_t)operand[0];
+           }
+           break;
+    }
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; An external address isn't known until link time, so it's as good as an
+  ; indirect jump or call.
+  ;------------------------------------------------------------------------*/
+  
+  if (opd->value.external)
+  {
+    if (insn->kind == FLOW_JUMP)
+      insn->kind = FLOW_IJUMP;
+    else if (insn->kind == FLOW_CALL)
+      insn->kind = FLOW_ICALL;
+  }
+}
+
+/**************************************************************************/
+
+bool flow_init(struct a09 *a09)
+{
+  assert(a09 != NULL);
+  
+  a09->flow = calloc(1,sizeof(struct flowdata));
+  if (a09->flow == NULL)
+    return message(a09,MSG_ERROR,"E0046: out of memory");
+  return true;
+}
+
+/**************************************************************************/
+
+bool flow_record(struct opcdata *opd)
+{
+  assert(opd            != NULL);
+  assert(opd->a09       != NULL);
+  assert(opd->a09->flow != NULL);
+  assert(opd->pass      == 2);
+  
+  struct flowdata *flow = opd->a09->flow;
+  struct flowinsn *insn;
+  
+  if (test_intest(opd->a09))
+    return true;
+    
+  if (opd->data && (opd->datasz > 0))
+  {
+    struct flowdatum *datum = realloc(flow->data,(flow->ndata + 1) * sizeof(struct flowdatum));
+    if (datum == NULL)
+      return message(opd->a09,MSG_ERROR,"E0046: out of memory");
+      
+    flow->data  = datum;
+    datum       = &flow->data[flow->ndata++];
+    datum->file = opd->a09->infile;
+    datum->line = opd->a09->lnum;
+    datum->size = opd->datasz;
+    datum->addr = opd->a09->pc + opd->a09->phase;
+    return true;
+  }
+  
+  if (opd->data || (opd->sz == 0) || (opd->op->cycles == 0))
+    return true;
+    
+  insn = realloc(flow->insns,(flow->ninsns + 1) * sizeof(struct flowinsn));
+  if (insn == NULL)
+    return message(opd->a09,MSG_ERROR,"E0046: out of memory");
+    
+  flow->insns   = insn;
+  insn          = &flow->insns[flow->ninsns++];
+  insn->file    = opd->a09->infile;
+  insn->line    = opd->a09->lnum;
+  insn->addr    = opd->a09->pc + opd->a09->phase;
+  insn->sz      = opd->sz;
+  insn->cycles  = opd->cycles + opd->ecycles;
+  insn->taken   = opd->acycles > 0 ? opd->acycles + opd->ecycles : insn->cycles;
+  insn->block   = NOBLOCK;
+  insn->ref     = opd->pcrel ? (uint16_t)(insn->addr + insn->sz + opd->value.value) : opd->value.value;
+  insn->hasref  = opd->value.defined
+               && !opd->value.external
+               && (
+                       (opd->mode == AM_DIRECT)
+                    || (opd->mode == AM_EXTENDED)
+                    || (opd->mode == AM_INDEX)
+                    || ((opd->mode == AM_IMMED) && opd->op->bit16)
+                  );
+  memcpy(insn->bytes,opd->bytes,sizeof(insn->bytes));
+  flow_kind(insn,opd);
+  return true;
+}
+
+/**************************************************************************/
+
+bool flow_word(struct opcdata *opd,uint16_t value)
+{
+  assert(opd            != NULL);
+  assert(opd->a09       != NULL);
+  assert(opd->a09->flow != NULL);
+  assert(opd->pass      == 2);
+  assert(opd->datasz    >= 2);
+  
+  struct flowdata *flow = opd->a09->flow;
+  struct flowword *word;
+  
+  if (test_intest(opd->a09) || opd->value.external)
+    return true;
+    
+  word = realloc(flow->words,(flow->nwords + 1) * sizeof(struct flowword));
+  if (word == NULL)
+    return message(opd->a09,MSG_ERROR,"E0046: out of memory");
+    
+  flow->words = word;
+  word        = &flow->words[flow->nwords++];
+  word->addr  = opd->a09->pc + opd->a09->phase + opd->datasz - 2;
+  word->value = value;
+  return true;
+}
+
+/**************************************************************************/
+
+bool flow_root(struct a09 *a09,uint16_t addr)
+{
+  assert(a09       != NULL);
+  assert(a09->flow != NULL);
+  
+  struct flowdata *flow = a09->flow;
+  uint16_t        *root = realloc(flow->roots,(flow->nroots + 1) * sizeof(uint16_t));
+  
+  if (root == NULL)
+    return message(a09,MSG_ERROR,"E0046: out of memory");
+  flow->roots                 = root;
+  flow->roots[flow->nroots++] = addr;
+  return true;
+}
+
+/**************************************************************************/
+
+static bool flow_blocks(struct a09 *a09,struct flowdata *flow)
+{
+  assert(a09  != NULL);
+  assert(flow != NULL);
+  
+  bool *leader = calloc(flow->ninsns + 1,sizeof(bool));
+  
+  if (leader == NULL)
+    return message(a09,MSG_ERROR,"E0046: out of memory");
+    
+  /*-----------------------------------------------------------------------
+  ; A basic block starts at the first instruction, at any branch or jump
+  ; target, after any change of flow, and where the code isn't contiguous.
+  ; Calls return, so they don't end a block.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t i = 0 ; i < flow->ninsns ; i++)
+  {
+    struct flowinsn *insn = &flow->insns[i];
+    
+    if ((i == 0) || (flow->insns[i-1].addr + flow->insns[i-1].sz != insn->addr))
+      leader[i] = true;
+      
+    switch(insn->kind)
+    {
+      case FLOW_BRANCH:
+      case FLOW_JUMP:
+      case FLOW_CALL:
+           {
+             size_t t = flow_find(flow,insn->target);
+             if (t != NOBLOCK)
+               leader[t] = true;
+           }
+           if (insn->kind != FLOW_CALL)
+             leader[i + 1] = true;
+           break;
+           
+      case FLOW_IJUMP:
+      case FLOW_RETURN:
+           leader[i + 1] = true;
+           break;
+           
+      case FLOW_NEXT:
+      case FLOW_ICALL:
+           break;
+    }
+  }
+  
+  for (size_t i = 0 ; i < flow->ninsns ; i++)
+  {
+    struct flowblock *block;
+    
+    if (leader[i])
+    {
+      block = realloc(flow->blocks,(flow->nblocks + 1) * sizeof(struct flowblock));
+      if (block == NULL)
+      {
+        free(leader);
+        return message(a09,MSG_ERROR,"E0046: out of memory");
+      }
+      
+      flow->blocks  = block;
+      block         = &flow->blocks[flow->nblocks++];
+      block->first  = i;
+      block->count  = 0;
+      block->bytes  = 0;
+      block->base   = 0;
+      block->next   = NOBLOCK;
+      block->target = NOBLOCK;
+    }
+    else
+      block = &flow->blocks[flow->nblocks - 1];
+      
+    if (block->count > 0)
+      block->base += flow->insns[i-1].cycles;
+    block->count++;
+    block->bytes      += flow->insns[i].sz;
+    flow->insns[i].block = flow->nblocks - 1;
+  }
+  
+  free(leader);
+  
+  for (size_t b = 0 ; b < flow->nblocks ; b++)
+  {
+    struct flowblock *block = &flow->blocks[b];
+    size_t            last  = block->first + block->count - 1;
+    struct flowinsn  *insn  = &flow->insns[last];
+    
+    if ((insn->kind == FLOW_BRANCH) || (insn->kind == FLOW_JUMP))
+    {
+      size_t t = flow_find(flow,insn->target);
+      if (t != NOBLOCK)
+        block->target = flow->insns[t].block;
+    }
+    
+    if (
+            (insn->kind != FLOW_JUMP)
+         && (insn->kind != FLOW_IJUMP)
+         && (insn->kind != FLOW_RETURN)
+         && (last + 1 < flow->ninsns)
+         && (flow->insns[last + 1].addr == insn->addr + insn->sz)
+       )
+      block->next = b + 1;
+  }
+  
+  return true;
+}
+
+/**************************************************************************/
+
+static char const *flow_name(struct flowdata *flow,uint16_t addr,char *buf,size_t size)
+{
+  assert(flow != NULL);
+  assert(buf  != NULL);
+  
+  struct symbol *sym = symbol_nearest(flow->symbols,flow->nsymbols,addr);
+  
+  if (sym == NULL)
+    snprintf(buf,size,"$%04X",addr);
+  else if (sym->value == addr)
+    snprintf(buf,size,"%.*s",sym->name.len,sym->name.text);
+  else
+    snprintf(buf,size,"%.*s+%u",sym->name.len,sym->name.text,(unsigned)(addr - sym->value));
+  return buf;
+}
+
+/**************************************************************************/
+
+static void flow_path(
+        struct flowdata  *flow,
+        size_t const     *order,
+        size_t            norder,
+        bool const       *back,
+        bool const       *entry,
+        size_t            to,
+        struct flowpath  *path
+)
+{
+  assert(flow  != NULL);
+  assert(order != NULL);
+  assert(back  != NULL);
+  assert(entry != NULL);
+  assert(path  != NULL);
+  
+  /*-----------------------------------------------------------------------
+  ; With the back edges removed, the blocks form a DAG, and order[] is a
+  ; post order, so the successors of a block are done before the block.
+  ; With to set to NOBLOCK, this finds the best and worst paths to any
+  ; exit.  Otherwise, it's the best and worst paths to block to, taking its
+  ; back edge (back[] is indexed by block times two, plus one for the
+  ; taken edge).
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t i = 0 ; i < norder ; i++)
+  {
+    size_t            b     = order[i];
+    struct flowblock *block = &flow->blocks[b];
+    struct flowinsn  *last  = &flow->insns[block->first + block->count - 1];
+    size_t            succ[2];
+    size_t            cost[2];
+    
+    path[b].reach = false;
+    path[b].best  = SIZE_MAX;
+    path[b].worst = 0;
+    
+    succ[0] = block->next;
+    cost[0] = last->cycles;
+    succ[1] = block->target;
+    cost[1] = last->taken;
+    
+    if (to == NOBLOCK)
+    {
+      bool exits = (last->kind == FLOW_RETURN) || (last->kind == FLOW_IJUMP);
+      
+      if (((last->kind == FLOW_BRANCH) || (last->kind == FLOW_JUMP)) && (block->target == NOBLOCK))
+        exits = true;
+      if ((last->kind != FLOW_JUMP) && (last->kind != FLOW_IJUMP) && (last->kind != FLOW_RETURN) && (block->next == NOBLOCK))
+        exits = true;
+        
+      if (exits)
+      {
+        size_t lo = last->cycles < last->taken ? last->cycles : last->taken;
+        size_t hi = last->cycles > last->taken ? last->cycles : last->taken;
+        
+        path[b].reach = true;
+        path[b].best  = block->base + lo;
+        path[b].worst = block->base + hi;
+      }
+    }
+    else if (b == to)
+    {
+      /*-------------------------------------------------------------------
+      ; The loop closes along the back edge, the taken one if that's a back
+      ; edge (as the caller picks the loop head), otherwise falling through,
+      ; which costs the not taken count.
+      ;--------------------------------------------------------------------*/
+      
+      size_t e = back[b * 2 + 1] ? 1 : 0;
+      
+      path[b].reach = true;
+      path[b].best  = block->base + cost[e];
+      path[b].worst = block->base + cost[e];
+      continue;
+    }
+    
+    for (size_t e = 0 ; e < 2 ; e++)
+    {
+      if ((succ[e] == NOBLOCK) || back[b * 2 + e])
+        continue;
+        
+      /*------------------------------------------------------------------
+      ; Flowing into another subroutine's entry point is a tail call, and
+      ; ends this path.
+      ;-------------------------------------------------------------------*/
+      
+      if (entry[succ[e]])
+      {
+        if (to == NOBLOCK)
+        {
+          path[b].reach = true;
+          if (block->base + cost[e] < path[b].best)
+            path[b].best = block->base + cost[e];
+          if (block->base + cost[e] > path[b].worst)
+            path[b].worst = block->base + cost[e];
+        }
+        continue;
+      }
+      
+      if (!path[succ[e]].reach)
+        continue;
+        
+      path[b].reach = true;
+      if (block->base + cost[e] + path[succ[e]].best < path[b].best)
+        path[b].best = block->base + cost[e] + path[succ[e]].best;
+      if (block->base + cost[e] + path[succ[e]].worst > path[b].worst)
+        path[b].worst = block->base + cost[e] + path[succ[e]].worst;
+    }
+  }
+}
+
+/**************************************************************************/
+
+static bool flow_subroutine(
+        struct a09      *a09,
+        struct flowdata *flow,
+        FILE            *out,
+        size_t           start,
+        bool const      *entry,
+        uint8_t         *color,
+        size_t          *order,
+        size_t          *stack,
+        bool            *back,
+        struct flowpath *path
+)
+{
+  assert(a09   != NULL);
+  assert(flow  != NULL);
+  assert(out   != NULL);
+  assert(entry != NULL);
+  assert(color != NULL);
+  assert(order != NULL);
+  assert(stack != NULL);
+  assert(back  != NULL);
+  assert(path  != NULL);
+  
+  struct flowinsn *first  = &flow->insns[flow->blocks[start].first];
+  size_t           norder = 0;
+  size_t           sp     = 0;
+  size_t           bytes  = 0;
+  bool             icall  = false;
+  char             name[80];
+  char             tname[80];
+  
+  /*-----------------------------------------------------------------------
+  ; A depth first search from the entry point, not following calls or
+  ; flowing into other entry points.  An edge to a block still on the
+  ; stack (color 1) is a back edge, which closes a loop.  Each stack entry
+  ; is a block times three, plus the next edge to look at (2 is done).
+  ;------------------------------------------------------------------------*/
+  
+  memset(color,0,flow->nblocks);
+  memset(back,0,flow->nblocks * 2 * sizeof(bool));
+  
+  color[start]  = 1;
+  stack[sp++]   = start * 3;
+  
+  while(sp > 0)
+  {
+    size_t b = stack[sp - 1] / 3;
+    size_t e = stack[sp - 1] % 3;
+    size_t succ;
+    
+    if (e == 2)
+    {
+      sp--;
+      color[b]        = 2;
+      order[norder++] = b;
+      continue;
+    }
+    
+    stack[sp - 1]++;
+    succ = e == 0 ? flow->blocks[b].next : flow->blocks[b].target;
+    
+    if ((succ == NOBLOCK) || entry[succ])
+      continue;
+      
+    if (color[succ] == 1)
+      back[b * 2 + e] = true;
+    else if (color[succ] == 0)
+    {
+      color[succ] = 1;
+      stack[sp++] = succ * 3;
+    }
+  }
+  
+  flow_path(flow,order,norder,back,entry,NOBLOCK,path);
+  
+  for (size_t i = 0 ; i < norder ; i++)
+    bytes += flow->blocks[order[i]].bytes;
+    
+  fprintf(
+        out,
+        "\nsubroutine %s %s:%zu $%04X %zu bytes",
+        flow_name(flow,first->addr,name,sizeof(name)),
+        first->file,
+        first->line,
+        first->addr,
+        bytes
+  );
+  
+  if (path[start].reach)
+    fprintf(out," %zu-%zu cycles\n",path[start].best,path[start].worst);
+  else
+    fprintf(out," no exit\n");
+    
+  /*-----------------------------------------------------------------------
+  ; List what's called, as the cycles above don't include them.
+  ;------------------------------------------------------------------------*/
+  
+  fprintf(out,"  calls:");
+  for (size_t i = norder ; i-- > 0 ; )
+  {
+    struct flowblock *block = &flow->blocks[order[i]];
+    
+    for (size_t j = block->first ; j < block->first + block->count ; j++)
+    {
+      if (flow->insns[j].kind == FLOW_CALL)
+        fprintf(out," %s",flow_name(flow,flow->insns[j].target,tname,sizeof(tname)));
+      else if (flow->insns[j].kind == FLOW_ICALL)
+        icall = true;
+    }
+  }
+  fprintf(out,"%s\n",icall ? " (indirect)" : "");
+  
+  for (size_t i = norder ; i-- > 0 ; )
+  {
+    struct flowblock *block = &flow->blocks[order[i]];
+    struct flowinsn  *head  = &flow->insns[block->first];
+    struct flowinsn  *last  = &flow->insns[block->first + block->count - 1];
+    size_t            lo    = last->cycles < last->taken ? last->cycles : last->taken;
+    size_t            hi    = last->cycles > last->taken ? last->cycles : last->taken;
+    
+    fprintf(
+          out,
+          "  block $%04X %s:%zu-%zu %zu bytes %zu-%zu cycles",
+          head->addr,
+          head->file,
+          head->line,
+          last->line,
+          block->bytes,
+          block->base + lo,
+          block->base + hi
+    );
+    
+    if (block->next != NOBLOCK)
+      fprintf(out," next $%04X",flow->insns[flow->blocks[block->next].first].addr);
+    if (block->target != NOBLOCK)
+      fprintf(out," %s $%04X",last->kind == FLOW_BRANCH ? "branch" : "jump",last->target);
+    else if ((last->kind == FLOW_BRANCH) || (last->kind == FLOW_JUMP))
+      fprintf(out," %s $%04X (outside)",last->kind == FLOW_BRANCH ? "branch" : "jump",last->target);
+    else if (last->kind == FLOW_IJUMP)
+      fprintf(out," jump (indirect)");
+    else if (last->kind == FLOW_RETURN)
+      fprintf(out," return");
+    fputc('\n',out);
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; Each back edge closes a loop.  The body is everything on a path from
+  ; the loop head to the back edge, and the cost per iteration includes
+  ; taking the back edge.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t i = norder ; i-- > 0 ; )
+  {
+    size_t b = order[i];
+    
+    if (!back[b * 2] && !back[b * 2 + 1])
+      continue;
+      
+    struct flowblock *block = &flow->blocks[b];
+    struct flowinsn  *last  = &flow->insns[block->first + block->count - 1];
+    size_t            head  = back[b * 2 + 1] ? block->target : block->next;
+    struct flowinsn  *hinsn = &flow->insns[flow->blocks[head].first];
+    size_t            nbody = 0;
+    size_t            bbody = 0;
+    
+    flow_path(flow,order,norder,back,entry,b,path);
+    
+    /*--------------------------------------------------------------------
+    ; The body is what can reach the back edge and is reachable from the
+    ; head.  Going through order[] backwards is a topological order, so
+    ; color[] (done with by now) marks what the head reaches.
+    ;---------------------------------------------------------------------*/
+    
+    memset(color,0,flow->nblocks);
+    color[head] = 1;
+    for (size_t j = norder ; j-- > 0 ; )
+    {
+      size_t            c  = order[j];
+      struct flowblock *cb = &flow->blocks[c];
+      
+      if ((color[c] == 0) || !path[c].reach)
+        continue;
+        
+      nbody++;
+      bbody += cb->bytes;
+      
+      if ((cb->next != NOBLOCK) && !back[c * 2] && !entry[cb->next])
+        color[cb->next] = 1;
+      if ((cb->target != NOBLOCK) && !back[c * 2 + 1] && !entry[cb->target])
+        color[cb->target] = 1;
+    }
+      
+    fprintf(
+          out,
+          "  loop $%04X %s:%zu-%zu %zu blocks %zu bytes %zu-%zu cycles/iteration\n",
+          hinsn->addr,
+          hinsn->file,
+          hinsn->line,
+          last->line,
+          nbody,
+          bbody,
+          path[head].best,
+          path[head].worst
+    );
+  }
+  
+  return true;
+}
+
+/**************************************************************************/
+
+static bool flow_unmasks(struct flowinsn const *insn,int scan)
+{
+  assert(insn != NULL);
+  assert(scan < SCAN_max);
+  
+  unsigned char mask = (scan == SCAN_IRQ) || (scan == SCAN_IRQCALL) ? 0x10 : 0x40;
+  unsigned char pb   = insn->bytes[1];
+  
+  /*-----------------------------------------------------------------------
+  ; Anything that clears the mask bit, or that restores CC (and thus
+  ; probably the mask from before) ends a masked region.  In a called
+  ; subroutine, restoring CC restores the caller's mask, so only clearing
+  ; the bit counts.
+  ;------------------------------------------------------------------------*/
+  
+  if ((scan == SCAN_IRQCALL) || (scan == SCAN_FIRQCALL))
+    if ((insn->bytes[0] != 0x1C) && (insn->bytes[0] != 0x3C))
+      return false;
+      
+  switch(insn->bytes[0])
+  {
+    case 0x1C: return (pb & mask) == 0;        /* ANDCC */
+    case 0x3C: return (pb & mask) == 0;        /* CWAI  */
+    case 0x35: return (pb & 0x01) == 0x01;     /* PULS CC */
+    case 0x3B: return true;                    /* RTI   */
+    case 0x1F: return (pb & 0x0F) == 0x0A;     /* TFR r,CC */
+    case 0x1E: return ((pb & 0x0F) == 0x0A) || ((pb & 0xF0) == 0xA0); /* EXG */
+    default:   return false;
+  }
+}
+
+/**************************************************************************/
+
+static struct flowcost flow_worst(struct flowdata *flow,size_t i,int scan)
+{
+  assert(flow != NULL);
+  assert(i    <  flow->ninsns);
+  assert(scan <  SCAN_max);
+  
+  size_t            b      = flow->insns[i].block;
+  struct flowblock *block  = &flow->blocks[b];
+  size_t            last   = block->first + block->count - 1;
+  struct flowcost  *memo   = block->first == i ? &flow->cost[scan][b] : NULL;
+  struct flowcost   res    = { .worst = 0 , .end = last , .low = SIZE_MAX , .flags = 0 , .state = 2 };
+  size_t            depth  = flow->depth;
+  bool              call   = (scan == SCAN_IRQCALL) || (scan == SCAN_FIRQCALL);
+  bool              done   = false;
+  
+  /*-----------------------------------------------------------------------
+  ; The worst case cycles from instruction i until the given interrupt is
+  ; unmasked, or in a called subroutine, until it returns.  Calls include
+  ; the worst case of what's called.  A block still being worked on has
+  ; been looped back to; it's counted once.  Results are kept per block,
+  ; but only once they no longer depend on a block still being worked on,
+  ; since that one was cut short.
+  ;------------------------------------------------------------------------*/
+  
+  if (memo != NULL)
+  {
+    if (memo->state == 2)
+      return *memo;
+    if (memo->state == 1)
+      return (struct flowcost){ .worst = 0 , .end = i , .low = memo->low , .flags = COST_LOOP , .state = 2 };
+    memo->state = 1;
+    memo->low   = depth;
+    flow->depth++;
+  }
+  
+  for ( ; !done && (i <= last) ; i++)
+  {
+    struct flowinsn *insn = &flow->insns[i];
+    size_t           hi   = insn->cycles > insn->taken ? insn->cycles : insn->taken;
+    
+    if (flow_unmasks(insn,scan))
+    {
+      res.worst += hi;
+      res.end    = i;
+      done       = true;
+    }
+    else if (insn->kind == FLOW_CALL)
+    {
+      size_t t = flow_find(flow,insn->target);
+      
+      res.worst += hi;
+      if (t != NOBLOCK)
+      {
+        struct flowcost sub = flow_worst(flow,t,call ? scan : scan + SCAN_IRQCALL - SCAN_IRQ);
+        res.worst += sub.worst;
+        res.low    = min(res.low,sub.low);
+        res.flags |= sub.flags & (COST_LOOP | COST_UNKNOWN);
+      }
+      else
+        res.flags |= COST_UNKNOWN;
+    }
+    else if (insn->kind == FLOW_ICALL)
+    {
+      res.worst += hi;
+      res.flags |= COST_UNKNOWN;
+    }
+    else if (i < last)
+      res.worst += hi;
+  }
+  
+  if (!done)
+  {
+    struct flowinsn *insn = &flow->insns[last];
+    size_t           base = res.worst;
+    size_t           succ[2];
+    size_t           cost[2];
+    
+    succ[0] = block->next   != NOBLOCK ? flow->blocks[block->next].first   : NOBLOCK;
+    succ[1] = block->target != NOBLOCK ? flow->blocks[block->target].first : NOBLOCK;
+    cost[0] = insn->cycles;
+    cost[1] = insn->taken;
+    
+    if ((insn->kind == FLOW_RETURN) || (insn->kind == FLOW_IJUMP))
+    {
+      res.worst += insn->cycles > insn->taken ? insn->cycles : insn->taken;
+      if (!call)
+        res.flags |= COST_LEAVES;
+      if (insn->kind == FLOW_IJUMP)
+        res.flags |= COST_UNKNOWN;
+    }
+    else if (((insn->kind == FLOW_BRANCH) || (insn->kind == FLOW_JUMP)) && (succ[1] == NOBLOCK))
+    {
+      res.worst += insn->taken;
+      res.flags |= COST_UNKNOWN;
+    }
+    
+    for (size_t e = 0 ; e < 2 ; e++)
+    {
+      if (succ[e] == NOBLOCK)
+        continue;
+        
+      struct flowcost sub = flow_worst(flow,succ[e],scan);
+      
+      res.low    = min(res.low,sub.low);
+      res.flags |= sub.flags;
+      if (base + cost[e] + sub.worst >= res.worst)
+      {
+        res.worst = base + cost[e] + sub.worst;
+        res.end   = sub.end;
+      }
+    }
+  }
+  
+  if (memo != NULL)
+  {
+    flow->depth--;
+    if (res.low >= depth)
+    {
+      res.low = SIZE_MAX;
+      *memo   = res;
+    }
+    else
+      memo->state = 0;
+  }
+  
+  return res;
+}
+
+/**************************************************************************/
+
+static bool flow_masked(struct a09 *a09,struct flowdata *flow,FILE *out)
+{
+  assert(a09  != NULL);
+  assert(flow != NULL);
+  
+  static char const *const names[] = { "IRQ" , "FIRQ" };
+  
+  char const *infile = a09->infile;
+  
+  for (size_t s = 0 ; s < SCAN_max ; s++)
+  {
+    flow->cost[s] = calloc(flow->nblocks + 1,sizeof(struct flowcost));
+    if (flow->cost[s] == NULL)
+      return message(a09,MSG_ERROR,"E0046: out of memory");
+  }
+  
+  if (out != NULL)
+    fprintf(out,"\n# interrupt masked regions, worst case cycles from ORCC to unmasking\n");
+    
+  /*-----------------------------------------------------------------------
+  ; Each ORCC that sets I or F starts a region, which is followed along
+  ; every path (including into called subroutines) until the mask is
+  ; cleared, or CC is restored.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t i = 0 ; i < flow->ninsns ; i++)
+  {
+    struct flowinsn *insn = &flow->insns[i];
+    
+    if (insn->bytes[0] != 0x1A) /* ORCC */
+      continue;
+      
+    for (int s = SCAN_IRQ ; s <= SCAN_FIRQ ; s++)
+    {
+      unsigned char   mask = s == SCAN_IRQ ? 0x10 : 0x40;
+      struct flowcost cost;
+      struct flowinsn *end;
+      char             name[80];
+      
+      if ((insn->bytes[1] & mask) == 0)
+        continue;
+        
+      /*-----------------------------------------------------------------
+      ; If the ORCC ends its block, the region carries on in the block it
+      ; falls into, if any.
+      ;------------------------------------------------------------------*/
+      
+      if ((i + 1 < flow->ninsns) && (flow->insns[i + 1].block == insn->block))
+        cost = flow_worst(flow,i + 1,s);
+      else if (flow->blocks[insn->block].next != NOBLOCK)
+        cost = flow_worst(flow,flow->blocks[flow->blocks[insn->block].next].first,s);
+      else
+        cost = (struct flowcost){ .worst = 0 , .end = i , .low = SIZE_MAX , .flags = COST_LEAVES , .state = 2 };
+      
+      end = &flow->insns[cost.end];
+      
+      if (out != NULL)
+      {
+        fprintf(
+              out,
+              "masked %s $%04X %s %s:%zu to %s:%zu %zu cycles",
+              names[s],
+              insn->addr,
+              flow_name(flow,insn->addr,name,sizeof(name)),
+              insn->file,
+              insn->line,
+              end->file,
+              end->line,
+              cost.worst
+        );
+        if (cost.flags & COST_LOOP)
+          fprintf(out,", loops counted once");
+        if (cost.flags & COST_LEAVES)
+          fprintf(out,", still masked on return or jump");
+        if (cost.flags & COST_UNKNOWN)
+          fprintf(out,", indirect jumps or calls not counted");
+        fputc('\n',out);
+      }
+      
+      if ((a09->maskmax > 0) && (cost.worst > a09->maskmax))
+      {
+        a09->infile = insn->file;
+        a09->lnum   = insn->line;
+        message(a09,MSG_WARNING,"W0031: %s masked for up to %zu cycles, over %lu",names[s],cost.worst,a09->maskmax);
+      }
+    }
+  }
+  
+  a09->infile = infile;
+  a09->lnum   = 0;
+  return true;
+}
+
+/**************************************************************************/
+
+static size_t flow_pushed(unsigned char pb)
+{
+  static unsigned char const sizes[8] = { 1 , 1 , 1 , 1 , 2 , 2 , 2 , 2 };
+  size_t                     bytes    = 0;
+  
+  for (size_t i = 0 ; i < 8 ; i++)
+    if (pb & (1 << i))
+      bytes += sizes[i];
+  return bytes;
+}
+
+/**************************************************************************/
+
+static bool flow_lea(struct flowinsn const *insn,unsigned char reg,long *pdelta)
+{
+  assert(insn   != NULL);
+  assert(pdelta != NULL);
+  
+  unsigned char pb = insn->bytes[1];
+  
+  /*-----------------------------------------------------------------------
+  ; Only LEAS n,S and LEAU n,U with a constant offset can be tracked.  The
+  ; register is in bits 5 and 6 of the postbyte (2 is U, 3 is S).
+  ;------------------------------------------------------------------------*/
+  
+  if (((pb >> 5) & 3) != reg)
+    return false;
+    
+  if ((pb & 0x80) == 0)
+  {
+    *pdelta = (pb & 0x10) ? (long)(pb & 0x1F) - 32 : (long)(pb & 0x1F);
+    return true;
+  }
+  else if ((pb & 0x9F) == 0x84)
+  {
+    *pdelta = 0;
+    return true;
+  }
+  else if ((pb & 0x9F) == 0x88)
+  {
+    *pdelta = (int8_t)insn->bytes[2];
+    return true;
+  }
+  else if ((pb & 0x9F) == 0x89)
+  {
+    *pdelta = (int16_t)((insn->bytes[2] << 8) | insn->bytes[3]);
+    return true;
+  }
+  else
+    return false;
+}
+
+/**************************************************************************/
+
+static void flow_stack_insn(
+        struct flowdata        *flow,
+        struct flowinsn const  *insn,
+        long                   *ps,
+        long                   *pu,
+        struct flowstack       *res
+)
+{
+  assert(flow != NULL);
+  assert(insn != NULL);
+  assert(ps   != NULL);
+  assert(pu   != NULL);
+  assert(res  != NULL);
+  
+  unsigned char op = insn->bytes[0];
+  unsigned char pb = insn->bytes[1];
+  long          delta;
+  
+  /*-----------------------------------------------------------------------
+  ; The depth is in bytes pushed since the entry of the subroutine, so a
+  ; call adds the return address plus whatever the called routine uses.
+  ;------------------------------------------------------------------------*/
+  
+  switch(op)
+  {
+    case 0x34: *ps += (long)flow_pushed(pb); break; /* PSHS */
+    case 0x35: *ps -= (long)flow_pushed(pb); break; /* PULS */
+    case 0x36: *pu += (long)flow_pushed(pb); break; /* PSHU */
+    case 0x37: *pu -= (long)flow_pushed(pb); break; /* PULU */
+    
+    case 0x32: /* LEAS */
+         if (flow_lea(insn,3,&delta))
+           *ps -= delta;
+         else
+           res->flags |= COST_UNKNOWN;
+         break;
+         
+    case 0x33: /* LEAU */
+         if (flow_lea(insn,2,&delta))
+           *pu -= delta;
+         else
+           res->flags |= COST_UNKNOWN;
+         break;
+         
+    case 0x3F: /* SWI */
+         if (*ps + 12 > res->s)
+           res->s = *ps + 12;
+         break;
+         
+    case 0x10: /* SWI2, LDS */
+    case 0x11: /* SWI3 */
+         if (pb == 0x3F)
+         {
+           if (*ps + 12 > res->s)
+             res->s = *ps + 12;
+         }
+         else if ((op == 0x10) && ((pb == 0xCE) || (pb == 0xDE) || (pb == 0xEE) || (pb == 0xFE)))
+           res->flags |= COST_UNKNOWN;
+         break;
+         
+    case 0xCE: case 0xDE: case 0xEE: case 0xFE: /* LDU */
+         res->flags |= COST_UNKNOWN;
+         break;
+         
+    case 0x1F: /* TFR r,S or r,U */
+         if (((pb & 0x0F) == 0x03) || ((pb & 0x0F) == 0x04))
+           res->flags |= COST_UNKNOWN;
+         break;
+         
+    case 0x1E: /* EXG */
+         if (
+                 ((pb & 0x0F) == 0x03) || ((pb & 0x0F) == 0x04)
+              || ((pb & 0xF0) == 0x30) || ((pb & 0xF0) == 0x40)
+            )
+           res->flags |= COST_UNKNOWN;
+         break;
+         
+    default:
+         break;
+  }
+  
+  if (insn->kind == FLOW_CALL)
+  {
+    size_t t = flow_find(flow,insn->target);
+    
+    if (t != NOBLOCK)
+    {
+      struct flowstack sub = flow_stack(flow,flow->insns[t].block);
+      
+      if (*ps + 2 + sub.s > res->s)
+        res->s = *ps + 2 + sub.s;
+      if (*pu + sub.u > res->u)
+        res->u = *pu + sub.u;
+      res->flags |= sub.flags;
+    }
+    else
+    {
+      if (*ps + 2 > res->s)
+        res->s = *ps + 2;
+      res->flags |= COST_UNKNOWN;
+    }
+  }
+  else if (insn->kind == FLOW_ICALL)
+  {
+    if (*ps + 2 > res->s)
+      res->s = *ps + 2;
+    res->flags |= COST_UNKNOWN;
+  }
+  
+  if (*ps > res->s)
+    res->s = *ps;
+  if (*pu > res->u)
+    res->u = *pu;
+}
+
+/**************************************************************************/
+
+static struct flowstack flow_stack(struct flowdata *flow,size_t entry)
+{
+  assert(flow  != NULL);
+  assert(entry <  flow->nblocks);
+  
+  struct flowstack *memo = &flow->stack[entry];
+  struct flowstack  res  = { .s = 0 , .u = 0 , .flags = 0 , .state = 2 };
+  long             *ins;
+  long             *inu;
+  bool             *set;
+  size_t           *work;
+  size_t            nwork = 0;
+  
+  if (memo->state == 2)
+    return *memo;
+  if (memo->state == 1)
+    return (struct flowstack){ .s = 0 , .u = 0 , .flags = COST_LOOP , .state = 2 };
+    
+  memo->state = 1;
+  ins         = calloc(flow->nblocks,sizeof(long));
+  inu         = calloc(flow->nblocks,sizeof(long));
+  set         = calloc(flow->nblocks,sizeof(bool));
+  work        = calloc(flow->nblocks,sizeof(size_t));
+  
+  if ((ins == NULL) || (inu == NULL) || (set == NULL) || (work == NULL))
+  {
+    free(work);
+    free(set);
+    free(inu);
+    free(ins);
+    res.flags = COST_UNKNOWN;
+    *memo     = res;
+    return res;
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; Each block is looked at once, with the depth it's first reached with.
+  ; Reaching it again with a different depth means the pushes and pulls
+  ; don't balance (usually a loop that pushes), so it's flagged.  Flowing
+  ; into another subroutine adds its depth.
+  ;------------------------------------------------------------------------*/
+  
+  set[entry]    = true;
+  work[nwork++] = entry;
+  
+  while(nwork > 0)
+  {
+    size_t            b     = work[--nwork];
+    struct flowblock *block = &flow->blocks[b];
+    struct flowinsn  *last  = &flow->insns[block->first + block->count - 1];
+    long              s     = ins[b];
+    long              u     = inu[b];
+    size_t            succ[2];
+    
+    for (size_t i = block->first ; i < block->first + block->count ; i++)
+      flow_stack_insn(flow,&flow->insns[i],&s,&u,&res);
+      
+    succ[0] = (last->kind != FLOW_JUMP) && (last->kind != FLOW_IJUMP) && (last->kind != FLOW_RETURN) ? block->next : NOBLOCK;
+    succ[1] = block->target;
+    
+    /*---------------------------------------------------------------------
+    ; By a return, everything pushed should have been pulled (with PULS PC
+    ; also pulling the return address).
+    ;----------------------------------------------------------------------*/
+    
+    if ((last->kind == FLOW_RETURN) && (last->bytes[0] == 0x35) && (s != -2))
+      res.flags |= COST_LOOP;
+    else if ((last->kind == FLOW_RETURN) && (last->bytes[0] == 0x39) && (s != 0))
+      res.flags |= COST_LOOP;
+      
+    for (size_t e = 0 ; e < 2 ; e++)
+    {
+      size_t n = succ[e];
+      
+      if (n == NOBLOCK)
+        continue;
+        
+      if (flow->entry[n] && (n != entry))
+      {
+        struct flowstack sub = flow_stack(flow,n);
+        
+        if (s + sub.s > res.s)
+          res.s = s + sub.s;
+        if (u + sub.u > res.u)
+          res.u = u + sub.u;
+        res.flags |= sub.flags;
+      }
+      else if (!set[n])
+      {
+        set[n]        = true;
+        ins[n]        = s;
+        inu[n]        = u;
+        work[nwork++] = n;
+      }
+      else if ((ins[n] != s) || (inu[n] != u))
+        res.flags |= COST_LOOP;
+    }
+  }
+  
+  free(work);
+  free(set);
+  free(inu);
+  free(ins);
+  *memo = res;
+  return res;
+}
+
+/**************************************************************************/
+
+static bool flow_stacks(struct a09 *a09,struct flowdata *flow,FILE *out)
+{
+  assert(a09  != NULL);
+  assert(flow != NULL);
+  
+  char const *infile = a09->infile;
+  
+  flow->stack = calloc(flow->nblocks + 1,sizeof(struct flowstack));
+  if (flow->stack == NULL)
+    return message(a09,MSG_ERROR,"E0046: out of memory");
+    
+  if (out != NULL)
+    fprintf(out,"\n# maximum stack depth in bytes, including called subroutines,\n# but not the return address of the entry itself\n");
+    
+  for (size_t b = 0 ; b < flow->nblocks ; b++)
+  {
+    if (!flow->entry[b])
+      continue;
+      
+    struct flowinsn  *insn = &flow->insns[flow->blocks[b].first];
+    struct flowstack  res  = flow_stack(flow,b);
+    char              name[80];
+    
+    if (out != NULL)
+    {
+      fprintf(
+            out,
+            "stack $%04X %s %s:%zu S %ld U %ld%s",
+            insn->addr,
+            flow_name(flow,insn->addr,name,sizeof(name)),
+            insn->file,
+            insn->line,
+            res.s,
+            res.u,
+            flow->root[b] ? " (entry point)" : ""
+      );
+      if (res.flags & COST_LOOP)
+        fprintf(out,", unbalanced or recursive");
+      if (res.flags & COST_UNKNOWN)
+        fprintf(out,", indirect calls or stack loads not counted");
+      fputc('\n',out);
+    }
+    
+    if (flow->root[b] && (a09->stackmax > 0) && ((unsigned long)res.s > a09->stackmax))
+    {
+      a09->infile = insn->file;
+      a09->lnum   = insn->line;
+      message(a09,MSG_WARNING,"W0032: %s: S stack may use up to %ld bytes, over %lu",flow_name(flow,insn->addr,name,sizeof(name)),res.s,a09->stackmax);
+    }
+  }
+  
+  a09->infile = infile;
+  a09->lnum   = 0;
+  return true;
+}
+
+/**************************************************************************/
+
+static bool flow_subroutines(struct a09 *a09,struct flowdata *flow,FILE *out)
+{
+  assert(a09  != NULL);
+  assert(flow != NULL);
+  assert(out  != NULL);
+  
+  bool            *back  = calloc(flow->nblocks * 2 + 1,sizeof(bool));
+  uint8_t         *color = calloc(flow->nblocks + 1,sizeof(uint8_t));
+  size_t          *order = calloc(flow->nblocks + 1,sizeof(size_t));
+  size_t          *stack = calloc(flow->nblocks + 1,sizeof(size_t));
+  struct flowpath *path  = calloc(flow->nblocks + 1,sizeof(struct flowpath));
+  bool             okay  = (back != NULL) && (color != NULL) && (order != NULL) && (stack != NULL) && (path != NULL);
+  
+  if (!okay)
+    message(a09,MSG_ERROR,"E0046: out of memory");
+    
+  for (size_t b = 0 ; okay && (b < flow->nblocks) ; b++)
+    if (flow->entry[b])
+      okay = flow_subroutine(a09,flow,out,b,flow->entry,color,order,stack,back,path);
+      
+  free(path);
+  free(stack);
+  free(order);
+  free(color);
+  free(back);
+  return okay;
+}
+
+/**************************************************************************/
+
+static bool flow_labeled(struct flowdata *flow,uint16_t addr)
+{
+  assert(flow != NULL);
+  
+  struct symbol *sym = symbol_nearest(flow->symbols,flow->nsymbols,addr);
+  
+  return (sym != NULL)
+      && (sym->value == addr)
+      && (memchr(sym->name.text,'.',sym->name.len) == NULL);
+}
+
+/**************************************************************************/
+
+static size_t flow_datum(struct flowdata const *flow,uint16_t addr)
+{
+  assert(flow != NULL);
+  
+  size_t low  = 0;
+  size_t high = flow->ndata;
+  
+  /*-----------------------------------------------------------------------
+  ; Find the last datum starting at or before the address, then check the
+  ; address is inside it.
+  ;------------------------------------------------------------------------*/
+  
+  while(low < high)
+  {
+    size_t mid = low + (high - low) / 2;
+    if (flow->data[mid].addr <= addr)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  
+  if ((low > 0) && ((size_t)addr < flow->data[low - 1].addr + flow->data[low - 1].size))
+    return low - 1;
+  else
+    return NOBLOCK;
+}
+
+/**************************************************************************/
+
+static void flow_mark(
+        struct flowdata *flow,
+        uint16_t         addr,
+        bool            *reached,
+        size_t          *stack,
+        size_t          *sp
+)
+{
+  assert(flow    != NULL);
+  assert(reached != NULL);
+  assert(stack   != NULL);
+  assert(sp      != NULL);
+  
+  size_t i = flow_find(flow,addr);
+  size_t x;
+  
+  if (i != NOBLOCK)
+    x = flow->insns[i].block;
+  else if ((i = flow_datum(flow,addr)) != NOBLOCK)
+    x = flow->nblocks + i;
+  else
+    return;
+    
+  if (!reached[x])
+  {
+    reached[x]    = true;
+    stack[(*sp)++] = x;
+  }
+}
+
+/**************************************************************************/
+
+static bool flow_reach(struct a09 *a09,struct flowdata *flow,FILE *out)
+{
+  assert(a09  != NULL);
+  assert(flow != NULL);
+  assert(out  != NULL);
+  
+  size_t  total = flow->nblocks + flow->ndata;
+  bool   *reached;
+  size_t *stack;
+  size_t  sp     = 0;
+  size_t  wcode  = 0;
+  size_t  wdata  = 0;
+  bool    rooted = flow->nroots > 0;
+  char    name[80];
+  
+  qsort(flow->data,flow->ndata,sizeof(struct flowdatum),datumcmp);
+  qsort(flow->words,flow->nwords,sizeof(struct flowword),wordcmp);
+  
+  reached = calloc(total + 1,sizeof(bool));
+  stack   = calloc(total + 1,sizeof(size_t));
+  if ((reached == NULL) || (stack == NULL))
+  {
+    free(stack);
+    free(reached);
+    return message(a09,MSG_ERROR,"E0046: out of memory");
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; The roots are the END address, anything given with .ROOT, and whatever
+  ; the 6809 vectors point to.  The vectors themselves are in use, too.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t i = 0 ; i < flow->nroots ; i++)
+    flow_mark(flow,flow->roots[i],reached,stack,&sp);
+    
+  for (size_t i = 0 ; i < flow->nwords ; i++)
+  {
+    if ((flow->words[i].addr >= 0xFFF2) && (flow->words[i].addr <= 0xFFFE))
+    {
+      flow_mark(flow,flow->words[i].addr,reached,stack,&sp);
+      flow_mark(flow,flow->words[i].value,reached,stack,&sp);
+      rooted = true;
+    }
+  }
+  
+  fprintf(out,"\n# code and data not reachable from the END address, the vectors\n# at $FFF2-$FFFE, or .ROOT\n");
+  
+  if (!rooted)
+  {
+    fprintf(out,"# (no END address, vectors or .ROOT given, so nothing was checked)\n");
+    free(stack);
+    free(reached);
+    return true;
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; Code reaches what it falls into, branches, jumps or calls to, and any
+  ; address in its operand.  Data reaches the addresses in its FDBs, which
+  ; covers jump tables, and the data following it up to the next label.
+  ;------------------------------------------------------------------------*/
+  
+  while(sp > 0)
+  {
+    size_t x = stack[--sp];
+    
+    if (x < flow->nblocks)
+    {
+      struct flowblock *block = &flow->blocks[x];
+      
+      if ((block->next != NOBLOCK) && !reached[block->next])
+      {
+        reached[block->next] = true;
+        stack[sp++]          = block->next;
+      }
+      
+      for (size_t j = block->first ; j < block->first + block->count ; j++)
+      {
+        struct flowinsn *insn = &flow->insns[j];
+        
+        if ((insn->kind == FLOW_BRANCH) || (insn->kind == FLOW_JUMP) || (insn->kind == FLOW_CALL))
+          flow_mark(flow,insn->target,reached,stack,&sp);
+        if (insn->hasref)
+          flow_mark(flow,insn->ref,reached,stack,&sp);
+      }
+    }
+    else
+    {
+      struct flowdatum *datum = &flow->data[x - flow->nblocks];
+      size_t            low   = 0;
+      size_t            high  = flow->nwords;
+      
+      while(low < high)
+      {
+        size_t mid = low + (high - low) / 2;
+        if (flow->words[mid].addr < datum->addr)
+          low = mid + 1;
+        else
+          high = mid;
+      }
+      
+      for ( ; (low < flow->nwords) && ((size_t)flow->words[low].addr < datum->addr + datum->size) ; low++)
+        flow_mark(flow,flow->words[low].value,reached,stack,&sp);
+        
+      /*---------------------------------------------------------------
+      ; Data runs on to the next label, like the NUL after an FCC.
+      ;----------------------------------------------------------------*/
+      
+      if (
+              (x + 1 < total)
+           && !reached[x + 1]
+           && (flow->data[x + 1 - flow->nblocks].addr == datum->addr + datum->size)
+           && !flow_labeled(flow,datum->addr + datum->size)
+         )
+      {
+        reached[x + 1] = true;
+        stack[sp++]    = x + 1;
+      }
+    }
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; Adjacent blocks that can't be reached are reported together, up to the
+  ; next global label.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t b = 0 ; b < flow->nblocks ; )
+  {
+    struct flowinsn *insn;
+    size_t           bytes;
+    
+    if (reached[b])
+    {
+      b++;
+      continue;
+    }
+    
+    insn  = &flow->insns[flow->blocks[b].first];
+    bytes = flow->blocks[b].bytes;
+    
+    for (b++ ; b < flow->nblocks ; b++)
+    {
+      uint16_t next = insn->addr + bytes;
+      
+      if (reached[b] || (flow->insns[flow->blocks[b].first].addr != next) || flow_labeled(flow,next))
+        break;
+      bytes += flow->blocks[b].bytes;
+    }
+    
+    fprintf(
+          out,
+          "unreachable code $%04X %s %s:%zu %zu bytes\n",
+          insn->addr,
+          flow_name(flow,insn->addr,name,sizeof(name)),
+          insn->file,
+          insn->line,
+          bytes
+    );
+    wcode += bytes;
+  }
+  
+  for (size_t d = 0 ; d < flow->ndata ; )
+  {
+    struct flowdatum *datum;
+    size_t            bytes;
+    
+    if (reached[flow->nblocks + d])
+    {
+      d++;
+      continue;
+    }
+    
+    datum = &flow->data[d];
+    bytes = datum->size;
+    
+    for (d++ ; d < flow->ndata ; d++)
+    {
+      uint16_t next = datum->addr + bytes;
+      
+      if (reached[flow->nblocks + d] || (flow->data[d].addr != next) || flow_labeled(flow,next))
+        break;
+      bytes += flow->data[d].size;
+    }
+    
+    fprintf(
+          out,
+          "unreachable data $%04X %s %s:%zu %zu bytes\n",
+          datum->addr,
+          flow_name(flow,datum->addr,name,sizeof(name)),
+          datum->file,
+          datum->line,
+          bytes
+    );
+    wdata += bytes;
+  }
+  
+  fprintf(out,"# %zu bytes of code and %zu bytes of data unreachable\n",wcode,wdata);
+  free(stack);
+  free(reached);
+  return true;
+}
+
+/**************************************************************************/
+
+bool flow_report(struct a09 *a09)
+{
+  assert(a09       != NULL);
+  assert(a09->flow != NULL);
+  
+  struct flowdata *flow = a09->flow;
+  FILE            *out  = NULL;
+  bool             okay = true;
+  bool            *seen;
+  
+  if ((a09->flowfile == NULL) && (a09->maskmax == 0) && (a09->stackmax == 0))
+    return true;
+    
+  qsort(flow->insns,flow->ninsns,sizeof(struct flowinsn),insncmp);
+  if (!flow_blocks(a09,flow))
+    return false;
+    
+  flow->symbols = symbol_addrtable(a09,&flow->nsymbols);
+  if (flow->symbols == NULL)
+    return false;
+    
+  flow->entry = calloc(flow->nblocks + 1,sizeof(bool));
+  flow->root  = calloc(flow->nblocks + 1,sizeof(bool));
+  seen        = calloc(flow->nblocks + 1,sizeof(bool));
+  
+  if ((flow->entry == NULL) || (flow->root == NULL) || (seen == NULL))
+  {
+    free(seen);
+    return message(a09,MSG_ERROR,"E0046: out of memory");
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; Subroutines start at the target of a call, or at any block nothing
+  ; flows or branches into (main entry points and interrupt handlers).
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t b = 0 ; b < flow->nblocks ; b++)
+  {
+    struct flowblock *block = &flow->blocks[b];
+    
+    if ((block->next != NOBLOCK) && (block->next != b))
+      seen[block->next] = true;
+    if ((block->target != NOBLOCK) && (block->target != b))
+      seen[block->target] = true;
+      
+    for (size_t j = block->first ; j < block->first + block->count ; j++)
+    {
+      if (flow->insns[j].kind == FLOW_CALL)
+      {
+        size_t t = flow_find(flow,flow->insns[j].target);
+        if (t != NOBLOCK)
+          flow->entry[flow->insns[t].block] = true;
+      }
+    }
+  }
+  
+  for (size_t b = 0 ; b < flow->nblocks ; b++)
+    if (!seen[b] && !flow->entry[b])
+      flow->entry[b] = flow->root[b] = true;
+      
+  free(seen);
+  
+  if (a09->flowfile != NULL)
+  {
+    out = fopen(a09->flowfile,"w");
+    if (out == NULL)
+      return message(a09,MSG_ERROR,"E0070: %s: %s",a09->flowfile,strerror(errno));
+      
+    fprintf(out,"# control flow of %s\n",a09->infile);
+    fprintf(out,"# cycles are best-worst; called subroutines are not included\n");
+    fprintf(out,"# and each loop is taken at most once through\n");
+    okay = flow_subroutines(a09,flow,out);
+  }
+  
+  if (okay)
+    okay = flow_masked(a09,flow,out);
+  if (okay)
+    okay = flow_stacks(a09,flow,out);
+  if (okay && (out != NULL))
+    okay = flow_reach(a09,flow,out);
+    
+  if (out != NULL)
+    fclose(out);
+  return okay;
+}
+
+/**************************************************************************/
+
+bool flow_fini(struct a09 *a09)
+{
+  assert(a09 != NULL);
+  
+  if (a09->flow != NULL)
+  {
+    for (size_t i = 0 ; i < SCAN_max ; i++)
+      free(a09->flow->cost[i]);
+    free(a09->flow->stack);
+    free(a09->flow->root);
+    free(a09->flow->entry);
+    free(a09->flow->symbols);
+    free(a09->flow->roots);
+    free(a09->flow->words);
+    free(a09->flow->data);
+    free(a09->flow->blocks);
+    free(a09->flow->insns);
+    free(a09->flow);
+    a09->flow = NULL;
+  }
+  return true;
+}
+
+/**************************************************************************/
@@ -0,0 +1,1068 @@
+/****************************************************************************
+*
+*   Reorder code by a branch profile to keep the busy branches short
+*   Copyright (C) 2023 Sean Conner
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*   Comments, questions and criticisms can be sent to: sean@conman.org
+*
+****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "a09.h"
+
+#define NONE ((size_t)-1)
+
+/*--------------------------------------------------------------------------
+; A .LAYOUT region is cut into blocks, one per global label.  The blocks are
+; put back together in a new order, then assembled in that order by seeking
+; around in the source file.  The order has to be the same on both passes,
+; so it's figured on pass 1 and kept for pass 2.
+;--------------------------------------------------------------------------*/
+
+struct lline
+{
+  long           offset;   /* file position of the line */
+  size_t         block;
+  size_t         target;   /* line the branch goes to, or NONE */
+  label          name;
+  label          dest;
+  unsigned long  exec;     /* counts from the profile */
+  unsigned long  taken;
+  unsigned long  nottaken;
+  uint16_t       pc;       /* address on pass 1 */
+  uint16_t       sz;
+  unsigned char  cycles;   /* cycles as a long jump */
+  bool           named;
+  bool           aimed;    /* operand is a single label */
+  bool           cond;     /* Bcc or LBcc */
+  bool           jump;     /* BRA, LBRA or JMP */
+  bool           near;     /* 8-bit offset */
+};
+
+struct lblock
+{
+  size_t         first;    /* index of the first line */
+  size_t         chain;
+  size_t         next;     /* next block in the chain, or NONE */
+  bool           falls;    /* falls through to the next block */
+};
+
+struct lchain
+{
+  size_t         head;
+  size_t         tail;
+  bool           placed;
+};
+
+struct lregion
+{
+  char const    *file;
+  size_t         line;     /* line of the .LAYOUT */
+  struct lline  *lines;
+  struct lblock *blocks;
+  size_t        *order;
+  size_t         nlines;
+  size_t         nblocks;
+  long           end;      /* file position of the .ENDLAY */
+  long long      saved;
+};
+
+struct lprof
+{
+  char          *file;
+  size_t         line;
+  unsigned long  exec;
+  unsigned long  taken;
+  unsigned long  nottaken;
+};
+
+struct ledge
+{
+  size_t         from;
+  size_t         to;
+  size_t         line;
+  unsigned long  weight;
+};
+
+struct laydata
+{
+  struct lregion *regions;
+  struct lprof   *prof;
+  size_t          nregions;
+  size_t          nprof;
+  bool            loaded;
+  bool            open;    /* expecting .ENDLAY */
+};
+
+/**************************************************************************/
+
+static int lprofcmp(void const *restrict needle,void const *restrict haystack)
+{
+  struct lprof const *l = needle;
+  struct lprof const *r = haystack;
+  int                 rc = strcmp(l->file,r->file);
+  
+  if (rc != 0)
+    return rc;
+  else if (l->line < r->line)
+    return -1;
+  else if (l->line > r->line)
+    return 1;
+  else
+    return 0;
+}
+
+/**************************************************************************/
+
+static int ledgecmp(void const *restrict needle,void const *restrict haystack)
+{
+  struct ledge const *l = needle;
+  struct ledge const *r = haystack;
+  
+  if (l->weight > r->weight)
+    return -1;
+  else if (l->weight < r->weight)
+    return 1;
+  else if (l->line < r->line)
+    return -1;
+  else if (l->line > r->line)
+    return 1;
+  else
+    return 0;
+}
+
+/**************************************************************************/
+
+static struct lprof *layout_entry(struct a09 *a09,struct laydata *data,char const *file,size_t line)
+{
+  assert(a09  != NULL);
+  assert(data != NULL);
+  assert(file != NULL);
+  
+  struct lprof *prof;
+  
+  /*-----------------------------------------------------------------------
+  ; The lcov file gives all the branch records for a line, then the line
+  ; record, so only the last entry needs checking.
+  ;------------------------------------------------------------------------*/
+  
+  if (
+          (data->nprof > 0)
+       && (data->prof[data->nprof - 1].line == line)
+       && (strcmp(data->prof[data->nprof - 1].file,file) == 0)
+     )
+    return &data->prof[data->nprof - 1];
+    
+  prof = realloc(data->prof,(data->nprof + 1) * sizeof(struct lprof));
+  if (prof == NULL)
+  {
+    message(a09,MSG_ERROR,"E0046: out of memory");
+    return NULL;
+  }
+  
+  data->prof     = prof;
+  prof           = &data->prof[data->nprof++];
+  prof->file     = malloc(strlen(file) + 1);
+  prof->line     = line;
+  prof->exec     = 0;
+  prof->taken    = 0;
+  prof->nottaken = 0;
+  
+  if (prof->file == NULL)
+  {
+    data->nprof--;
+    message(a09,MSG_ERROR,"E0046: out of memory");
+    return NULL;
+  }
+  
+  strcpy(prof->file,file);
+  return prof;
+}
+
+/**************************************************************************/
+
+static bool layout_profile(struct a09 *a09,struct laydata *data)
+{
+  assert(a09           != NULL);
+  assert(a09->layfile  != NULL);
+  assert(data          != NULL);
+  
+  char  line[BUFSIZ];
+  char  file[BUFSIZ];
+  FILE *fp = fopen(a09->layfile,"r");
+  
+  if (fp == NULL)
+    return message(a09,MSG_ERROR,"E0070: %s: %s",a09->layfile,strerror(errno));
+    
+  data->loaded = true;
+  file[0]      = '\0';
+  
+  /*-----------------------------------------------------------------------
+  ; This reads the lcov file written by -v.  Branch 0 of a BRDA record is
+  ; the taken count, branch 1 the not taken count.  Anything else is skipped.
+  ;------------------------------------------------------------------------*/
+  
+  while(fgets(line,sizeof(line),fp) != NULL)
+  {
+    struct lprof  *prof;
+    unsigned long  lnum;
+    unsigned long  count;
+    unsigned long  block;
+    int            branch;
+    char           taken[32];
+    
+    line[strcspn(line,"\r\n")] = '\0';
+    
+    if (strncmp(line,"SF:",3) == 0)
+      snprintf(file,sizeof(file),"%s",&line[3]);
+    else if (sscanf(line,"DA:%lu,%lu",&lnum,&count) == 2)
+    {
+      prof = layout_entry(a09,data,file,lnum);
+      if (prof == NULL)
+      {
+        fclose(fp);
+        return false;
+      }
+      prof->exec = count;
+    }
+    else if (sscanf(line,"BRDA:%lu,%lu,%d,%31s",&lnum,&block,&branch,taken) == 4)
+    {
+      prof = layout_entry(a09,data,file,lnum);
+      if (prof == NULL)
+      {
+        fclose(fp);
+        return false;
+      }
+      count = strtoul(taken,NULL,10); /* '-' is never executed */
+      if (branch == 0)
+        prof->taken += count;
+      else
+        prof->nottaken += count;
+    }
+  }
+  
+  fclose(fp);
+  qsort(data->prof,data->nprof,sizeof(struct lprof),lprofcmp);
+  return true;
+}
+
+/**************************************************************************/
+
+static bool layout_ends(struct opcode const *op,struct buffer *buffer)
+{
+  assert(op     != NULL);
+  assert(buffer != NULL);
+  
+  if ((strcmp(op->name,"RTS") == 0) || (strcmp(op->name,"RTI") == 0))
+    return true;
+    
+  if ((strcmp(op->name,"PULS") == 0) || (strcmp(op->name,"PULU") == 0))
+  {
+    char prev = ',';
+    
+    for (size_t i = buffer->ridx ; buffer->buf[i] != '\0' ; i++)
+    {
+      char c = buffer->buf[i];
+      
+      if (isspace(c) || (c == ';'))
+        break;
+      if ((prev == ',') || isspace(prev))
+        if ((toupper(c) == 'P') && (toupper(buffer->buf[i + 1]) == 'C'))
+          return true;
+      prev = c;
+    }
+  }
+  
+  return false;
+}
+
+/**************************************************************************/
+
+static bool layout_block(struct a09 *a09,struct lregion *region)
+{
+  assert(a09    != NULL);
+  assert(region != NULL);
+  
+  struct lblock *block = realloc(region->blocks,(region->nblocks + 1) * sizeof(struct lblock));
+  
+  if (block == NULL)
+    return message(a09,MSG_ERROR,"E0046: out of memory");
+    
+  region->blocks = block;
+  block          = &region->blocks[region->nblocks++];
+  block->first   = region->nlines;
+  block->chain   = NONE;
+  block->next    = NONE;
+  block->falls   = true;
+  return true;
+}
+
+/**************************************************************************/
+
+static bool layout_scan(struct a09 *a09,struct lregion *region)
+{
+  assert(a09    != NULL);
+  assert(region != NULL);
+  
+  label  saved   = a09->label;
+  size_t lnum    = a09->lnum;
+  bool   content = false;
+  bool   rc      = layout_block(a09,region);
+  
+  while(rc)
+  {
+    struct opcode const *op = NULL;
+    struct lline        *line;
+    struct buffer        buf;
+    long                 offset = ftell(a09->in);
+    char                 c;
+    
+    if (feof(a09->in))
+    {
+      rc = message(a09,MSG_ERROR,"E0123: missing .ENDLAY");
+      break;
+    }
+    
+    /*---------------------------------------------------------------------
+    ; Any error in reading the line is reported against it, not the .LAYOUT.
+    ;----------------------------------------------------------------------*/
+    
+    a09->lnum = ++lnum;
+    rc        = read_line(a09,a09->in,&buf);
+    a09->lnum = region->line;
+    if (!rc)
+      break;
+    
+    line = realloc(region->lines,(region->nlines + 1) * sizeof(struct lline));
+    if (line == NULL)
+    {
+      rc = message(a09,MSG_ERROR,"E0046: out of memory");
+      break;
+    }
+    
+    region->lines  = line;
+    line           = &region->lines[region->nlines];
+    line->offset   = offset;
+    line->target   = NONE;
+    line->exec     = 0;
+    line->taken    = 0;
+    line->nottaken = 0;
+    line->pc       = 0;
+    line->sz       = 0;
+    line->cycles   = 0;
+    line->aimed    = false;
+    line->cond     = false;
+    line->jump     = false;
+    line->near     = false;
+    line->named    = parse_label(&line->name,&buf,a09,2);
+    
+    c = skip_space(&buf);
+    if (!isEOL(c))
+    {
+      buf.ridx--;
+      if (!parse_op(&buf,&op))
+        op = NULL;
+    }
+    
+    if ((op != NULL) && (strcmp(op->name,".ENDLAY") == 0))
+    {
+      region->end = offset;
+      break;
+    }
+    
+    if ((op != NULL) && (strcmp(op->name,".LAYOUT") == 0))
+    {
+      a09->lnum = lnum;
+      rc        = message(a09,MSG_ERROR,"E0124: .LAYOUT can't be nested");
+      a09->lnum = region->line;
+      break;
+    }
+    
+    /*---------------------------------------------------------------------
+    ; Without -t, a test is skipped by reading ahead to its .ENDTST, which
+    ; would take lines out from under the blocks.
+    ;----------------------------------------------------------------------*/
+    
+    if (
+            (op != NULL)
+         && (
+                 (strcmp(op->name,".TEST")   == 0)
+              || (strcmp(op->name,".SETUP")  == 0)
+              || (strcmp(op->name,".NOTEST") == 0)
+              || (strcmp(op->name,".ENDTST") == 0)
+            )
+       )
+    {
+      a09->lnum = lnum;
+      rc        = message(a09,MSG_ERROR,"E0136: %s can't be used in a .LAYOUT region",op->name);
+      a09->lnum = region->line;
+      break;
+    }
+    
+    /*---------------------------------------------------------------------
+    ; A global label starts a new block, unless the current one has nothing
+    ; in it yet (comments and blank lines leading off the region).
+    ;----------------------------------------------------------------------*/
+    
+    if (line->named)
+    {
+      char *p = memchr(line->name.text,'.',line->name.len);
+      
+      if ((p == NULL) && content)
+        if (!(rc = layout_block(a09,region)))
+          break;
+          
+      a09->label = line->name;
+      if (p != NULL)
+        a09->label.len = (unsigned char)(p - line->name.text);
+    }
+    
+    line->block = region->nblocks - 1;
+    content    |= line->named || (op != NULL);
+    region->nlines++;
+    
+    if ((op == NULL) || (op->cycles == 0))
+      continue;
+      
+    line->cond = (op->opcode >= 0x22) && (op->opcode <= 0x2F) && ((op->page == 0x00) || (op->page == 0x10));
+    line->near = (op->page == 0x00) && (((op->opcode >= 0x20) && (op->opcode <= 0x2F)) || (strcmp(op->name,"BSR") == 0));
+    line->jump = (strcmp(op->name,"BRA") == 0) || (strcmp(op->name,"LBRA") == 0) || (strcmp(op->name,"JMP") == 0);
+    
+    if (strcmp(op->name,"LBRA") == 0)
+      line->cycles = 5;
+    else if (strcmp(op->name,"JMP") == 0)
+      line->cycles = 4;
+    else
+      line->cycles = 3;
+      
+    region->blocks[line->block].falls = !line->jump && !layout_ends(op,&buf);
+    
+    if (line->cond || line->jump || line->near)
+    {
+      c = skip_space(&buf);
+      if (!isEOL(c))
+      {
+        buf.ridx--;
+        if (parse_label(&line->dest,&buf,a09,2))
+        {
+          c           = skip_space(&buf);
+          line->aimed = isEOL(c);
+        }
+      }
+    }
+  }
+  
+  a09->label = saved;
+  
+  if (rc)
+  {
+    for (size_t i = 0 ; i < region->nlines ; i++)
+    {
+      struct lline *line = &region->lines[i];
+      
+      if (!line->aimed)
+        continue;
+      for (size_t j = 0 ; j < region->nlines ; j++)
+      {
+        if (
+                region->lines[j].named
+             && (region->lines[j].name.len == line->dest.len)
+             && (memcmp(region->lines[j].name.text,line->dest.text,line->dest.len) == 0)
+           )
+        {
+          line->target = j;
+          break;
+        }
+      }
+    }
+  }
+  
+  return rc;
+}
+
+/**************************************************************************/
+
+static void layout_join(struct lregion *region,struct lchain *chains,size_t a,size_t b)
+{
+  assert(region != NULL);
+  assert(chains != NULL);
+  assert(a      != b);
+  
+  region->blocks[chains[a].tail].next = chains[b].head;
+  chains[a].tail                      = chains[b].tail;
+  
+  for (size_t x = chains[b].head ; x != NONE ; x = region->blocks[x].next)
+    region->blocks[x].chain = a;
+    
+  chains[b].head = NONE;
+  chains[b].tail = NONE;
+}
+
+/**************************************************************************/
+
+static void layout_merge(struct lregion *region,struct lchain *chains,size_t a,size_t b)
+{
+  assert(region != NULL);
+  assert(chains != NULL);
+  assert(a      != b);
+  
+  size_t x    = chains[a].head;
+  size_t y    = chains[b].head;
+  size_t head = NONE;
+  size_t tail = NONE;
+  
+  /*-----------------------------------------------------------------------
+  ; Both chains are in source order, so merging them keeps them that way,
+  ; and no branch between the two gets any longer than it was.
+  ;------------------------------------------------------------------------*/
+  
+  while((x != NONE) || (y != NONE))
+  {
+    size_t z;
+    
+    if ((y == NONE) || ((x != NONE) && (x < y)))
+    {
+      z = x;
+      x = region->blocks[x].next;
+    }
+    else
+    {
+      z = y;
+      y = region->blocks[y].next;
+    }
+    
+    region->blocks[z].chain = a;
+    if (tail == NONE)
+      head = z;
+    else
+      region->blocks[tail].next = z;
+    tail = z;
+  }
+  
+  region->blocks[tail].next = NONE;
+  chains[a].head            = head;
+  chains[a].tail            = tail;
+  chains[b].head            = NONE;
+  chains[b].tail            = NONE;
+}
+
+/**************************************************************************/
+
+static bool layout_order(struct a09 *a09,struct laydata *data,struct lregion *region)
+{
+  assert(a09    != NULL);
+  assert(data   != NULL);
+  assert(region != NULL);
+  
+  size_t         n      = region->nblocks;
+  struct lchain *chains = calloc(n,sizeof(struct lchain));
+  struct ledge  *edges  = calloc(region->nlines + 1,sizeof(struct ledge));
+  size_t         nedges = 0;
+  size_t         norder = 0;
+  size_t         first;
+  size_t         last;
+  
+  region->order = calloc(n,sizeof(size_t));
+  if ((chains == NULL) || (edges == NULL) || (region->order == NULL))
+  {
+    free(edges);
+    free(chains);
+    return message(a09,MSG_ERROR,"E0046: out of memory");
+  }
+  
+  for (size_t b = 0 ; b < n ; b++)
+  {
+    chains[b].head         = b;
+    chains[b].tail         = b;
+    chains[b].placed       = false;
+    region->blocks[b].chain = b;
+    region->blocks[b].next  = NONE;
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; With no profile there's nothing to go on, so keep the source order.
+  ;------------------------------------------------------------------------*/
+  
+  if (!data->loaded)
+  {
+    for (size_t b = 0 ; b < n ; b++)
+      region->order[b] = b;
+    free(edges);
+    free(chains);
+    return true;
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; A block that falls into the next has to stay in front of it, and blocks
+  ; tied together with an 8-bit branch stay in source order so the branch
+  ; will still reach.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t b = 0 ; b + 1 < n ; b++)
+    if (region->blocks[b].falls)
+      layout_join(region,chains,region->blocks[b].chain,region->blocks[b + 1].chain);
+      
+  for (size_t i = 0 ; i < region->nlines ; i++)
+  {
+    struct lline *line = &region->lines[i];
+    
+    if (line->near && (line->target != NONE))
+    {
+      size_t a = region->blocks[line->block].chain;
+      size_t b = region->blocks[region->lines[line->target].block].chain;
+      
+      if (a != b)
+        layout_merge(region,chains,a,b);
+    }
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; Pick up the counts and make an edge of each branch or jump from one
+  ; block to another, weighted by how often it went there.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t i = 0 ; i < region->nlines ; i++)
+  {
+    struct lline *line = &region->lines[i];
+    struct lprof  key  = { .file = (char *)region->file , .line = region->line + 1 + i };
+    struct lprof *prof = bsearch(&key,data->prof,data->nprof,sizeof(struct lprof),lprofcmp);
+    
+    if (prof != NULL)
+    {
+      line->exec     = prof->exec;
+      line->taken    = prof->taken;
+      line->nottaken = prof->nottaken;
+    }
+    
+    if ((line->cond || line->jump) && (line->target != NONE))
+    {
+      size_t to = region->lines[line->target].block;
+      
+      if (to != line->block)
+      {
+        edges[nedges].from   = line->block;
+        edges[nedges].to     = to;
+        edges[nedges].line   = i;
+        edges[nedges].weight = line->cond ? line->taken : line->exec;
+        nedges++;
+      }
+    }
+  }
+  
+  qsort(edges,nedges,sizeof(struct ledge),ledgecmp);
+  
+  /*-----------------------------------------------------------------------
+  ; The first block is where the region is entered, so it stays first, and
+  ; a last block that falls out of the region stays last.  The busiest edges
+  ; then pull the block they go to right after the one they leave.
+  ;------------------------------------------------------------------------*/
+  
+  first = region->blocks[0].chain;
+  last  = region->blocks[n - 1].falls ? region->blocks[n - 1].chain : NONE;
+  
+  for (size_t e = 0 ; (e < nedges) && (edges[e].weight > 0) ; e++)
+  {
+    size_t a = region->blocks[edges[e].from].chain;
+    size_t b = region->blocks[edges[e].to].chain;
+    
+    if (
+            (a != b)
+         && (chains[a].tail == edges[e].from)
+         && (chains[b].head == edges[e].to)
+         && (b != first)
+         && (a != last)
+       )
+    {
+      layout_join(region,chains,a,b);
+      if (b == last)
+        last = a;
+    }
+  }
+  
+  first = region->blocks[0].chain;
+  
+  /*-----------------------------------------------------------------------
+  ; Then lay down the chains, each time taking the one with the most traffic
+  ; to what's already down, in source order when there's a tie.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t next = first ; next != NONE ; )
+  {
+    size_t             best   = NONE;
+    unsigned long long weight = 0;
+    
+    chains[next].placed = true;
+    for (size_t x = chains[next].head ; x != NONE ; x = region->blocks[x].next)
+      region->order[norder++] = x;
+      
+    for (size_t b = 0 ; b < n ; b++)
+    {
+      size_t             c = region->blocks[b].chain;
+      unsigned long long w = 0;
+      
+      if ((chains[c].head != b) || chains[c].placed || (c == last))
+        continue;
+        
+      for (size_t e = 0 ; e < nedges ; e++)
+      {
+        size_t from = region->blocks[edges[e].from].chain;
+        size_t to   = region->blocks[edges[e].to].chain;
+        
+        if (((from == c) && chains[to].placed) || ((to == c) && chains[from].placed))
+          w += edges[e].weight;
+      }
+      
+      if ((best == NONE) || (w > weight))
+      {
+        best   = c;
+        weight = w;
+      }
+    }
+    
+    if ((best == NONE) && (last != NONE) && !chains[last].placed)
+      best = last;
+    next = best;
+  }
+  
+  assert(norder == n);
+  free(edges);
+  free(chains);
+  return true;
+}
+
+/**************************************************************************/
+
+static unsigned long long layout_cost(struct lregion *region,size_t const *order,uint16_t *start)
+{
+  assert(region != NULL);
+  assert(order  != NULL);
+  assert(start  != NULL);
+  
+  unsigned long long cost = 0;
+  uint16_t           addr = region->lines[0].pc;
+  
+  for (size_t k = 0 ; k < region->nblocks ; k++)
+  {
+    size_t b   = order[k];
+    size_t end = b + 1 < region->nblocks ? region->blocks[b + 1].first : region->nlines;
+    
+    start[b] = addr;
+    for (size_t i = region->blocks[b].first ; i < end ; i++)
+      addr += region->lines[i].sz;
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; Each branch is costed in the best form it could take at that distance:
+  ; nothing for a jump to the next instruction, 3 cycles for anything in
+  ; 8-bit range, and the long form otherwise.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t i = 0 ; i < region->nlines ; i++)
+  {
+    struct lline  const *line = &region->lines[i];
+    struct lline  const *dest;
+    uint16_t             from;
+    uint16_t             to;
+    int                  delta;
+    bool                 fits;
+    
+    if ((!line->cond && !line->jump) || (line->target == NONE))
+      continue;
+      
+    dest  = &region->lines[line->target];
+    from  = start[line->block] + (uint16_t)(line->pc - region->lines[region->blocks[line->block].first].pc) + line->sz;
+    to    = start[dest->block] + (uint16_t)(dest->pc - region->lines[region->blocks[dest->block].first].pc);
+    delta = (int16_t)(uint16_t)(to - from);
+    fits  = (delta >= -128) && (delta <= 127);
+    
+    if (line->cond)
+      cost += fits ? 3ull * (line->taken + line->nottaken) : 6ull * line->taken + 5ull * line->nottaken;
+    else if (delta != 0)
+      cost += (fits ? 3ull : line->cycles) * line->exec;
+  }
+  
+  return cost;
+}
+
+/**************************************************************************/
+
+static void layout_report(struct a09 *a09,struct laydata *data,struct lregion *region)
+{
+  assert(a09    != NULL);
+  assert(data   != NULL);
+  assert(region != NULL);
+  
+  char   names[BUFSIZ];
+  size_t len = 0;
+  
+  names[0] = '\0';
+  
+  for (size_t k = 0 ; (k < region->nblocks) && (len < sizeof(names)) ; k++)
+  {
+    struct lblock const *block = &region->blocks[region->order[k]];
+    size_t               end   = region->order[k] + 1 < region->nblocks ? region->blocks[region->order[k] + 1].first : region->nlines;
+    label const         *name  = NULL;
+    
+    for (size_t i = block->first ; (i < end) && (name == NULL) ; i++)
+      if (region->lines[i].named && (memchr(region->lines[i].name.text,'.',region->lines[i].name.len) == NULL))
+        name = &region->lines[i].name;
+        
+    if (name != NULL)
+      len += snprintf(&names[len],sizeof(names) - len,"%s%.*s",k > 0 ? " " : "",name->len,name->text);
+    else
+      len += snprintf(&names[len],sizeof(names) - len,"%s(start)",k > 0 ? " " : "");
+  }
+  
+  a09->lnum = region->line;
+  
+  if (!data->loaded)
+  {
+    message(a09,MSG_NOTE,"layout: %s (no profile given)",names);
+    return;
+  }
+  
+  message(a09,MSG_NOTE,"layout: %s; changing branches to their shortest forms could save about %lld cycles over the profiled run",names,region->saved);
+  
+  /*-----------------------------------------------------------------------
+  ; A long branch costs a cycle more when taken, and moving code can't fix
+  ; that.  Point out the ones that go the other way most of the time.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t i = 0 ; i < region->nlines ; i++)
+  {
+    struct lline const *line = &region->lines[i];
+    
+    if (line->cond && !line->near && (line->taken > line->nottaken))
+    {
+      a09->lnum = region->line + 1 + i;
+      message(
+               a09,
+               MSG_NOTE,
+               "branch taken %lu of %lu times; inverting it lets the busy path fall through",
+               line->taken,
+               line->taken + line->nottaken
+             );
+    }
+  }
+}
+
+/**************************************************************************/
+
+bool layout_init(struct a09 *a09)
+{
+  assert(a09 != NULL);
+  
+  a09->layout = calloc(1,sizeof(struct laydata));
+  if (a09->layout == NULL)
+    return message(a09,MSG_ERROR,"E0046: out of memory");
+  return true;
+}
+
+/**************************************************************************/
+
+bool layout_start(struct opcdata *opd)
+{
+  assert(opd              != NULL);
+  assert(opd->a09         != NULL);
+  assert(opd->a09->layout != NULL);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  struct a09        *a09    = opd->a09;
+  struct laydata *data   = a09->layout;
+  struct buffer      inbuf  = a09->inbuf;
+  size_t             lnum   = a09->lnum;
+  struct lregion    *region = NULL;
+  size_t             idx;
+  bool               rc     = true;
+  
+  if (strcmp(a09->infile,"(stdin)") == 0)
+    return message(a09,MSG_ERROR,"E0125: .LAYOUT can't be used when reading from stdin");
+    
+  if (opd->pass == 1)
+  {
+    if (!data->loaded && (a09->layfile != NULL))
+      if (!layout_profile(a09,data))
+        return false;
+        
+    region = realloc(data->regions,(data->nregions + 1) * sizeof(struct lregion));
+    if (region == NULL)
+      return message(a09,MSG_ERROR,"E0046: out of memory");
+      
+    data->regions   = region;
+    idx             = data->nregions++;
+    region          = &data->regions[idx];
+    region->file    = a09->infile;
+    region->line    = lnum;
+    region->lines   = NULL;
+    region->blocks  = NULL;
+    region->order   = NULL;
+    region->nlines  = 0;
+    region->nblocks = 0;
+    region->end     = 0;
+    region->saved   = 0;
+    
+    if (!layout_scan(a09,region))
+      return false;
+    if (!layout_order(a09,data,region))
+      return false;
+  }
+  else
+  {
+    for (idx = 0 ; idx < data->nregions ; idx++)
+      if ((data->regions[idx].line == lnum) && (strcmp(data->regions[idx].file,a09->infile) == 0))
+        break;
+    assert(idx < data->nregions);
+    
+    print_list(a09,opd,false);
+    opd->includehack = true;
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; Assemble the blocks in their new order.  An INCLUDE in a block could
+  ; start a region of its own, so the region is looked up fresh each line.
+  ; A block runs up to the file position of the next one, and each line is
+  ; found by its position, so a directive that reads ahead can't pull in
+  ; lines from another block.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t k = 0 ; rc && (k < data->regions[idx].nblocks) ; k++)
+  {
+    size_t b     = data->regions[idx].order[k];
+    size_t first = data->regions[idx].blocks[b].first;
+    size_t end   = b + 1 < data->regions[idx].nblocks ? data->regions[idx].blocks[b + 1].first : data->regions[idx].nlines;
+    long   stop  = end < data->regions[idx].nlines ? data->regions[idx].lines[end].offset : data->regions[idx].end;
+    long   pos   = data->regions[idx].lines[first].offset;
+    
+    if (fseek(a09->in,pos,SEEK_SET) != 0)
+    {
+      rc = message(a09,MSG_ERROR,"E0070: %s: %s",a09->infile,strerror(errno));
+      break;
+    }
+    
+    for (size_t i = first ; (i < end) && (pos < stop) ; )
+    {
+      uint16_t pc = a09->pc;
+      
+      while((i + 1 < end) && (data->regions[idx].lines[i + 1].offset <= pos))
+        i++;
+        
+      a09->lnum = lnum + 1 + i;
+      if (!read_line(a09,a09->in,&a09->inbuf))
+      {
+        rc = false;
+        break;
+      }
+      if (!parse_line(a09,&a09->inbuf,opd->pass))
+      {
+        rc = false;
+        break;
+      }
+      
+      if (opd->pass == 1)
+      {
+        data->regions[idx].lines[i].pc = pc;
+        data->regions[idx].lines[i].sz = a09->pc - pc;
+      }
+      
+      pos = ftell(a09->in);
+      if (pos == -1)
+      {
+        rc = message(a09,MSG_ERROR,"E0070: %s: %s",a09->infile,strerror(errno));
+        break;
+      }
+    }
+  }
+  
+  region = &data->regions[idx];
+  
+  if (rc && (region->nlines > 0))
+  {
+    if (opd->pass == 1)
+    {
+      uint16_t *start  = calloc(region->nblocks,sizeof(uint16_t));
+      size_t   *source = calloc(region->nblocks,sizeof(size_t));
+      
+      if ((start == NULL) || (source == NULL))
+        rc = message(a09,MSG_ERROR,"E0046: out of memory");
+      else
+      {
+        for (size_t b = 0 ; b < region->nblocks ; b++)
+          source[b] = b;
+        region->saved = (long long)layout_cost(region,source,start)
+                      - (long long)layout_cost(region,region->order,start);
+      }
+      
+      free(source);
+      free(start);
+    }
+    else
+      layout_report(a09,data,region);
+  }
+  
+  if (rc && (fseek(a09->in,region->end,SEEK_SET) != 0))
+    rc = message(a09,MSG_ERROR,"E0070: %s: %s",a09->infile,strerror(errno));
+    
+  a09->lnum  = lnum + region->nlines;
+  a09->inbuf = inbuf;
+  data->open = rc;
+  return rc;
+}
+
+/**************************************************************************/
+
+bool layout_end(struct opcdata *opd)
+{
+  assert(opd              != NULL);
+  assert(opd->a09         != NULL);
+  assert(opd->a09->layout != NULL);
+  
+  if (!opd->a09->layout->open)
+    return message(opd->a09,MSG_ERROR,"E0122: .ENDLAY without .LAYOUT");
+  opd->a09->layout->open = false;
+  return true;
+}
+
+/**************************************************************************/
+
+bool layout_fini(struct a09 *a09)
+{
+  assert(a09 != NULL);
+  
+  struct laydata *data = a09->layout;
+  
+  if (data != NULL)
+  {
+    for (size_t i = 0 ; i < data->nregions ; i++)
+    {
+      free(data->regions[i].order);
+      free(data->regions[i].blocks);
+      free(data->regions[i].lines);
+    }
+    for (size_t i = 0 ; i < data->nprof ; i++)
+      free(data->prof[i].file);
+    free(data->prof);
+    free(data->regions);
+    free(data);
+    a09->layout = NULL;
+  }
+  return true;
+}
+
+/**************************************************************************/
@@ -733,12 +733,12 @@ static bool op_inh(struct opcdata *opd)
          || (opd->a09->prevop == 0xBD) /* JSR extended */
        )
     {
-      if (!labeled(opd))
+      if (!labeled(opd) && (opd->a09->peep == NULL))
         message(opd->a09,MSG_WARNING,"W0020: BSR/LBSR/JSR followed by RTS, maybe use BRA/LBRA/JMP?");
     }
     else if(opd->a09->prevop == 0x35) /* PULS */
     {
-      if (!labeled(opd))
+      if (!labeled(opd) && (opd->a09->peep == NULL))
         message(opd->a09,MSG_WARNING,"W0021: PULS followed by RTS, maybe add ',PC' to PULS?");
     }
   }
@@ -968,11 +968,16 @@ static bool op_lbr(struct opcdata *opd)
   {
     uint16_t delta = opd->value.value - (opd->a09->pc + (opd->op->page ? 4 : 3));
     
-    if ((opd->pass == 2) && (opd->op->opcode != 0x21))
+    /*---------------------------------------------------------------------
+    ; With '-e o', a tail call to the next instruction is removed, so there
+    ; is nothing to warn about.
+    ;----------------------------------------------------------------------*/
+    
+    if ((opd->pass == 2) && (opd->op->opcode != 0x21) && ((opd->a09->peep == NULL) || !peep_gone(opd)))
     {
       if (delta == 0)
         message(opd->a09,MSG_WARNING,"W0012: branch to next location, maybe remove?");
-      else if ((delta < 0x80) || (delta > 0xFF80))
+      else if (((delta < 0x80) || (delta > 0xFF80)) && ((opd->a09->peep == NULL) || !peep_short(opd)))
         message(opd->a09,MSG_WARNING,"W0009: offset could be 8-bits, maybe use short branch?");
     }
     
@@ -1075,8 +1080,12 @@ static bool op_pshpul(struct opcdata *opd)
     }
   }
   
+  /*-----------------------------------------------------------------------
+  ; '-e o' turns PULS PC into RTS, but leaves PULU PC alone.
+  ;------------------------------------------------------------------------*/
+  
   if (opd->pass == 1)
-    if ((opd->op->opcode == 0x35) || (opd->op->opcode == 0x37))
+    if (((opd->op->opcode == 0x35) && (opd->a09->peep == NULL)) || (opd->op->opcode == 0x37))
       if (operand == 0x80)
         message(opd->a09,MSG_WARNING,"W0024: only pulling PC, maybe use RTS?");
       
@@ -1247,7 +1256,11 @@ static bool pseudo_end(struct opcdata *opd)
       return message(opd->a09,MSG_ERROR,"E0050: not a label");
     sym = symbol_find(opd->a09,&label);
     if ((sym != NULL) && (opd->pass == 2))
+    {
       sym->refs++;
+      if ((opd->a09->flow != NULL) && !flow_root(opd->a09,sym->value))
+        return false;
+    }
   }
   return opd->a09->format.end(&opd->a09->format,opd,sym);
 }
@@ -1324,6 +1337,11 @@ static bool pseudo_fdb(struct opcdata *opd)
         opd->bytes[opd->sz++] = word[0];
         opd->bytes[opd->sz++] = word[1];
       }
+      if (opd->a09->flow != NULL)
+      {
+        if (!flow_word(opd,opd->value.value))
+          return false;
+      }
       if (opd->a09->obj)
       {
         if (!opd->a09->format.write(&opd->a09->format,opd,word,2,DATA))
@@ -1729,6 +1747,28 @@ static bool pseudo__code(struct opcdata *opd)
 
 /**************************************************************************/
 
+static bool pseudo__cycles(struct opcdata *opd)
+{
+  assert(opd      != NULL);
+  assert(opd->a09 != NULL);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  return timing_start(opd);
+}
+
+/**************************************************************************/
+
+static bool pseudo__delay(struct opcdata *opd)
+{
+  assert(opd      != NULL);
+  assert(opd->a09 != NULL);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  return delay_gen(opd);
+}
+
+/**************************************************************************/
+
 static bool pseudo__dp(struct opcdata *opd)
 {
   assert(opd != NULL);
@@ -1741,6 +1781,57 @@ static bool pseudo__dp(struct opcdata *opd)
 
 /**************************************************************************/
 
+static bool pseudo__dpvar(struct opcdata *opd)
+{
+  assert(opd != NULL);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  struct symbol *sym;
+  uint16_t       addr;
+  bool           direct;
+  char           c;
+  
+  if (opd->label.len == 0)
+    return message(opd->a09,MSG_ERROR,"E0120: missing label for .DPVAR");
+    
+  c = skip_space(opd->buffer);
+  if (isEOL(c))
+    opd->value.value = 1;
+  else
+  {
+    opd->buffer->ridx--;
+    if (!parse_dirext(opd))
+      return false;
+  }
+  
+  if (!dpvar_place(opd,&addr,&direct))
+    return false;
+    
+  /*-----------------------------------------------------------------------
+  ; A variable in the direct page takes no space here; one that didn't fit
+  ; is just RMB.
+  ;------------------------------------------------------------------------*/
+  
+  if (direct)
+  {
+    sym = symbol_find(opd->a09,&opd->label);
+    assert(sym != NULL);
+    sym->value = addr;
+    sym->type  = SYM_EQU;
+    sym->bits  = 8;
+    return true;
+  }
+  
+  opd->data   = true;
+  opd->datasz = opd->value.value;
+  if (opd->a09->obj)
+    return opd->a09->format.rmb(&opd->a09->format,opd);
+  else
+    return true;
+}
+
+/**************************************************************************/
+
 static bool pseudo_align(struct opcdata *opd)
 {
   uint16_t rem;
@@ -1847,6 +1938,28 @@ static bool pseudo__assert(struct opcdata *opd)
 
 /**************************************************************************/
 
+static bool pseudo__endcyc(struct opcdata *opd)
+{
+  assert(opd      != NULL);
+  assert(opd->a09 != NULL);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  return timing_end(opd);
+}
+
+/**************************************************************************/
+
+static bool pseudo__endlay(struct opcdata *opd)
+{
+  assert(opd      != NULL);
+  assert(opd->a09 != NULL);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  return layout_end(opd);
+}
+
+/**************************************************************************/
+
 static bool pseudo__endtst(struct opcdata *opd)
 {
   assert(opd      != NULL);
@@ -1858,6 +1971,28 @@ static bool pseudo__endtst(struct opcdata *opd)
 
 /**************************************************************************/
 
+static bool pseudo__inpool(struct opcdata *opd)
+{
+  assert(opd      != NULL);
+  assert(opd->a09 != NULL);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  return pool_add(opd);
+}
+
+/**************************************************************************/
+
+static bool pseudo__layout(struct opcdata *opd)
+{
+  assert(opd      != NULL);
+  assert(opd->a09 != NULL);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  return layout_start(opd);
+}
+
+/**************************************************************************/
+
 static bool pseudo__notest(struct opcdata *opd)
 {
   assert(opd      != NULL);
@@ -1869,6 +2004,45 @@ static bool pseudo__notest(struct opcdata *opd)
 
 /**************************************************************************/
 
+static bool pseudo__pool(struct opcdata *opd)
+{
+  assert(opd      != NULL);
+  assert(opd->a09 != NULL);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  return pool_place(opd);
+}
+
+/**************************************************************************/
+
+static bool pseudo__root(struct opcdata *opd)
+{
+  assert(opd         != NULL);
+  assert(opd->a09    != NULL);
+  assert(opd->buffer != NULL);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  while(true)
+  {
+    skip_space(opd->buffer);
+    opd->buffer->ridx--;
+    if (!expr(&opd->value,opd->a09,opd->buffer,opd->pass))
+      return false;
+      
+    if ((opd->pass == 2) && (opd->a09->flow != NULL))
+      if (!flow_root(opd->a09,opd->value.value))
+        return false;
+        
+    char c = skip_space(opd->buffer);
+    if (isEOL(c))
+      return true;
+    if (c != ',')
+      return message(opd->a09,MSG_ERROR,"E0034: missing comma");
+  }
+}
+
+/**************************************************************************/
+
 static bool pseudo__test(struct opcdata *opd)
 {
   assert(opd      != NULL);
@@ -2033,6 +2207,30 @@ static bool pseudo__opt(struct opcdata *opd)
     return true;
   }
   
+  else if ((tmp.len == 6) && (memcmp(tmp.text,"DPPOOL",6) == 0))
+  {
+    if (!parse_dirext(opd))
+      return false;
+    opd->a09->dppool = opd->value.value;
+    return true;
+  }
+  
+  else if ((tmp.len == 7) && (memcmp(tmp.text,"MASKMAX",7) == 0))
+  {
+    if (!expr(&opd->value,opd->a09,opd->buffer,opd->pass))
+      return false;
+    opd->a09->maskmax = opd->value.value;
+    return true;
+  }
+  
+  else if ((tmp.len == 8) && (memcmp(tmp.text,"STACKMAX",8) == 0))
+  {
+    if (!expr(&opd->value,opd->a09,opd->buffer,opd->pass))
+      return false;
+    opd->a09->stackmax = opd->value.value;
+    return true;
+  }
+  
   else if ((tmp.len == 6) && (memcmp(tmp.text,"EXADDR",6) == 0))
   {
     c = skip_space(opd->buffer);
@@ -2047,6 +2245,21 @@ static bool pseudo__opt(struct opcdata *opd)
       
     return true;
   }
+  
+  else if ((tmp.len == 6) && (memcmp(tmp.text,"THREAD",6) == 0))
+  {
+    c = skip_space(opd->buffer);
+    read_label(opd->buffer,&tmp,c);
+    upper_label(&tmp);
+    if ((tmp.len == 5) && (memcmp(tmp.text,"FALSE",5) == 0))
+      opd->a09->thread = false;
+    else if ((tmp.len == 4) && (memcmp(tmp.text,"TRUE",4) == 0))
+      opd->a09->thread = true;
+    else
+      return message(opd->a09,MSG_ERROR,"E0086: boolean value must be 'true' or 'false'");
+      
+    return true;
+  }
   else
     return message(opd->a09,MSG_ERROR,"E0087: option '%.*s' not supported",tmp.len,tmp.text);
 }
@@ -2217,13 +2430,23 @@ bool parse_op(struct buffer *buffer,struct opcode const **pop)
                /*  HNZVC */
     { ".ASSERT" , ""      , pseudo__assert ,  0 , 0x00 , 0x00 , false } , // test
     { ".CODE"   , ""      , pseudo__code   ,  0 , 0x00 , 0x00 , false } ,
+    { ".CYCLES" , ""      , pseudo__cycles ,  0 , 0x00 , 0x00 , false } ,
+    { ".DELAY"  , ""      , pseudo__delay  ,  0 , 0x00 , 0x00 , false } ,
     { ".DP"     , ""      , pseudo__dp     ,  0 , 0x00 , 0x00 , false } ,
+    { ".DPVAR"  , ""      , pseudo__dpvar  ,  0 , 0x00 , 0x00 , false } ,
+    { ".ENDCYC" , ""      , pseudo__endcyc ,  0 , 0x00 , 0x00 , false } ,
+    { ".ENDLAY" , ""      , pseudo__endlay ,  0 , 0x00 , 0x00 , false } ,
     { ".ENDTST" , ""      , pseudo__endtst ,  0 , 0x00 , 0x00 , false } , // test
     { ".FLOAT"  , ""      , pseudo__float  ,  0 , 0x00 , 0x00 , false } ,
     { ".FLOATD" , ""      , pseudo__float  ,  0 , 0x01 , 0x00 , false } ,
+    { ".INPOOL" , ""      , pseudo__inpool ,  0 , 0x00 , 0x00 , false } ,
+    { ".LAYOUT" , ""      , pseudo__layout ,  0 , 0x00 , 0x00 , false } ,
     { ".NOTEST" , ""      , pseudo__notest ,  0 , 0x00 , 0x00 , false } , // test
     { ".OPT"    , ""      , pseudo__opt    ,  0 , 0x00 , 0x00 , false } ,
     { ".PCLE"   , ""      , pseudo__pcle   ,  0 , 0x00 , 0x00 , false } ,
+    { ".POOL"   , ""      , pseudo__pool   ,  0 , 0x00 , 0x00 , false } ,
+    { ".ROOT"   , ""      , pseudo__root   ,  0 , 0x00 , 0x00 , false } ,
+    { ".SETUP"  , ""      , pseudo__test   ,  0 , 0x01 , 0x00 , false } , // test
     { ".TEST"   , ""      , pseudo__test   ,  0 , 0x00 , 0x00 , false } , // test
     { ".TROFF"  , ""      , pseudo__troff  ,  0 , 0x00 , 0x00 , false } , // test
     { ".TRON"   , ""      , pseudo__tron   ,  0 , 0x00 , 0x00 , false } , // test
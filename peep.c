@@ -0,0 +1,740 @@
+/****************************************************************************
+*
+*   Peephole optimizer---rewrite what the warnings only suggest
+*   Copyright (C) 2023 Sean Conner
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*   Comments, questions and criticisms can be sent to: sean@conman.org
+*
+****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "a09.h"
+
+#define MAXHOPS 8
+
+/*--------------------------------------------------------------------------
+; Any rewrite that changes the size of the code has to be decided on pass 1
+; so the labels that follow get their final addresses.  Those that need to
+; look ahead (a call followed by RTS only becomes a tail call once we see
+; the RTS) are recorded on pass 1 and replayed, in the same order, on pass
+; 2.  Branch threading doesn't change any sizes, so it's done on pass 2
+; using the unconditional jumps collected on pass 1.
+;--------------------------------------------------------------------------*/
+
+enum peepkind
+{
+  PEEP_SHORT,  /* long branch to a known address fits in 8 bits */
+  PEEP_TAIL,   /* BSR/LBSR/JSR followed by RTS becomes BRA/LBRA/JMP */
+  PEEP_FOLD,   /* PULS followed by RTS pulls the PC instead */
+  PEEP_NEXT,   /* tail call to the next instruction is removed */
+};
+
+struct peeprec
+{
+  size_t         line;
+  uint16_t       pc;
+  enum peepkind  kind;
+};
+
+struct peepjump
+{
+  uint16_t addr;
+  size_t   cycles;
+  size_t   section;
+  label    target;
+};
+
+struct peepdata
+{
+  struct peeprec  *recs;
+  struct peepjump *jumps;
+  size_t           nrecs;
+  size_t           maxrecs;
+  size_t           njumps;
+  size_t           next;      /* pass 2 cursor into recs */
+  size_t           rewrites;
+  size_t           bytes;
+  size_t           cycles;
+  size_t           prevline;
+  size_t           tailline;
+  size_t           section;   /* bumped whenever the code isn't contiguous */
+  int              pass;
+  uint16_t         nextpc;
+  uint16_t         prevpc;
+  uint16_t         tailpc;
+  label            prevto;    /* target of the previous call */
+  unsigned char    prevop;
+  unsigned char    prevpb;
+  bool             prev;      /* previous line is an instruction */
+  bool             prevlbl;   /* prevto is valid */
+  bool             drop;      /* drop the RTS on the next line */
+  bool             tail;      /* the RTS of a tail call was just dropped */
+};
+
+/**************************************************************************/
+
+static int jumpcmp(void const *needle,void const *haystack)
+{
+  uint16_t        const *addr = needle;
+  struct peepjump const *jump = haystack;
+  
+  if (*addr < jump->addr)
+    return -1;
+  else if (*addr > jump->addr)
+    return 1;
+  else
+    return 0;
+}
+
+/**************************************************************************/
+
+static int jumpsort(void const *restrict l,void const *restrict r)
+{
+  struct peepjump const *left = l;
+  return jumpcmp(&left->addr,r);
+}
+
+/**************************************************************************/
+
+static bool peep_saved(
+        struct a09      *a09,
+        struct peepdata *peep,
+        char const      *what,
+        size_t           bytes,
+        size_t           cycles
+)
+{
+  assert(a09  != NULL);
+  assert(peep != NULL);
+  assert(what != NULL);
+  
+  peep->rewrites++;
+  peep->bytes  += bytes;
+  peep->cycles += cycles;
+  return message(a09,MSG_NOTE,"%s, saved %zu byte%s and %zu cycle%s",what,bytes,bytes == 1 ? "" : "s",cycles,cycles == 1 ? "" : "s");
+}
+
+/**************************************************************************/
+
+static bool peep_decide(
+        struct peepdata *peep,
+        int              pass,
+        size_t           line,
+        uint16_t         pc,
+        enum peepkind    kind,
+        bool             cond
+)
+{
+  assert(peep != NULL);
+  assert((pass == 1) || (pass == 2));
+  
+  if (pass == 1)
+  {
+    if (cond)
+    {
+      assert(peep->nrecs < peep->maxrecs);
+      peep->recs[peep->nrecs++] = (struct peeprec){ .line = line , .pc = pc , .kind = kind };
+    }
+    return cond;
+  }
+  
+  if (
+          (peep->next < peep->nrecs)
+       && (peep->recs[peep->next].line == line)
+       && (peep->recs[peep->next].pc   == pc)
+       && (peep->recs[peep->next].kind == kind)
+     )
+  {
+    peep->next++;
+    return true;
+  }
+  
+  return false;
+}
+
+/**************************************************************************/
+
+static bool peep_room(struct a09 *a09,struct peepdata *peep)
+{
+  assert(a09  != NULL);
+  assert(peep != NULL);
+  
+  if (peep->nrecs == peep->maxrecs)
+  {
+    size_t          max  = peep->maxrecs == 0 ? 64 : peep->maxrecs * 2;
+    struct peeprec *recs = realloc(peep->recs,max * sizeof(struct peeprec));
+    
+    if (recs == NULL)
+      return message(a09,MSG_ERROR,"E0046: out of memory");
+    peep->recs    = recs;
+    peep->maxrecs = max;
+  }
+  return true;
+}
+
+/**************************************************************************/
+
+static bool peep_target(struct a09 *a09,label *target)
+{
+  assert(a09    != NULL);
+  assert(target != NULL);
+  
+  struct buffer        buf = a09->inbuf;
+  struct opcode const *op;
+  label                tmp;
+  char                 c;
+  
+  /*-----------------------------------------------------------------------
+  ; Reparse the line to see if the operand is nothing but a label.  Anything
+  ; fancier (an expression, a forced addressing mode) is left alone.
+  ;------------------------------------------------------------------------*/
+  
+  buf.ridx = 0;
+  parse_label(&tmp,&buf,a09,2);
+  skip_space(&buf);
+  buf.ridx--;
+  if (!parse_op(&buf,&op))
+    return false;
+  c = skip_space(&buf);
+  if (isEOL(c))
+    return false;
+  buf.ridx--;
+  if (!parse_label(target,&buf,a09,2))
+    return false;
+  c = skip_space(&buf);
+  return isEOL(c);
+}
+
+/**************************************************************************/
+
+static bool peep_jump(struct opcdata *opd,struct peepdata *peep)
+{
+  assert(opd  != NULL);
+  assert(peep != NULL);
+  
+  struct peepjump *jump;
+  label            target;
+  
+  if (opd->value.external || !opd->a09->thread)
+    return true;
+  if (!(
+            ((opd->sz == 2) && (opd->bytes[0] == 0x20)) /* BRA          */
+         || ((opd->sz == 3) && (opd->bytes[0] == 0x16)) /* LBRA         */
+         || ((opd->sz == 3) && (opd->bytes[0] == 0x7E)) /* JMP extended */
+     ))
+    return true;
+  if (!peep_target(opd->a09,&target))
+    return true;
+    
+  jump = realloc(peep->jumps,(peep->njumps + 1) * sizeof(struct peepjump));
+  if (jump == NULL)
+    return message(opd->a09,MSG_ERROR,"E0046: out of memory");
+    
+  peep->jumps   = jump;
+  jump          = &peep->jumps[peep->njumps++];
+  jump->addr    = opd->a09->pc + opd->a09->phase;
+  jump->cycles  = opd->cycles + opd->ecycles;
+  jump->section = peep->section;
+  jump->target  = target;
+  return true;
+}
+
+/**************************************************************************/
+
+static bool peep_thread(struct opcdata *opd,struct peepdata *peep)
+{
+  assert(opd       != NULL);
+  assert(opd->pass == 2);
+  assert(peep      != NULL);
+  
+  size_t   at;
+  bool     jmp;
+  uint16_t target;
+  uint16_t best;
+  size_t   saved;
+  size_t   cycles;
+  
+  if (opd->value.external || (peep->njumps == 0))
+    return true;
+    
+  /*-----------------------------------------------------------------------
+  ; BRN and LBRN are left alone---they're used to skip bytes, not to go
+  ; anywhere.  Calls are left alone as well.
+  ;------------------------------------------------------------------------*/
+  
+  if ((opd->sz == 2) && (opd->bytes[0] >= 0x20) && (opd->bytes[0] <= 0x2F) && (opd->bytes[0] != 0x21))
+    at = 1;
+  else if ((opd->sz == 3) && (opd->bytes[0] == 0x16))
+    at = 1;
+  else if ((opd->sz == 4) && (opd->bytes[0] == 0x10) && (opd->bytes[1] >= 0x22) && (opd->bytes[1] <= 0x2F))
+    at = 2;
+  else if ((opd->sz == 3) && (opd->bytes[0] == 0x7E) && (opd->mode == AM_EXTENDED))
+    at = 1;
+  else
+    return true;
+    
+  jmp    = opd->bytes[0] == 0x7E;
+  target = opd->value.value;
+  best   = target;
+  saved  = 0;
+  cycles = 0;
+  
+  /*-----------------------------------------------------------------------
+  ; Only jumps in the same stretch of code are followed.  A JMP off on its
+  ; own (after an ORG or RMB) is likely a vector in RAM that gets patched
+  ; at run time, so threading through it would bypass the patch.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t hop = 0 ; hop < MAXHOPS ; hop++)
+  {
+    struct peepjump *jump = bsearch(&target,peep->jumps,peep->njumps,sizeof(struct peepjump),jumpcmp);
+    if ((jump == NULL) || (jump->section != peep->section))
+      break;
+    struct symbol *sym = symbol_find(opd->a09,&jump->target);
+    if ((sym == NULL) || (sym->type == SYM_UNDEF) || (sym->type == SYM_EXTERN))
+      break;
+    if (sym->value == jump->addr)
+      break;
+      
+    target  = sym->value;
+    cycles += jump->cycles;
+    
+    if (!jmp)
+    {
+      uint16_t delta = target - (opd->a09->pc + opd->sz);
+      if ((opd->sz == 2) && (delta > 0x007F) && (delta < 0xFF80))
+        continue;
+    }
+    
+    best  = target;
+    saved = cycles;
+  }
+  
+  if (saved == 0)
+    return true;
+    
+  if (jmp)
+  {
+    opd->bytes[1] = best >> 8;
+    opd->bytes[2] = best & 255;
+  }
+  else
+  {
+    uint16_t delta = best - (opd->a09->pc + opd->sz);
+    if (opd->sz == 2)
+      opd->bytes[at] = delta & 255;
+    else
+    {
+      opd->bytes[at]     = delta >> 8;
+      opd->bytes[at + 1] = delta & 255;
+    }
+  }
+  
+  return peep_saved(opd->a09,peep,"threaded jump to jump",0,saved);
+}
+
+/**************************************************************************/
+
+bool peep_init(struct a09 *a09)
+{
+  assert(a09 != NULL);
+  
+  a09->peep = calloc(1,sizeof(struct peepdata));
+  if (a09->peep == NULL)
+    return message(a09,MSG_ERROR,"E0046: out of memory");
+  return true;
+}
+
+/**************************************************************************/
+
+void peep_label(struct a09 *a09)
+{
+  assert(a09       != NULL);
+  assert(a09->peep != NULL);
+  
+  /*-----------------------------------------------------------------------
+  ; Something can jump here, so whatever came before doesn't matter.
+  ;------------------------------------------------------------------------*/
+  
+  a09->peep->prev = false;
+}
+
+/**************************************************************************/
+
+bool peep_short(struct opcdata *opd)
+{
+  assert(opd            != NULL);
+  assert(opd->a09       != NULL);
+  assert(opd->a09->peep != NULL);
+  assert(opd->pass      == 2);
+  
+  struct peepdata *peep = opd->a09->peep;
+  
+  return (peep->next < peep->nrecs)
+      && (peep->recs[peep->next].line == opd->a09->lnum)
+      && (peep->recs[peep->next].pc   == opd->a09->pc)
+      && (peep->recs[peep->next].kind == PEEP_SHORT);
+}
+
+/**************************************************************************/
+
+bool peep_gone(struct opcdata *opd)
+{
+  assert(opd            != NULL);
+  assert(opd->a09       != NULL);
+  assert(opd->a09->peep != NULL);
+  assert(opd->pass      == 2);
+  
+  struct peepdata *peep = opd->a09->peep;
+  
+  for (
+        size_t i = peep->next ;
+           (i < peep->nrecs)
+        && (peep->recs[i].line == opd->a09->lnum)
+        && (peep->recs[i].pc   == opd->a09->pc) ;
+        i++
+      )
+    if (peep->recs[i].kind == PEEP_NEXT)
+      return true;
+  return false;
+}
+
+/**************************************************************************/
+
+static bool peep_rewrite(struct opcdata *opd,struct peepdata *peep)
+{
+  assert(opd      != NULL);
+  assert(opd->a09 != NULL);
+  assert(opd->op  != NULL);
+  assert(peep     != NULL);
+  
+  struct a09 *a09 = opd->a09;
+  bool        drop;
+  
+  drop       = peep->drop;
+  peep->drop = false;
+  
+  if (opd->data || (opd->sz == 0) || (opd->op->cycles == 0) || test_intest(a09))
+  {
+    peep->prev = false;
+    return true;
+  }
+  
+  if (opd->pass == 1)
+    if (!peep_room(a09,peep))
+      return false;
+  
+  /*-----------------------------------------------------------------------
+  ; An RTS after a call or a PULS is folded into the previous instruction.
+  ; On pass 1 that's decided here; on pass 2 the previous instruction has
+  ; already been rewritten and told us to drop this one.
+  ;------------------------------------------------------------------------*/
+  
+  if ((opd->sz == 1) && (opd->bytes[0] == 0x39))
+  {
+    if ((opd->pass == 1) && peep->prev)
+    {
+      drop = peep_decide(
+                peep,
+                1,
+                peep->prevline,
+                peep->prevpc,
+                PEEP_TAIL,
+                   (peep->prevop == 0x8D) /* BSR          */
+                || (peep->prevop == 0x17) /* LBSR         */
+                || (peep->prevop == 0x9D) /* JSR direct   */
+                || (peep->prevop == 0xAD) /* JSR indexed  */
+                || (peep->prevop == 0xBD) /* JSR extended */
+             );
+      if (drop && peep->prevlbl)
+      {
+        peep->tail     = true;
+        peep->tailline = peep->prevline;
+        peep->tailpc   = peep->prevpc;
+      }
+      else if (!drop)
+        drop = peep_decide(
+                  peep,
+                  1,
+                  peep->prevline,
+                  peep->prevpc,
+                  PEEP_FOLD,
+                  (peep->prevop == 0x35) && ((peep->prevpb & 0x80) == 0) /* PULS without PC */
+               );
+    }
+    
+    if (drop)
+    {
+      opd->sz      = 0;
+      opd->cycles  = 0;
+      peep->prev   = false;
+      return true;
+    }
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; A long branch back to a known address that's within 8 bits is made
+  ; short.  Forward branches would need another pass over the source.
+  ;------------------------------------------------------------------------*/
+  
+  if ((opd->mode == AM_BRANCH) && !opd->value.external)
+  {
+    unsigned char op = 0;
+    
+    if ((opd->sz == 3) && (opd->bytes[0] == 0x16))
+      op = 0x20;
+    else if ((opd->sz == 3) && (opd->bytes[0] == 0x17))
+      op = 0x8D;
+    else if ((opd->sz == 4) && (opd->bytes[0] == 0x10) && (opd->bytes[1] != 0x21))
+      op = opd->bytes[1];
+      
+    if (op != 0)
+    {
+      uint16_t delta = opd->value.value - (a09->pc + 2);
+      bool     fits  = !opd->value.unknownpass1 && ((delta < 0x0080) || (delta >= 0xFF80));
+      
+      if (peep_decide(peep,opd->pass,a09->lnum,a09->pc,PEEP_SHORT,fits))
+      {
+        size_t bytes  = opd->sz - 2;
+        size_t cycles = opd->cycles - (op == 0x8D ? 7 : 3);
+        
+        opd->sz       = 2;
+        opd->bytes[0] = op;
+        opd->bytes[1] = delta & 255;
+        opd->cycles   = op == 0x8D ? 7 : 3;
+        opd->acycles  = 0;
+        
+        if (opd->pass == 2)
+          if (!peep_saved(a09,peep,"long branch made short",bytes,cycles))
+            return false;
+      }
+    }
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; PULS PC is just RTS.
+  ;------------------------------------------------------------------------*/
+  
+  if ((opd->sz == 2) && (opd->bytes[0] == 0x35) && (opd->bytes[1] == 0x80))
+  {
+    opd->sz       = 1;
+    opd->bytes[0] = 0x39;
+    opd->cycles   = 5;
+    opd->ecycles  = 0;
+    
+    if (opd->pass == 2)
+      if (!peep_saved(a09,peep,"PULS PC replaced with RTS",1,2))
+        return false;
+  }
+  
+  if (opd->pass == 1)
+  {
+    if (!peep_jump(opd,peep))
+      return false;
+  }
+  else
+  {
+    if (peep_decide(peep,2,a09->lnum,a09->pc,PEEP_TAIL,false))
+    {
+      switch(opd->bytes[0])
+      {
+        case 0x8D: opd->bytes[0] = 0x20; break; /* BSR  -> BRA  */
+        case 0x17: opd->bytes[0] = 0x16; break; /* LBSR -> LBRA */
+        case 0x9D: opd->bytes[0] = 0x0E; break; /* JSR  -> JMP  */
+        case 0xAD: opd->bytes[0] = 0x6E; break;
+        case 0xBD: opd->bytes[0] = 0x7E; break;
+        default:   assert(0);            break;
+      }
+      
+      opd->cycles -= 4;
+      peep->drop   = true;
+      if (!peep_saved(a09,peep,"tail call made a jump, RTS removed",1,9))
+        return false;
+        
+      if (peep_decide(peep,2,a09->lnum,a09->pc,PEEP_NEXT,false))
+      {
+        size_t bytes  = opd->sz;
+        size_t cycles = opd->cycles + opd->ecycles;
+        
+        opd->sz      = 0;
+        opd->cycles  = 0;
+        opd->ecycles = 0;
+        peep->prev   = false;
+        return peep_saved(a09,peep,"jump to the next instruction removed",bytes,cycles);
+      }
+    }
+    else if (peep_decide(peep,2,a09->lnum,a09->pc,PEEP_FOLD,false))
+    {
+      opd->bytes[1] |= 0x80;
+      opd->ecycles  += 2;
+      peep->drop     = true;
+      if (!peep_saved(a09,peep,"RTS folded into PULS",1,3))
+        return false;
+    }
+    
+    if (!peep_thread(opd,peep))
+      return false;
+  }
+  
+  peep->prev     = true;
+  peep->prevline = a09->lnum;
+  peep->prevpc   = a09->pc;
+  peep->prevop   = opd->bytes[0];
+  peep->prevpb   = opd->bytes[1];
+  peep->prevlbl  = (opd->pass == 1)
+                && (
+                        (opd->bytes[0] == 0x8D) /* BSR          */
+                     || (opd->bytes[0] == 0x17) /* LBSR         */
+                     || (opd->bytes[0] == 0xBD) /* JSR extended */
+                   )
+                && !opd->value.external
+                && peep_target(a09,&peep->prevto);
+  return true;
+}
+
+/**************************************************************************/
+
+static bool peep_fallin(struct opcdata *opd,struct peepdata *peep)
+{
+  assert(opd       != NULL);
+  assert(opd->a09  != NULL);
+  assert(opd->pass == 1);
+  assert(peep      != NULL);
+  
+  struct a09    *a09 = opd->a09;
+  struct symbol *sym;
+  
+  /*-----------------------------------------------------------------------
+  ; A tail call whose RTS was dropped, to the label on the very next
+  ; instruction, would be a jump to the next location.  The target wasn't
+  ; known when the RTS went, so back up over the jump now, and move the
+  ; label with it.  Only this line has seen the old address, and nothing
+  ; on it has been recorded yet.
+  ;------------------------------------------------------------------------*/
+  
+  if (
+          opd->data
+       || (opd->op->cycles == 0)
+       || (opd->label.len != peep->prevto.len)
+       || (memcmp(opd->label.text,peep->prevto.text,opd->label.len) != 0)
+     )
+    return true;
+    
+  sym = symbol_find(a09,&opd->label);
+  if ((sym == NULL) || (sym->type != SYM_ADDRESS) || (sym->value != (uint16_t)(a09->pc + a09->phase)))
+    return true;
+  if (!peep_room(a09,peep))
+    return false;
+    
+  peep_decide(peep,1,peep->tailline,peep->tailpc,PEEP_NEXT,true);
+  a09->pc      = peep->tailpc;
+  sym->value   = a09->pc + a09->phase;
+  peep->nextpc = a09->pc;
+  return true;
+}
+
+/**************************************************************************/
+
+bool peep_line(struct opcdata *opd)
+{
+  assert(opd            != NULL);
+  assert(opd->a09       != NULL);
+  assert(opd->a09->peep != NULL);
+  
+  struct a09      *a09  = opd->a09;
+  struct peepdata *peep = a09->peep;
+  bool             rc;
+  
+  if (peep->pass != opd->pass)
+  {
+    peep->pass    = opd->pass;
+    peep->next    = 0;
+    peep->section = 0;
+    peep->nextpc  = 0;
+    peep->prev    = false;
+    peep->drop    = false;
+    peep->tail    = false;
+    if (peep->pass == 2)
+      qsort(peep->jumps,peep->njumps,sizeof(struct peepjump),jumpsort);
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; The sizes are settled once the line is rewritten, so the next line can
+  ; tell if it follows on from this one.  Since any size changes are made
+  ; the same way on both passes, so are the section numbers.
+  ;------------------------------------------------------------------------*/
+  
+  if ((opd->pass == 1) && peep->tail)
+  {
+    peep->tail = false;
+    if (!peep_fallin(opd,peep))
+      return false;
+  }
+  
+  if (a09->pc != peep->nextpc)
+    peep->section++;
+    
+  rc           = peep_rewrite(opd,peep);
+  peep->nextpc = a09->pc + (opd->data ? opd->datasz : opd->sz);
+  return rc;
+}
+
+/**************************************************************************/
+
+bool peep_report(struct a09 *a09)
+{
+  assert(a09       != NULL);
+  assert(a09->peep != NULL);
+  
+  size_t lnum = a09->lnum;
+  bool   rc   = true;
+  
+  if (a09->peep->rewrites > 0)
+  {
+    a09->lnum = 0;
+    rc        = message(
+                  a09,
+                  MSG_NOTE,
+                  "%zu rewrite%s saved %zu bytes and %zu cycles",
+                  a09->peep->rewrites,
+                  a09->peep->rewrites == 1 ? "" : "s",
+                  a09->peep->bytes,
+                  a09->peep->cycles
+                );
+    a09->lnum = lnum;
+  }
+  return rc;
+}
+
+/**************************************************************************/
+
+bool peep_fini(struct a09 *a09)
+{
+  assert(a09 != NULL);
+  
+  if (a09->peep != NULL)
+  {
+    free(a09->peep->jumps);
+    free(a09->peep->recs);
+    free(a09->peep);
+    a09->peep = NULL;
+  }
+  return true;
+}
+
+/**************************************************************************/
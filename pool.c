@@ -0,0 +1,454 @@
+/****************************************************************************
+*
+*   Pools of constant data, stored once no matter how often they're given
+*   Copyright (C) 2023 Sean Conner
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*   Comments, questions and criticisms can be sent to: sean@conman.org
+*
+****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "a09.h"
+
+/*--------------------------------------------------------------------------
+; Each .INPOOL adds an entry to a pool, and the .POOL for it lays down the
+; data on pass 1, with each entry sharing any copy of its bytes already in
+; the pool.  Until then, an entry's label isn't known, so it's marked as
+; being defined at the .POOL, making any use before then a forward
+; reference (and 16 bits) on both passes.
+;--------------------------------------------------------------------------*/
+
+struct poolentry
+{
+  struct symbol  *sym;
+  unsigned char  *bytes;
+  size_t          size;
+  size_t          order;
+};
+
+struct pool
+{
+  label              name;
+  struct poolentry  *entries;
+  size_t             nentries;
+  unsigned char     *blob;
+  size_t             size;
+  size_t             given;    /* bytes before sharing */
+  char const        *file;     /* of the first .INPOOL */
+  size_t             line;
+  bool               placed;
+};
+
+struct pooldata
+{
+  struct pool       *pools;
+  size_t             npools;
+};
+
+/**************************************************************************/
+
+static int entrycmp(void const *restrict needle,void const *restrict haystack)
+{
+  struct poolentry const *l = needle;
+  struct poolentry const *r = haystack;
+  
+  if (l->size > r->size)
+    return -1;
+  else if (l->size < r->size)
+    return 1;
+  else if (l->order < r->order)
+    return -1;
+  else if (l->order > r->order)
+    return 1;
+  else
+    return 0;
+}
+
+/**************************************************************************/
+
+static struct pool *pool_find(struct a09 *a09,struct pooldata *data,label const *name,bool create)
+{
+  assert(a09  != NULL);
+  assert(data != NULL);
+  assert(name != NULL);
+  
+  struct pool *pool;
+  
+  for (size_t i = 0 ; i < data->npools ; i++)
+    if ((data->pools[i].name.len == name->len) && (memcmp(data->pools[i].name.text,name->text,name->len) == 0))
+      return &data->pools[i];
+      
+  if (!create)
+    return NULL;
+    
+  pool = realloc(data->pools,(data->npools + 1) * sizeof(struct pool));
+  if (pool == NULL)
+  {
+    message(a09,MSG_ERROR,"E0046: out of memory");
+    return NULL;
+  }
+  
+  data->pools    = pool;
+  pool           = &data->pools[data->npools++];
+  pool->name     = *name;
+  pool->entries  = NULL;
+  pool->nentries = 0;
+  pool->blob     = NULL;
+  pool->size     = 0;
+  pool->given    = 0;
+  pool->file     = a09->infile;
+  pool->line     = a09->lnum;
+  pool->placed   = false;
+  return pool;
+}
+
+/**************************************************************************/
+
+static bool pool_name(struct opcdata *opd,label *name)
+{
+  assert(opd  != NULL);
+  assert(name != NULL);
+  
+  char c = skip_space(opd->buffer);
+  
+  if (!isID(c))
+    return message(opd->a09,MSG_ERROR,"E0050: not a label");
+  read_label(opd->buffer,name,c);
+  return true;
+}
+
+/**************************************************************************/
+
+static bool pool_append(struct a09 *a09,struct poolentry *entry,void const *bytes,size_t size)
+{
+  assert(a09   != NULL);
+  assert(entry != NULL);
+  assert(bytes != NULL);
+  
+  unsigned char *new = realloc(entry->bytes,entry->size + size);
+  
+  if (new == NULL)
+    return message(a09,MSG_ERROR,"E0046: out of memory");
+  memcpy(&new[entry->size],bytes,size);
+  entry->bytes  = new;
+  entry->size  += size;
+  return true;
+}
+
+/**************************************************************************/
+
+static bool pool_items(struct opcdata *opd,struct poolentry *entry)
+{
+  assert(opd   != NULL);
+  assert(entry != NULL);
+  
+  /*-----------------------------------------------------------------------
+  ; The data is a list of strings (with the same escapes as ASCII) and byte
+  ; values, so it can stand in for FCB, FCC, FCN and ASCII.  It all has to
+  ; be known on pass 1 for the pool to be laid down.
+  ;------------------------------------------------------------------------*/
+  
+  while(true)
+  {
+    char c = skip_space(opd->buffer);
+    
+    opd->buffer->ridx--;
+    
+    if (c == '"')
+    {
+      struct buffer textstring;
+      
+      if (!parse_string(opd->a09,&textstring,opd->buffer))
+        return false;
+      if (!pool_append(opd->a09,entry,textstring.buf,textstring.widx))
+        return false;
+    }
+    else
+    {
+      struct value  value;
+      unsigned char byte;
+      
+      if (!expr(&value,opd->a09,opd->buffer,opd->pass))
+        return false;
+      if (!value.defined || value.unknownpass1)
+        return message(opd->a09,MSG_ERROR,"E0108: value needed on pass 1 not defined on pass 1");
+      byte = value.value & 255;
+      if (!pool_append(opd->a09,entry,&byte,1))
+        return false;
+    }
+    
+    c = skip_space(opd->buffer);
+    if (isEOL(c))
+      return true;
+    if (c != ',')
+      return message(opd->a09,MSG_ERROR,"E0034: missing comma");
+  }
+}
+
+/**************************************************************************/
+
+static bool pool_build(struct a09 *a09,struct pool *pool)
+{
+  assert(a09  != NULL);
+  assert(pool != NULL);
+  
+  size_t max = 0;
+  
+  for (size_t i = 0 ; i < pool->nentries ; i++)
+    max += pool->entries[i].size;
+    
+  pool->given = max;
+  pool->blob  = malloc(max + 1);
+  if (pool->blob == NULL)
+    return message(a09,MSG_ERROR,"E0046: out of memory");
+    
+  /*-----------------------------------------------------------------------
+  ; Longest first, so the shorter ones have the best chance of being found
+  ; inside (or at the end of) one already down.  Failing that, an entry
+  ; that starts with what the pool ends with overlaps it.
+  ;------------------------------------------------------------------------*/
+  
+  qsort(pool->entries,pool->nentries,sizeof(struct poolentry),entrycmp);
+  
+  for (size_t i = 0 ; i < pool->nentries ; i++)
+  {
+    struct poolentry *entry  = &pool->entries[i];
+    size_t            offset = pool->size;
+    size_t            keep   = 0;
+    
+    for (size_t at = 0 ; at + entry->size <= pool->size ; at++)
+    {
+      if (memcmp(&pool->blob[at],entry->bytes,entry->size) == 0)
+      {
+        offset = at;
+        keep   = entry->size;
+        break;
+      }
+    }
+    
+    if (keep == 0)
+    {
+      for (size_t n = min(entry->size - 1,pool->size) ; n > 0 ; n--)
+      {
+        if (memcmp(&pool->blob[pool->size - n],entry->bytes,n) == 0)
+        {
+          offset = pool->size - n;
+          keep   = n;
+          break;
+        }
+      }
+      
+      memcpy(&pool->blob[pool->size],&entry->bytes[keep],entry->size - keep);
+      pool->size += entry->size - keep;
+    }
+    
+    entry->sym->value    = a09->pc + a09->phase + offset;
+    entry->sym->filename = a09->infile;
+    entry->sym->ldef     = a09->lnum;
+    entry->sym->bits     = a09->dp == entry->sym->value >> 8 ? 8 : 16;
+  }
+  
+  return true;
+}
+
+/**************************************************************************/
+
+bool pool_init(struct a09 *a09)
+{
+  assert(a09 != NULL);
+  
+  a09->pools = calloc(1,sizeof(struct pooldata));
+  if (a09->pools == NULL)
+    return message(a09,MSG_ERROR,"E0046: out of memory");
+  return true;
+}
+
+/**************************************************************************/
+
+bool pool_add(struct opcdata *opd)
+{
+  assert(opd             != NULL);
+  assert(opd->a09        != NULL);
+  assert(opd->a09->pools != NULL);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  struct poolentry *entry;
+  struct pool      *pool;
+  struct symbol    *sym;
+  label             name;
+  
+  if (opd->label.len == 0)
+    return message(opd->a09,MSG_ERROR,"E0126: missing label for .INPOOL");
+    
+  if (opd->pass == 2)
+    return true;
+    
+  if (!pool_name(opd,&name))
+    return false;
+  if (skip_space(opd->buffer) != ',')
+    return message(opd->a09,MSG_ERROR,"E0034: missing comma");
+    
+  pool = pool_find(opd->a09,opd->a09->pools,&name,true);
+  if (pool == NULL)
+    return false;
+  if (pool->placed)
+    return message(opd->a09,MSG_ERROR,"E0127: pool '%.*s' already placed",name.len,name.text);
+    
+  sym = symbol_find(opd->a09,&opd->label);
+  assert(sym != NULL);
+  
+  entry = realloc(pool->entries,(pool->nentries + 1) * sizeof(struct poolentry));
+  if (entry == NULL)
+    return message(opd->a09,MSG_ERROR,"E0046: out of memory");
+    
+  pool->entries = entry;
+  entry         = &pool->entries[pool->nentries];
+  entry->sym    = sym;
+  entry->bytes  = NULL;
+  entry->size   = 0;
+  entry->order  = pool->nentries;
+  
+  if (!pool_items(opd,entry))
+  {
+    free(entry->bytes);
+    return false;
+  }
+  
+  if (entry->size == 0)
+  {
+    free(entry->bytes);
+    return message(opd->a09,MSG_ERROR,"E0135: empty entry for .INPOOL");
+  }
+  
+  pool->nentries++;
+  sym->type = SYM_EQU;
+  sym->ldef = (size_t)-1;
+  return true;
+}
+
+/**************************************************************************/
+
+bool pool_place(struct opcdata *opd)
+{
+  assert(opd             != NULL);
+  assert(opd->a09        != NULL);
+  assert(opd->a09->pools != NULL);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  struct pool *pool;
+  label        name;
+  
+  if (!pool_name(opd,&name))
+    return false;
+    
+  pool = pool_find(opd->a09,opd->a09->pools,&name,opd->pass == 1);
+  if (pool == NULL)
+    return false;
+    
+  if (opd->pass == 1)
+  {
+    if (pool->placed)
+      return message(opd->a09,MSG_ERROR,"E0127: pool '%.*s' already placed",name.len,name.text);
+    pool->placed = true;
+    if (!pool_build(opd->a09,pool))
+      return false;
+  }
+  
+  opd->data     = true;
+  opd->datasz   = pool->size;
+  opd->truncate = opd->datasz > sizeof(opd->bytes);
+  
+  if (opd->pass == 2)
+  {
+    opd->sz = min(pool->size,sizeof(opd->bytes));
+    memcpy(opd->bytes,pool->blob,opd->sz);
+    if (opd->a09->obj && (pool->size > 0))
+    {
+      if (!opd->a09->format.write(&opd->a09->format,opd,pool->blob,pool->size,DATA))
+        return false;
+    }
+    
+    message(
+             opd->a09,
+             MSG_NOTE,
+             "pool '%.*s' holds %zu entr%s in %zu bytes, saved %zu bytes",
+             name.len,name.text,
+             pool->nentries,
+             pool->nentries == 1 ? "y" : "ies",
+             pool->size,
+             pool->given - pool->size
+           );
+  }
+  
+  return true;
+}
+
+/**************************************************************************/
+
+bool pool_check(struct a09 *a09)
+{
+  assert(a09        != NULL);
+  assert(a09->pools != NULL);
+  
+  struct pooldata *data   = a09->pools;
+  char const      *infile = a09->infile;
+  size_t           lnum   = a09->lnum;
+  bool             rc     = true;
+  
+  for (size_t i = 0 ; i < data->npools ; i++)
+  {
+    struct pool *pool = &data->pools[i];
+    
+    if (!pool->placed)
+    {
+      a09->infile = pool->file;
+      a09->lnum   = pool->line;
+      rc          = message(a09,MSG_ERROR,"E0128: pool '%.*s' never placed",pool->name.len,pool->name.text);
+    }
+  }
+  
+  a09->infile = infile;
+  a09->lnum   = lnum;
+  return rc;
+}
+
+/**************************************************************************/
+
+bool pool_fini(struct a09 *a09)
+{
+  assert(a09 != NULL);
+  
+  struct pooldata *data = a09->pools;
+  
+  if (data != NULL)
+  {
+    for (size_t i = 0 ; i < data->npools ; i++)
+    {
+      for (size_t j = 0 ; j < data->pools[i].nentries ; j++)
+        free(data->pools[i].entries[j].bytes);
+      free(data->pools[i].entries);
+      free(data->pools[i].blob);
+    }
+    free(data->pools);
+    free(data);
+    a09->pools = NULL;
+  }
+  return true;
+}
+
+/**************************************************************************/
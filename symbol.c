@@ -125,3 +125,104 @@ void symbol_freetable(tree__s *tree)
 }
 
 /**************************************************************************/
+
+static size_t symbol_count(tree__s *tree)
+{
+  if (tree == NULL)
+    return 0;
+  else
+    return symbol_count(tree->left) + 1 + symbol_count(tree->right);
+}
+
+/**************************************************************************/
+
+static void symbol_collect(struct symbol **list,size_t *pnum,tree__s *tree)
+{
+  assert(list != NULL);
+  assert(pnum != NULL);
+  
+  if (tree != NULL)
+  {
+    symbol_collect(list,pnum,tree->left);
+    struct symbol *sym = tree2sym(tree);
+    if ((sym->type == SYM_ADDRESS) || (sym->type == SYM_PUBLIC))
+      list[(*pnum)++] = sym;
+    symbol_collect(list,pnum,tree->right);
+  }
+}
+
+/**************************************************************************/
+
+static int symaddrcmp(void const *restrict needle,void const *restrict haystack)
+{
+  struct symbol const *const *key   = needle;
+  struct symbol const *const *value = haystack;
+  
+  if ((*key)->value < (*value)->value)
+    return -1;
+  else if ((*key)->value > (*value)->value)
+    return  1;
+  else if ((*key)->name.len < (*value)->name.len)
+    return -1;
+  else if ((*key)->name.len > (*value)->name.len)
+    return  1;
+  else
+    return memcmp((*key)->name.text,(*value)->name.text,(*key)->name.len);
+}
+
+/**************************************************************************/
+
+struct symbol **symbol_addrtable(struct a09 *a09,size_t *pnum)
+{
+  assert(a09  != NULL);
+  assert(pnum != NULL);
+  
+  struct symbol **list = malloc((symbol_count(a09->symtab) + 1) * sizeof(struct symbol *));
+  
+  *pnum = 0;
+  if (list == NULL)
+  {
+    message(a09,MSG_ERROR,"E0046: out of memory");
+    return NULL;
+  }
+  
+  symbol_collect(list,pnum,a09->symtab);
+  qsort(list,*pnum,sizeof(struct symbol *),symaddrcmp);
+  return list;
+}
+
+/**************************************************************************/
+
+struct symbol *symbol_nearest(struct symbol **list,size_t num,uint16_t addr)
+{
+  assert((list != NULL) || (num == 0));
+  
+  size_t low  = 0;
+  size_t high = num;
+  
+  /*-----------------------------------------------------------------------
+  ; Find the first symbol past the address; the one before it is the
+  ; nearest one.  Since the list is sorted by length when the values are
+  ; the same, back up to the shortest (usually non-local) name.
+  ;------------------------------------------------------------------------*/
+  
+  while(low < high)
+  {
+    size_t mid = low + (high - low) / 2;
+    if (list[mid]->value <= addr)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  
+  if (low == 0)
+    return NULL;
+    
+  low--;
+  while((low > 0) && (list[low - 1]->value == list[low]->value))
+    low--;
+    
+  return list[low];
+}
+
+/**************************************************************************/
@@ -26,6 +26,9 @@
 #include <errno.h>
 #include <time.h>
 
+#include <pthread.h>
+#include <fnmatch.h>
+
 #include <mc6809.h>
 #include <mc6809dis.h>
 
@@ -42,7 +45,11 @@
 
 /**************************************************************************/
 
-#define MAX_PROG 64
+#define MAX_PROG  64
+#define MAX_FRAME 64
+#define MAX_SUBS  64
+#define HOT_RANGE 16
+#define HOT_RATE  16
 
 enum vmops
 {
@@ -102,6 +109,18 @@ enum vmops
   VM_TO8,
   VM_TO16,
   VM_PROT,
+  VM_CYCLES,
+  VM_ICOUNT,
+  VM_IRQLAT,
+  VM_IRQCYC,
+  VM_FIRQLAT,
+  VM_FIRQCYC,
+  VM_NMILAT,
+  VM_NMICYC,
+  VM_PIAWR,
+  VM_SERIALTX,
+  VM_SUSED,
+  VM_UUSED,
   VM_EXIT,
 };
 
@@ -136,25 +155,235 @@ enum
   TEST_WEEDS,
   TEST_NON_WRITE_MEM,
   TEST_NON_EXEC_MEM,
+  TEST_LIMIT,
+  TEST_SETUP,
   TEST_max,
 };
 
+enum
+{
+  INT_IRQ,
+  INT_FIRQ,
+  INT_NMI,
+  INT_max,
+};
+
 struct memprot
 {
-  bool read  : 1;
-  bool write : 1;
-  bool exec  : 1;
-  bool tron  : 1;
-  bool check : 1;
+  bool read   : 1;
+  bool write  : 1;
+  bool exec   : 1;
+  bool tron   : 1;
+  bool check  : 1;
+  bool device : 1;
+};
+
+enum devkind
+{
+  DEV_TIMER,
+  DEV_PIA,
+  DEV_SERIAL,
+};
+
+struct device
+{
+  enum devkind  kind;
+  uint16_t      addr;
+  uint16_t      size;
+  unsigned long param;
+  unsigned long base;
+  unsigned long busy;
+  unsigned long writes;
+  unsigned long first;
+  unsigned long last;
+  unsigned long overruns;
+  uint8_t       latch;
+  uint8_t       ddr[2];
+  uint8_t       ctl[2];
+  uint8_t       port[2];
+};
+
+struct heatmap
+{
+  uint32_t fetch[65536u];
+  uint32_t read [65536u];
+  uint32_t write[65536u];
+};
+
+struct coverage
+{
+  char const *file[65536u];
+  uint32_t    line[65536u];
+  uint32_t    exec    [65536u];
+  uint32_t    taken   [65536u];
+  uint32_t    nottaken[65536u];
+};
+
+struct covline
+{
+  char const *file;
+  uint32_t    line;
+  uint16_t    addr;
+};
+
+struct srcline
+{
+  char const *file;
+  size_t      line;
+  uint32_t    hash;
+};
+
+struct impact
+{
+  struct srcline *lines;
+  size_t          nlines;
+  struct srcline *sorted;
+  uint32_t        opthash;
+  uint32_t        lineidx[65536u];
+  uint8_t         touched[65536u / CHAR_BIT];
+};
+
+struct cached
+{
+  char           *filename;
+  char           *name;
+  uint32_t        hash;
+  struct srcline *lines;
+  size_t          nlines;
+};
+
+struct wfault
+{
+  char const      *tag;
+  size_t           lnum;
+  int              rc;
+  char             errbuf[128];
+};
+
+struct worker
+{
+  pthread_t        thread;
+  struct a09       a09;
+  struct testdata *data;
+  struct unittest *units;
+  size_t          *order;
+  bool            *passed;
+  struct wfault   *faults;
+  size_t           ntests;
+  unsigned int     seed;
+  bool             started;
+};
+
+struct intsched
+{
+  unsigned long at;
+  unsigned long every;
+  bool          on;
+};
+
+struct intstate
+{
+  unsigned long next;
+  unsigned long every;
+  unsigned long asserted;
+  unsigned long entered;
+  unsigned long latency;
+  unsigned long cost;
+  size_t        taken;
+  uint16_t      rets;
+  bool          pending;
+  bool          inhandler;
+};
+
+struct sframe
+{
+  uint16_t      entry;  /* address called */
+  uint16_t      base;   /* S before the call */
+  uint16_t      min;
+};
+
+struct subuse
+{
+  uint16_t      entry;
+  uint16_t      used;   /* most bytes below S before the call */
 };
 
 struct unittest
 {
-  uint16_t       addr;
-  char const    *filename;
+  uint16_t        addr;
+  char const     *filename;
+  size_t          line;
+  struct buffer   name;
+  unsigned long   cycles;
+  unsigned long   icount;
+  unsigned long   maxinst;
+  unsigned long   maxcycles;
+  size_t          fixture;
+  struct intsched ints[INT_max];
+  uint32_t        hash;
+  size_t         *lines;
+  size_t          nlines;
+  struct cached  *cache;
+  bool            setup;
+  bool            tron;
+  bool            passed;
+  bool            selected;
+};
+
+struct snapshot
+{
+  mc6809__t     cpu;
+  char const   *name;
+  uint32_t      hash;
+  uint8_t       touched[65536u / CHAR_BIT];
+  bool          okay;
+  mc6809byte__t memory[65536u];
+};
+
+struct baseline
+{
+  char          *filename;
+  char          *name;
   size_t         line;
-  struct buffer  name;
-  bool           tron;
+  unsigned long  cycles;
+  unsigned long  icount;
+};
+
+struct tracerec
+{
+  unsigned long cycles;
+  uint16_t      pc;
+  uint16_t      X;
+  uint16_t      Y;
+  uint16_t      U;
+  uint16_t      S;
+  uint16_t      d;
+  uint8_t       dp;
+  uint8_t       cc;
+  uint8_t       bytes[5];
+  bool          traced;
+};
+
+enum
+{
+  STUB_A,
+  STUB_B,
+  STUB_D,
+  STUB_X,
+  STUB_Y,
+  STUB_U,
+  STUB_DP,
+  STUB_CC,
+  STUB_max,
+};
+
+struct stub
+{
+  uint16_t      addr;
+  unsigned long cycles;
+  unsigned int  set;
+  uint16_t      value[STUB_max];
+  char          output;
 };
 
 struct vmcode
@@ -182,14 +411,48 @@ struct testdata
   tree__s         *Asserts;
   struct unittest *units;
   size_t           nunits;
+  struct snapshot *snapshots;
+  size_t           nfixtures;
+  size_t           fixture;
   size_t           failed;
   unsigned long    icount;
+  unsigned long    basecycles;
+  unsigned long    baseicount;
   mc6809__t        cpu;
   mc6809dis__t     dis;
+  struct tracerec *trace;
+  size_t           tracesize;
+  size_t           tracenext;
+  unsigned long    tracecnt;
+  struct symbol  **symbols;
+  size_t           nsymbols;
+  struct stub     *stubs;
+  size_t           nstubs;
+  struct device   *devices;
+  size_t           ndevices;
+  struct heatmap  *heat;
+  struct coverage *cover;
+  struct impact   *impact;
+  size_t           outlen;
+  char             output[256];
+  unsigned long    maxinst;
+  unsigned long    maxcycles;
+  struct intsched  intsched[INT_max];
+  struct intstate  ints[INT_max];
+  uint32_t         hot[65536u / HOT_RANGE];
   int              passinit;
   uint16_t         addr;
   uint16_t         sp;
   uint16_t         stacksize;
+  uint16_t         smin;
+  uint16_t         sminpc;
+  uint16_t         ubase;
+  uint16_t         umin;
+  bool             upushed;
+  struct sframe    frames[MAX_FRAME];
+  size_t           nframes;
+  struct subuse    subs[MAX_SUBS];
+  size_t           nsubs;
   uint16_t         inittestpc;
   uint16_t         testpc;
   uint16_t         resumepc;
@@ -246,6 +509,56 @@ static struct vmcode *new_program(struct Assert *Assert)
 
 /**************************************************************************/
 
+static int stubcmp(void const *restrict needle,void const *restrict haystack)
+{
+  uint16_t    const *key   = needle;
+  struct stub const *value = haystack;
+  
+  if (*key < value->addr)
+    return -1;
+  else if (*key > value->addr)
+    return  1;
+  else
+    return  0;
+}
+
+/**************************************************************************/
+
+static uint32_t ft_hash(uint32_t hash,void const *src,size_t len)
+{
+  assert((src != NULL) || (len == 0));
+  
+  unsigned char const *p = src;
+  
+  /*-----------------------------------------------------------------------
+  ; FNV-1a.  It only has to notice that something changed.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t i = 0 ; i < len ; i++)
+  {
+    hash ^= p[i];
+    hash *= 16777619uL;
+  }
+  
+  return hash;
+}
+
+/**************************************************************************/
+
+static void ft_impact_hash(struct testdata *data,struct a09 *a09)
+{
+  assert(data != NULL);
+  assert(a09  != NULL);
+  
+  if (data->impact != NULL)
+  {
+    uint32_t *hash = data->intest ? &data->units[data->nunits - 1].hash : &data->impact->opthash;
+    *hash = ft_hash(*hash,a09->inbuf.buf,strlen(a09->inbuf.buf));
+  }
+}
+
+/**************************************************************************/
+
 static int Assertaddrcmp(void const *restrict needle,void const *restrict haystack)
 {
   uint16_t      const *key   = needle;
@@ -325,6 +638,8 @@ static bool runvm(struct a09 *a09,mc6809__t *cpu,struct vmcode *test)
   size_t           ip = 0;
   int              rc;
   
+  data->errbuf[0] = '\0';
+  
   /*--------------------------------------------------------------
   ; I control the code generation, so I can skip checks that would
   ; otherwise have to be made.
@@ -581,8 +896,10 @@ static bool runvm(struct a09 *a09,mc6809__t *cpu,struct vmcode *test)
            break;
            
       case VM_TIMEON:
-           cpu->cycles  = 0;
-           data->icount = 0;
+           data->basecycles += cpu->cycles;
+           data->baseicount += data->icount;
+           cpu->cycles       = 0;
+           data->icount      = 0;
            break;
            
       case VM_TIMEOFF:
@@ -619,8 +936,80 @@ static bool runvm(struct a09 *a09,mc6809__t *cpu,struct vmcode *test)
            value = stack[sp++];
            memcpy(&prot,&stack[sp++],sizeof(prot));
            
+           /*------------------------------------------------------------
+           ; A device stays attached to its addresses; only the access
+           ; bits change.
+           ;-------------------------------------------------------------*/
+           
            for (size_t a = addr ; a <= value ; a++)
-             data->prot[a] = prot;
+           {
+             bool device = data->prot[a].device;
+             
+             data->prot[a]        = prot;
+             data->prot[a].device = device;
+           }
+           break;
+           
+      /*---------------------------------------------------------------
+      ; The cycle and instruction counts are saturated to 16 bits, but
+      ; the actual value is recorded to report if the assertion fails.
+      ;----------------------------------------------------------------*/
+      
+      case VM_CYCLES:
+           stack[--sp] = cpu->cycles > UINT16_MAX ? UINT16_MAX : cpu->cycles;
+           snprintf(data->errbuf,sizeof(data->errbuf),"cycles=%lu",cpu->cycles);
+           break;
+           
+      case VM_ICOUNT:
+           stack[--sp] = data->icount > UINT16_MAX ? UINT16_MAX : data->icount;
+           snprintf(data->errbuf,sizeof(data->errbuf),"instructions=%lu",data->icount);
+           break;
+           
+      /*---------------------------------------------------------------
+      ; The worst interrupt latency and handler cost seen so far in the
+      ; test, in the order IRQ, FIRQ, NMI.
+      ;----------------------------------------------------------------*/
+      
+      case VM_IRQLAT:
+      case VM_IRQCYC:
+      case VM_FIRQLAT:
+      case VM_FIRQCYC:
+      case VM_NMILAT:
+      case VM_NMICYC:
+           {
+             static char const *const names[INT_max] = { "irq" , "firq" , "nmi" };
+             size_t                   idx            = (test->prog[ip - 1] - VM_IRQLAT) / 2;
+             bool                     lat            = (test->prog[ip - 1] - VM_IRQLAT) % 2 == 0;
+             unsigned long            v              = lat ? data->ints[idx].latency : data->ints[idx].cost;
+             
+             stack[--sp] = v > UINT16_MAX ? UINT16_MAX : v;
+             snprintf(data->errbuf,sizeof(data->errbuf),"%s %s=%lu",names[idx],lat ? "latency" : "cycles",v);
+           }
+           break;
+           
+      case VM_SUSED:
+           stack[--sp] = data->sp - data->smin;
+           snprintf(data->errbuf,sizeof(data->errbuf),"S used=%u",(unsigned)stack[sp]);
+           break;
+           
+      case VM_UUSED:
+           stack[--sp] = data->upushed ? data->ubase - data->umin : 0;
+           snprintf(data->errbuf,sizeof(data->errbuf),"U used=%u",(unsigned)stack[sp]);
+           break;
+           
+      case VM_PIAWR:
+      case VM_SERIALTX:
+           {
+             enum devkind  kind = test->prog[ip - 1] == VM_PIAWR ? DEV_PIA : DEV_SERIAL;
+             unsigned long v    = 0;
+             
+             for (size_t i = 0 ; i < data->ndevices ; i++)
+               if (data->devices[i].kind == kind)
+                 v += data->devices[i].writes;
+                 
+             stack[--sp] = v > UINT16_MAX ? UINT16_MAX : v;
+             snprintf(data->errbuf,sizeof(data->errbuf),"%s=%lu",kind == DEV_PIA ? "writes" : "bytes",v);
+           }
            break;
            
       case VM_EXIT:
@@ -632,6 +1021,140 @@ static bool runvm(struct a09 *a09,mc6809__t *cpu,struct vmcode *test)
 
 /**************************************************************************/
 
+static struct device *ft_device(struct testdata *data,uint16_t addr)
+{
+  assert(data != NULL);
+  
+  for (size_t i = 0 ; i < data->ndevices ; i++)
+    if ((addr >= data->devices[i].addr) && (addr - data->devices[i].addr < data->devices[i].size))
+      return &data->devices[i];
+      
+  return NULL;
+}
+
+/**************************************************************************/
+
+static mc6809byte__t ft_dev_read(struct testdata *data,uint16_t addr)
+{
+  assert(data != NULL);
+  
+  struct device *dev = ft_device(data,addr);
+  unsigned long  now = data->basecycles + data->cpu.cycles;
+  unsigned int   reg;
+  
+  if (dev == NULL) /* shouldn't happen, but act like memory if it does */
+    return data->memory[addr];
+    
+  reg = addr - dev->addr;
+  
+  switch(dev->kind)
+  {
+    /*---------------------------------------------------------------------
+    ; A 16-bit counter, one tick every <param> cycles.  Reading the MSB
+    ; latches the LSB so the two halves are consistent.
+    ;----------------------------------------------------------------------*/
+    
+    case DEV_TIMER:
+         {
+           unsigned long count = (now - dev->base) / dev->param;
+           
+           if (reg == 0)
+           {
+             dev->latch = count & 0xFF;
+             return (count >> 8) & 0xFF;
+           }
+           else
+             return dev->latch;
+         }
+         
+    /*---------------------------------------------------------------------
+    ; MC6821 layout:  data/direction A, control A, data/direction B,
+    ; control B.  Bit 2 of a control register selects the data register.
+    ; Input pins read as 1.
+    ;----------------------------------------------------------------------*/
+    
+    case DEV_PIA:
+         if (reg & 1)
+           return dev->ctl[reg / 2] & 0x3F;
+         else if (dev->ctl[reg / 2] & 0x04)
+           return (dev->port[reg / 2] & dev->ddr[reg / 2]) | ~dev->ddr[reg / 2];
+         else
+           return dev->ddr[reg / 2];
+           
+    /*---------------------------------------------------------------------
+    ; MC6850 layout:  status, data.  The transmitter is busy for <param>
+    ; cycles after each byte; nothing is ever received.
+    ;----------------------------------------------------------------------*/
+    
+    case DEV_SERIAL:
+         if (reg == 0)
+           return now >= dev->busy ? 0x02 : 0x00;
+         else
+           return 0x00;
+  }
+  
+  return 0xFF;
+}
+
+/**************************************************************************/
+
+static void ft_dev_write(struct testdata *data,uint16_t addr,uint8_t byte)
+{
+  assert(data != NULL);
+  
+  struct device *dev = ft_device(data,addr);
+  unsigned long  now = data->basecycles + data->cpu.cycles;
+  unsigned int   reg;
+  
+  if (dev == NULL) /* shouldn't happen, but act like memory if it does */
+  {
+    data->memory[addr] = byte;
+    return;
+  }
+  
+  reg = addr - dev->addr;
+  
+  switch(dev->kind)
+  {
+    case DEV_TIMER:
+         dev->base = now;
+         return;
+         
+    case DEV_PIA:
+         if (reg & 1)
+         {
+           dev->ctl[reg / 2] = byte & 0x3F;
+           return;
+         }
+         else if ((dev->ctl[reg / 2] & 0x04) == 0)
+         {
+           dev->ddr[reg / 2] = byte;
+           return;
+         }
+         dev->port[reg / 2] = byte;
+         break;
+         
+    case DEV_SERIAL:
+         if (reg == 0)
+           return;
+         if (now < dev->busy)
+         {
+           dev->overruns++;
+           return;
+         }
+         if (data->outlen < sizeof(data->output))
+           data->output[data->outlen++] = byte;
+         dev->busy = now + dev->param;
+         break;
+  }
+  
+  if (dev->writes++ == 0)
+    dev->first = now;
+  dev->last = now;
+}
+
+/**************************************************************************/
+
 static mc6809byte__t ft_cpu_read(mc6809__t *cpu,mc6809addr__t addr,bool inst)
 {
   assert(cpu       != NULL);
@@ -652,6 +1175,20 @@ static mc6809byte__t ft_cpu_read(mc6809__t *cpu,mc6809addr__t addr,bool inst)
     longjmp(cpu->err,TEST_NON_EXEC_MEM);
   }
   
+  if (data->impact != NULL)
+    data->impact->touched[addr / CHAR_BIT] |= 1u << (addr % CHAR_BIT);
+    
+  if (data->heat != NULL)
+  {
+    if (inst)
+      data->heat->fetch[addr]++;
+    else
+      data->heat->read[addr]++;
+  }
+  
+  if (data->prot[addr].device)
+    return ft_dev_read(data,addr);
+    
   return data->memory[addr];
 }
 
@@ -673,7 +1210,12 @@ static void ft_cpu_write(mc6809__t *cpu,mc6809addr__t addr,mc6809byte__t byte)
     message(data->a09,MSG_WARNING,"W0014: possible self-modifying code @ %04X",cpu->instpc);
   if (data->prot[addr].tron)
     message(data->a09,MSG_WARNING,"W0016: memory write of %02X to %04X @ %04X",byte,addr,cpu->instpc);
-  data->memory[addr] = byte;
+  if (data->heat != NULL)
+    data->heat->write[addr]++;
+  if (data->prot[addr].device)
+    ft_dev_write(data,addr,byte);
+  else
+    data->memory[addr] = byte;
 }
 
 /**************************************************************************/
@@ -731,24 +1273,36 @@ static int regsearch(void const *needle,void const *haystack)
 
 static struct labeltable const mregisters[] =
 {
-  { .label = { .text = "A"    , .len = 1 } , .op = VM_CPUA   } ,
-  { .label = { .text = "B"    , .len = 1 } , .op = VM_CPUB   } ,
-  { .label = { .text = "CC"   , .len = 2 } , .op = VM_CPUCC  } ,
-  { .label = { .text = "CC.C" , .len = 4 } , .op = VM_CPUCCc } ,
-  { .label = { .text = "CC.E" , .len = 4 } , .op = VM_CPUCCe } ,
-  { .label = { .text = "CC.F" , .len = 4 } , .op = VM_CPUCCf } ,
-  { .label = { .text = "CC.H" , .len = 4 } , .op = VM_CPUCCh } ,
-  { .label = { .text = "CC.I" , .len = 4 } , .op = VM_CPUCCi } ,
-  { .label = { .text = "CC.N" , .len = 4 } , .op = VM_CPUCCn } ,
-  { .label = { .text = "CC.V" , .len = 4 } , .op = VM_CPUCCv } ,
-  { .label = { .text = "CC.Z" , .len = 4 } , .op = VM_CPUCCz } ,
-  { .label = { .text = "D"    , .len = 1 } , .op = VM_CPUD   } ,
-  { .label = { .text = "DP"   , .len = 2 } , .op = VM_CPUDP  } ,
-  { .label = { .text = "PC"   , .len = 2 } , .op = VM_CPUPC  } ,
-  { .label = { .text = "S"    , .len = 1 } , .op = VM_CPUS   } ,
-  { .label = { .text = "U"    , .len = 1 } , .op = VM_CPUU   } ,
-  { .label = { .text = "X"    , .len = 1 } , .op = VM_CPUX   } ,
-  { .label = { .text = "Y"    , .len = 1 } , .op = VM_CPUY   } ,
+  { .label = { .text = "A"         , .len = 1 } , .op = VM_CPUA     } ,
+  { .label = { .text = "B"         , .len = 1 } , .op = VM_CPUB     } ,
+  { .label = { .text = "CC"        , .len = 2 } , .op = VM_CPUCC    } ,
+  { .label = { .text = "CC.C"      , .len = 4 } , .op = VM_CPUCCc   } ,
+  { .label = { .text = "CC.E"      , .len = 4 } , .op = VM_CPUCCe   } ,
+  { .label = { .text = "CC.F"      , .len = 4 } , .op = VM_CPUCCf   } ,
+  { .label = { .text = "CC.H"      , .len = 4 } , .op = VM_CPUCCh   } ,
+  { .label = { .text = "CC.I"      , .len = 4 } , .op = VM_CPUCCi   } ,
+  { .label = { .text = "CC.N"      , .len = 4 } , .op = VM_CPUCCn   } ,
+  { .label = { .text = "CC.V"      , .len = 4 } , .op = VM_CPUCCv   } ,
+  { .label = { .text = "CC.Z"      , .len = 4 } , .op = VM_CPUCCz   } ,
+  { .label = { .text = "CYCLES"    , .len = 6 } , .op = VM_CYCLES   } ,
+  { .label = { .text = "D"         , .len = 1 } , .op = VM_CPUD     } ,
+  { .label = { .text = "DP"        , .len = 2 } , .op = VM_CPUDP    } ,
+  { .label = { .text = "FIRQ.CYC"  , .len = 8 } , .op = VM_FIRQCYC  } ,
+  { .label = { .text = "FIRQ.LAT"  , .len = 8 } , .op = VM_FIRQLAT  } ,
+  { .label = { .text = "ICOUNT"    , .len = 6 } , .op = VM_ICOUNT   } ,
+  { .label = { .text = "IRQ.CYC"   , .len = 7 } , .op = VM_IRQCYC   } ,
+  { .label = { .text = "IRQ.LAT"   , .len = 7 } , .op = VM_IRQLAT   } ,
+  { .label = { .text = "NMI.CYC"   , .len = 7 } , .op = VM_NMICYC   } ,
+  { .label = { .text = "NMI.LAT"   , .len = 7 } , .op = VM_NMILAT   } ,
+  { .label = { .text = "PC"        , .len = 2 } , .op = VM_CPUPC    } ,
+  { .label = { .text = "PIA.WR"    , .len = 6 } , .op = VM_PIAWR    } ,
+  { .label = { .text = "S"         , .len = 1 } , .op = VM_CPUS     } ,
+  { .label = { .text = "S.USED"    , .len = 6 } , .op = VM_SUSED    } ,
+  { .label = { .text = "SERIAL.TX" , .len = 9 } , .op = VM_SERIALTX } ,
+  { .label = { .text = "U"         , .len = 1 } , .op = VM_CPUU     } ,
+  { .label = { .text = "U.USED"    , .len = 6 } , .op = VM_UUSED    } ,
+  { .label = { .text = "X"         , .len = 1 } , .op = VM_CPUX     } ,
+  { .label = { .text = "Y"         , .len = 1 } , .op = VM_CPUY     } ,
 };
 
 /**************************************************************************/
@@ -1321,6 +1875,47 @@ static bool ftest_write(
   
   struct testdata *data = opd->a09->tests;
   
+  /*-----------------------------------------------------------------------
+  ; For test impact analysis, each source line outside of a test gets a
+  ; hash of its text and the bytes it generated, and each address is
+  ; mapped to its line.  Bytes generated inside a test go into the hash of
+  ; the test.
+  ;------------------------------------------------------------------------*/
+  
+  if ((data->impact != NULL) && data->intest)
+  {
+    struct unittest *unit = &data->units[data->nunits - 1];
+    unit->hash = ft_hash(unit->hash,buffer,len);
+  }
+  else if (data->impact != NULL)
+  {
+    struct impact  *impact = data->impact;
+    struct srcline *last   = impact->nlines > 0 ? &impact->lines[impact->nlines - 1] : NULL;
+    
+    if ((last == NULL) || (last->file != opd->a09->infile) || (last->line != opd->a09->lnum))
+    {
+      struct srcline *new = realloc(impact->lines,(impact->nlines + 1) * sizeof(struct srcline));
+      if (new == NULL)
+        return message(opd->a09,MSG_ERROR,"E0046: out of memory");
+        
+      impact->lines = new;
+      last          = &impact->lines[impact->nlines++];
+      last->file    = opd->a09->infile;
+      last->line    = opd->a09->lnum;
+      last->hash    = ft_hash(2166136261uL,opd->a09->inbuf.buf,strlen(opd->a09->inbuf.buf));
+    }
+    
+    last->hash = ft_hash(last->hash,buffer,len);
+    for (size_t i = 0 ; i < len ; i++)
+      impact->lineidx[(uint16_t)(data->addr + i)] = impact->nlines;
+  }
+  
+  if ((data->cover != NULL) && instruction && !data->intest)
+  {
+    data->cover->file[data->addr] = opd->a09->infile;
+    data->cover->line[data->addr] = opd->a09->lnum;
+  }
+  
   memcpy(&data->memory[data->addr],buffer,len);
   for (size_t i = 0 ; i < len ; i++)
   {
@@ -1339,615 +1934,3212 @@ static bool ftest_write(
 
 /**************************************************************************/
 
-bool test__opt(struct opcdata *opd)
+static bool ft_ulong(struct a09 *a09,unsigned long *pv,struct buffer *buffer)
 {
-  assert(opd             != NULL);
-  assert(opd->a09        != NULL);
-  assert((opd->pass == 1) || (opd->pass == 2));
+  assert(a09    != NULL);
+  assert(pv     != NULL);
+  assert(buffer != NULL);
   
-  if (opd->a09->tests == NULL)
-    return true;
-    
-  assert(opd->a09->tests != NULL);
-  assert(opd->a09->runtests);
+  char *end;
+  int   base = 10;
+  char  c    = skip_space(buffer);
   
-  struct testdata *data = opd->a09->tests;
-  char             c    = skip_space(opd->buffer);
-  label            tmp;
+  /*-----------------------------------------------------------------------
+  ; Limits easily exceed 16 bits, so these are parsed as a plain number
+  ; rather than as an expression.
+  ;------------------------------------------------------------------------*/
   
-  read_label(opd->buffer,&tmp,c);
-  upper_label(&tmp);
+  if (c == '$')
+    base = 16;
+  else if (isdigit(c))
+    buffer->ridx--;
+  else
+    return message(a09,MSG_ERROR,"E0006: not a value");
+    
+  errno = 0;
+  *pv   = strtoul(&buffer->buf[buffer->ridx],&end,base);
+  if ((errno != 0) || (end == &buffer->buf[buffer->ridx]))
+    return message(a09,MSG_ERROR,"E0006: not a value");
+  buffer->ridx = (size_t)(end - buffer->buf);
+  return true;
+}
+
+/**************************************************************************/
+
+static bool ft_protbits(struct a09 *a09,struct memprot *prot,char const *text,size_t len)
+{
+  assert(a09  != NULL);
+  assert(prot != NULL);
+  assert(text != NULL);
   
-  if (opd->pass == 1)
+  for (size_t i = 0 ; i < len ; i++)
   {
-    if ((tmp.len == 3) && (memcmp(tmp.text,"ORG",3) == 0))
+    switch(toupper(text[i]))
     {
-      struct value addr;
-      
-      if (!expr(&addr,opd->a09,opd->buffer,opd->pass))
-        return false;
-        
-      if (data->intest)
-        return message(opd->a09,MSG_ERROR,"E0100: Can only assign test code outside a .TEST directive");
-        
-      data->inittestpc = addr.value;
-      data->testpc     = addr.value;
-      message(opd->a09,MSG_DEBUG,"testloadpc=%04X",data->testpc);
+      case 'R': prot->read  = true; break;
+      case 'W': prot->write = true; break;
+      case 'X': prot->exec  = true; break;
+      case 'T': prot->tron  = true; break;
+      case 'N':                     break;
+      default: return message(a09,MSG_ERROR,"E0084: undefined protection bit '%c'",text[i]);
     }
   }
   
-  else if (opd->pass == 2)
-  {
-    if ((tmp.len == 4) && (memcmp(tmp.text,"PROT",4) == 0))
-    {
-      struct memprot prot =
-      {
-        .read  = false ,
-        .write = false ,
-        .exec  = false ,
-        .tron  = false ,
-        .check = false ,
-      };
-      struct value low;
-      struct value high;
-      
-      c = skip_space(opd->buffer);
+  return true;
+}
+
+/**************************************************************************/
+
+static bool ft_poke_image(
+        struct a09          *a09,
+        struct testdata     *data,
+        unsigned long        addr,
+        unsigned char const *bytes,
+        size_t               len,
+        struct memprot       prot
+)
+{
+  assert(a09   != NULL);
+  assert(data  != NULL);
+  assert(bytes != NULL);
+  
+  if ((addr > 65536uL) || (len > 65536uL - addr))
+    return message(a09,MSG_ERROR,"E0112: length exceeds memory space");
+    
+  memcpy(&data->memory[addr],bytes,len);
+  for (size_t i = 0 ; i < len ; i++)
+    data->prot[addr + i] = prot;
+  return true;
+}
+
+/**************************************************************************/
+
+static int ft_hexbyte(char const *p)
+{
+  assert(p != NULL);
+  
+  if (!isxdigit(p[0]) || !isxdigit(p[1]))
+    return -1;
+  else
+  {
+    char hex[3] = { p[0] , p[1] , '\0' };
+    return (int)strtoul(hex,NULL,16);
+  }
+}
+
+/**************************************************************************/
+
+static bool ft_load_srec(
+        struct a09          *a09,
+        struct testdata     *data,
+        char const          *filename,
+        unsigned char const *image,
+        size_t               size,
+        uint16_t             offset,
+        struct memprot       prot
+)
+{
+  assert(a09      != NULL);
+  assert(data     != NULL);
+  assert(filename != NULL);
+  assert(image    != NULL);
+  
+  size_t pos = 0;
+  
+  while(pos < size)
+  {
+    unsigned char bytes[256];
+    char const   *line = (char const *)&image[pos];
+    size_t        eol  = pos;
+    size_t        alen;
+    int           count;
+    int           sum;
+    
+    while((eol < size) && (image[eol] != '\n'))
+      eol++;
+      
+    if ((eol - pos < 2) || (line[0] != 'S'))
+    {
+      size_t blank = pos;
+      
+      /*-------------------------------------------------------------------
+      ; The image isn't NUL terminated, so only look up to the end of line.
+      ;--------------------------------------------------------------------*/
+      
+      while((blank < eol) && (image[blank] == '\r'))
+        blank++;
+      if (blank < eol)
+        return message(a09,MSG_ERROR,"E0117: %s: malformed image",filename);
+      pos = eol + 1;
+      continue;
+    }
+    
+    switch(line[1])
+    {
+      case '1': alen = 2; break;
+      case '2': alen = 3; break;
+      case '3': alen = 4; break;
+      default:  pos  = eol + 1; continue; /* header, count and start records */
+    }
+    
+    count = eol - pos >= 4 ? ft_hexbyte(&line[2]) : -1;
+    if ((count < (int)alen + 1) || ((size_t)count * 2 + 4 > eol - pos))
+      return message(a09,MSG_ERROR,"E0117: %s: malformed image",filename);
+      
+    sum = count;
+    for (int i = 0 ; i < count ; i++)
+    {
+      int byte = ft_hexbyte(&line[4 + i * 2]);
+      if (byte < 0)
+        return message(a09,MSG_ERROR,"E0117: %s: malformed image",filename);
+      bytes[i]  = byte;
+      sum      += byte;
+    }
+    
+    if ((sum & 0xFF) != 0xFF)
+      return message(a09,MSG_ERROR,"E0117: %s: malformed image",filename);
+      
+    unsigned long addr = 0;
+    for (size_t i = 0 ; i < alen ; i++)
+      addr = (addr << 8) | bytes[i];
+      
+    if (!ft_poke_image(a09,data,addr + offset,&bytes[alen],(size_t)count - alen - 1,prot))
+      return false;
+      
+    pos = eol + 1;
+  }
+  
+  return true;
+}
+
+/**************************************************************************/
+
+static bool ft_rsdos(
+        struct a09          *a09,
+        struct testdata     *data,
+        unsigned char const *image,
+        size_t               size,
+        uint16_t             offset,
+        struct memprot       prot,
+        bool                 load
+)
+{
+  assert(image != NULL);
+  assert(!load || (a09  != NULL));
+  assert(!load || (data != NULL));
+  
+  size_t pos = 0;
+  
+  /*-----------------------------------------------------------------------
+  ; A series of blocks of $00 length:2 address:2 data, ending with a block
+  ; of $FF $00 $00 exec:2.  This is called first to check the format, then
+  ; to actually load the image.
+  ;------------------------------------------------------------------------*/
+  
+  while(pos + 5 <= size)
+  {
+    size_t   len  = (image[pos + 1] << 8) | image[pos + 2];
+    uint16_t addr = (image[pos + 3] << 8) | image[pos + 4];
+    
+    if (image[pos] == 0xFF)
+      return (len == 0) && (pos + 5 == size);
+    if (image[pos] != 0x00)
+      return false;
+    if (pos + 5 + len > size)
+      return false;
+    if (load && !ft_poke_image(a09,data,(unsigned long)addr + offset,&image[pos + 5],len,prot))
+      return false;
+    pos += 5 + len;
+  }
+  
+  return false;
+}
+
+/**************************************************************************/
+
+static bool ft_load_image(
+        struct a09      *a09,
+        struct testdata *data,
+        char const      *filename,
+        uint16_t         addr,
+        bool             haveaddr,
+        struct memprot   prot
+)
+{
+  assert(a09      != NULL);
+  assert(data     != NULL);
+  assert(filename != NULL);
+  
+  unsigned char *image = NULL;
+  size_t         size  = 0;
+  bool           rc;
+  FILE          *fp    = fopen(filename,"rb");
+  
+  if (fp == NULL)
+    return message(a09,MSG_ERROR,"E0042: %s: '%s'",filename,strerror(errno));
+    
+  while(true)
+  {
+    unsigned char *new = realloc(image,size + 65536u);
+    size_t         bytes;
+    
+    if (new == NULL)
+    {
+      free(image);
+      fclose(fp);
+      return message(a09,MSG_ERROR,"E0046: out of memory");
+    }
+    
+    image  = new;
+    bytes  = fread(&image[size],1,65536u,fp);
+    size  += bytes;
+    if (bytes < 65536u)
+      break;
+  }
+  
+  fclose(fp);
+  
+  /*-----------------------------------------------------------------------
+  ; A test's cached result depends on the images loaded, not just on the
+  ; directive naming them, so fold in the contents.
+  ;------------------------------------------------------------------------*/
+  
+  if (data->impact != NULL)
+    data->impact->opthash = ft_hash(data->impact->opthash,image,size);
+    
+  /*-----------------------------------------------------------------------
+  ; S-records and RS-DOS images carry their own addresses, so the given
+  ; address is an offset for them.  Anything else is a raw binary image.
+  ;------------------------------------------------------------------------*/
+  
+  if (size == 0)
+    rc = message(a09,MSG_ERROR,"E0097: %s: contains no data",filename);
+  else if ((size > 1) && (image[0] == 'S') && isdigit(image[1]))
+    rc = ft_load_srec(a09,data,filename,image,size,addr,prot);
+  else if (ft_rsdos(a09,data,image,size,addr,prot,false))
+    rc = ft_rsdos(a09,data,image,size,addr,prot,true);
+  else if (!haveaddr)
+    rc = message(a09,MSG_ERROR,"E0116: missing load address for binary image '%s'",filename);
+  else
+    rc = ft_poke_image(a09,data,addr,image,size,prot);
+    
+  free(image);
+  return rc;
+}
+
+/**************************************************************************/
+
+static bool ft_load_spec(struct a09 *a09,struct testdata *data,char const *spec)
+{
+  assert(a09  != NULL);
+  assert(data != NULL);
+  assert(spec != NULL);
+  
+  struct memprot  prot     = { .read = true , .exec = true };
+  char            filename[FILENAME_MAX];
+  char const     *comma    = strchr(spec,',');
+  unsigned long   addr     = 0;
+  bool            haveaddr = false;
+  size_t          len      = comma != NULL ? (size_t)(comma - spec) : strlen(spec);
+  
+  /*-----------------------------------------------------------------------
+  ; The command line form is "file[,address[,prot]]".
+  ;------------------------------------------------------------------------*/
+  
+  if (len >= sizeof(filename))
+    return message(a09,MSG_ERROR,"E0117: %s: malformed image",spec);
+  memcpy(filename,spec,len);
+  filename[len] = '\0';
+  
+  if (comma != NULL)
+  {
+    char *end;
+    
+    errno    = 0;
+    addr     = strtoul(comma + 1,&end,0);
+    haveaddr = true;
+    if ((errno != 0) || (end == comma + 1) || (addr > 0xFFFFuL))
+      return message(a09,MSG_ERROR,"E0006: not a value");
+      
+    if (*end == ',')
+    {
+      prot = (struct memprot){ .read = false };
+      if (!ft_protbits(a09,&prot,end + 1,strlen(end + 1)))
+        return false;
+    }
+    else if (*end != '\0')
+      return message(a09,MSG_ERROR,"E0023: missing expected comma");
+  }
+  
+  return ft_load_image(a09,data,filename,(uint16_t)addr,haveaddr,prot);
+}
+
+/**************************************************************************/
+
+static bool ft_stub_opt(struct opcdata *opd,struct testdata *data)
+{
+  assert(opd  != NULL);
+  assert(data != NULL);
+  
+  static char const *const regs[STUB_max] =
+  {
+    [STUB_A]  = "A",
+    [STUB_B]  = "B",
+    [STUB_D]  = "D",
+    [STUB_X]  = "X",
+    [STUB_Y]  = "Y",
+    [STUB_U]  = "U",
+    [STUB_DP] = "DP",
+    [STUB_CC] = "CC",
+  };
+  
+  struct stub   stub = { .cycles = 5 , .set = 0 , .output = '\0' };
+  struct value  addr;
+  struct stub  *new;
+  size_t        i;
+  char          c;
+  
+  if (data->intest)
+    return message(opd->a09,MSG_ERROR,"E0089: can only set outside a .TEST directive");
+    
+  if (!expr(&addr,opd->a09,opd->buffer,opd->pass))
+    return false;
+  stub.addr = addr.value;
+  
+  /*-----------------------------------------------------------------------
+  ; Each option is <name>=<value>.  CYCLES is the total cost of the call,
+  ; which defaults to the cost of the RTS; OUT names the register whose
+  ; value is captured, and the rest are registers to set on return.
+  ;------------------------------------------------------------------------*/
+  
+  while(!isEOL(c = skip_space(opd->buffer)))
+  {
+    label        name;
+    struct value value;
+    
+    if (c != ',')
+      return message(opd->a09,MSG_ERROR,"E0023: missing expected comma");
+      
+    c = skip_space(opd->buffer);
+    read_label(opd->buffer,&name,c);
+    upper_label(&name);
+    if (skip_space(opd->buffer) != '=')
+      return message(opd->a09,MSG_ERROR,"E0118: missing expected '='");
+      
+    if ((name.len == 6) && (memcmp(name.text,"CYCLES",6) == 0))
+    {
+      if (!ft_ulong(opd->a09,&stub.cycles,opd->buffer))
+        return false;
+      continue;
+    }
+    
+    if ((name.len == 3) && (memcmp(name.text,"OUT",3) == 0))
+    {
+      label reg;
+      
+      c = skip_space(opd->buffer);
+      read_label(opd->buffer,&reg,c);
+      upper_label(&reg);
+      if ((reg.len != 1) || ((reg.text[0] != 'A') && (reg.text[0] != 'B')))
+        return message(opd->a09,MSG_ERROR,"E0137: OUT='%.*s' not supported, only A or B",reg.len,reg.text);
+      stub.output = reg.text[0];
+      continue;
+    }
+    
+    for (i = 0 ; i < STUB_max ; i++)
+      if ((name.len == strlen(regs[i])) && (memcmp(name.text,regs[i],name.len) == 0))
+        break;
+        
+    if (i == STUB_max)
+      return message(opd->a09,MSG_ERROR,"E0087: option '%.*s' not supported",name.len,name.text);
+    if (!expr(&value,opd->a09,opd->buffer,opd->pass))
+      return false;
+      
+    stub.set      |= 1u << i;
+    stub.value[i]  = value.value;
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; Keep the stubs sorted by address.  Stubbing an address a second time
+  ; replaces the earlier definition.
+  ;------------------------------------------------------------------------*/
+  
+  for (i = 0 ; i < data->nstubs ; i++)
+    if (data->stubs[i].addr >= stub.addr)
+      break;
+      
+  if ((i < data->nstubs) && (data->stubs[i].addr == stub.addr))
+  {
+    data->stubs[i] = stub;
+    return true;
+  }
+  
+  new = realloc(data->stubs,(data->nstubs + 1) * sizeof(struct stub));
+  if (new == NULL)
+    return message(opd->a09,MSG_ERROR,"E0046: out of memory");
+    
+  memmove(&new[i + 1],&new[i],(data->nstubs - i) * sizeof(struct stub));
+  new[i]      = stub;
+  data->stubs = new;
+  data->nstubs++;
+  return true;
+}
+
+/**************************************************************************/
+
+static bool ft_int_opt(struct opcdata *opd,struct testdata *data,size_t idx)
+{
+  assert(opd  != NULL);
+  assert(data != NULL);
+  assert(idx  <  INT_max);
+  
+  struct intsched  sched = { .at = 0 , .every = 0 , .on = true };
+  label            when;
+  char             c     = skip_space(opd->buffer);
+  
+  read_label(opd->buffer,&when,c);
+  upper_label(&when);
+  
+  if ((when.len == 5) && (memcmp(when.text,"EVERY",5) == 0))
+  {
+    if (!ft_ulong(opd->a09,&sched.every,opd->buffer))
+      return false;
+    if (sched.every == 0)
+      return message(opd->a09,MSG_ERROR,"E0006: not a value");
+    sched.at = sched.every;
+  }
+  else if ((when.len == 2) && (memcmp(when.text,"AT",2) == 0))
+  {
+    if (!ft_ulong(opd->a09,&sched.at,opd->buffer))
+      return false;
+  }
+  else if ((when.len == 3) && (memcmp(when.text,"OFF",3) == 0))
+    sched.on = false;
+  else
+    return message(opd->a09,MSG_ERROR,"E0087: option '%.*s' not supported",when.len,when.text);
+    
+  if (data->intest)
+  {
+    assert(data->nunits > 0);
+    data->units[data->nunits-1].ints[idx] = sched;
+  }
+  else
+    data->intsched[idx] = sched;
+    
+  return true;
+}
+
+/**************************************************************************/
+
+static bool ft_device_opt(struct opcdata *opd,struct testdata *data)
+{
+  assert(opd  != NULL);
+  assert(data != NULL);
+  
+  struct device  dev  = { .param = 1 };
+  struct device *new;
+  struct value   addr;
+  label          kind;
+  char           c;
+  
+  if (data->intest)
+    return message(opd->a09,MSG_ERROR,"E0089: can only set outside a .TEST directive");
+    
+  c = skip_space(opd->buffer);
+  read_label(opd->buffer,&kind,c);
+  upper_label(&kind);
+  
+  if ((kind.len == 5) && (memcmp(kind.text,"TIMER",5) == 0))
+  {
+    dev.kind = DEV_TIMER;
+    dev.size = 2;
+  }
+  else if ((kind.len == 3) && (memcmp(kind.text,"PIA",3) == 0))
+  {
+    dev.kind = DEV_PIA;
+    dev.size = 4;
+  }
+  else if ((kind.len == 6) && (memcmp(kind.text,"SERIAL",6) == 0))
+  {
+    dev.kind  = DEV_SERIAL;
+    dev.size  = 2;
+    dev.param = 0;
+  }
+  else
+    return message(opd->a09,MSG_ERROR,"E0087: option '%.*s' not supported",kind.len,kind.text);
+    
+  if (skip_space(opd->buffer) != ',')
+    return message(opd->a09,MSG_ERROR,"E0023: missing expected comma");
+  if (!expr(&addr,opd->a09,opd->buffer,opd->pass))
+    return false;
+  if (addr.value > 65536u - dev.size)
+    return message(opd->a09,MSG_ERROR,"E0112: length exceeds memory space");
+  dev.addr = addr.value;
+  
+  c = skip_space(opd->buffer);
+  if (c == ',')
+  {
+    if (!ft_ulong(opd->a09,&dev.param,opd->buffer))
+      return false;
+    if ((dev.kind == DEV_TIMER) && (dev.param == 0))
+      return message(opd->a09,MSG_ERROR,"E0006: not a value");
+  }
+  else if (!isEOL(c))
+    return message(opd->a09,MSG_ERROR,"E0023: missing expected comma");
+    
+  new = realloc(data->devices,(data->ndevices + 1) * sizeof(struct device));
+  if (new == NULL)
+    return message(opd->a09,MSG_ERROR,"E0046: out of memory");
+  data->devices                   = new;
+  data->devices[data->ndevices++] = dev;
+  return true;
+}
+
+/**************************************************************************/
+
+bool test__opt(struct opcdata *opd)
+{
+  assert(opd             != NULL);
+  assert(opd->a09        != NULL);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  if (opd->a09->tests == NULL)
+    return true;
+    
+  assert(opd->a09->tests != NULL);
+  assert(opd->a09->runtests);
+  
+  struct testdata *data = opd->a09->tests;
+  char             c    = skip_space(opd->buffer);
+  label            tmp;
+  
+  read_label(opd->buffer,&tmp,c);
+  upper_label(&tmp);
+  
+  if (opd->pass == 1)
+  {
+    if ((tmp.len == 3) && (memcmp(tmp.text,"ORG",3) == 0))
+    {
+      struct value addr;
+      
+      if (!expr(&addr,opd->a09,opd->buffer,opd->pass))
+        return false;
+        
+      if (data->intest)
+        return message(opd->a09,MSG_ERROR,"E0100: Can only assign test code outside a .TEST directive");
+        
+      data->inittestpc = addr.value;
+      data->testpc     = addr.value;
+      message(opd->a09,MSG_DEBUG,"testloadpc=%04X",data->testpc);
+    }
+  }
+  
+  else if (opd->pass == 2)
+  {
+    ft_impact_hash(data,opd->a09);
+    
+    if ((tmp.len == 4) && (memcmp(tmp.text,"PROT",4) == 0))
+    {
+      struct memprot prot =
+      {
+        .read  = false ,
+        .write = false ,
+        .exec  = false ,
+        .tron  = false ,
+        .check = false ,
+      };
+      struct value low;
+      struct value high;
+      
+      c = skip_space(opd->buffer);
       read_label(opd->buffer,&tmp,c);
+      if (!ft_protbits(opd->a09,&prot,tmp.text,tmp.len))
+        return false;
+      
+      c = skip_space(opd->buffer);
+      if (c != ',')
+        return message(opd->a09,MSG_ERROR,"E0023: missing expected comma");
+        
+      if (!expr(&low,opd->a09,opd->buffer,opd->pass))
+        return false;
+      c = skip_space(opd->buffer);
+      if (isEOL(c))
+        high = low;
+      else if (c != ',')
+        return message(opd->a09,MSG_ERROR,"E0023: missing expected comma");
+      else
+      {
+        if (!expr(&high,opd->a09,opd->buffer,opd->pass))
+          return false;
+      }
+      
+      message(opd->a09,MSG_DEBUG,
+        "LOW=%04X HIGH=%04X r=%s w=%s x=%s t=%s",
+        low.value,
+        high.value,
+        prot.read  ? "true " : "false",
+        prot.write ? "true " : "false",
+        prot.exec  ? "true " : "false",
+        prot.tron  ? "true " : "false"
+      );
+      
+      if (data->intest)
+      {
+        struct Assert *Assert = get_Assert(opd->a09,data,opd->a09->pc);
+        if (Assert == NULL)
+          return false;
+          
+        struct vmcode *new = new_program(Assert);
+        if (new == NULL)
+          return false;
+          
+        assert(sizeof(struct memprot) <= sizeof(enum vmops));
+        
+        new->prog[0]                   = VM_LIT;
+        memcpy(&new->prog[1],&prot,sizeof(prot));
+        new->prog[2]                   = VM_LIT;
+        new->prog[3]                   = high.value;
+        new->prog[4]                   = VM_LIT;
+        new->prog[5]                   = low.value;
+        new->prog[6]                   = VM_PROT;
+        new->prog[7]                   = VM_TRUE;
+        new->prog[8]                   = VM_EXIT;
+        data->prot[opd->a09->pc].check = true;
+      }
+      else
+      {
+        for (size_t a = low.value ; a <= high.value ; a++)
+          data->prot[a] = prot;
+      }
+    }
+    
+    else if ((tmp.len == 5) && (memcmp(tmp.text,"POKEW",5) == 0))
+    {
+      struct value addr;
+      struct value word;
+      
+      if (!expr(&addr,opd->a09,opd->buffer,opd->pass))
+        return false;
+      c = skip_space(opd->buffer);
+      if (c != ',')
+        return message(opd->a09,MSG_ERROR,"E0023: missing expected comma");
+      if (!expr(&word,opd->a09,opd->buffer,opd->pass))
+        return false;
+        
+      if (data->intest)
+      {
+        struct Assert *Assert = get_Assert(opd->a09,data,opd->a09->pc);
+        if (Assert == NULL)
+          return false;
+          
+        struct vmcode *new = new_program(Assert);
+        if (new == NULL)
+          return false;
+          
+        new->prog[0]                   = VM_LIT;
+        new->prog[1]                   = word.value;
+        new->prog[2]                   = VM_LIT;
+        new->prog[3]                   = addr.value;
+        new->prog[4]                   = VM_TO16;
+        new->prog[5]                   = VM_TRUE;
+        new->prog[6]                   = VM_EXIT;
+        data->prot[opd->a09->pc].check = true;
+      }
+      else
+      {
+        data->memory[addr.value]     = word.value >> 8;
+        data->memory[addr.value + 1] = word.value & 255;
+      }
+    }
+    
+    else if ((tmp.len == 4) && (memcmp(tmp.text,"POKE",4) == 0))
+    {
+      struct value addr;
+      struct value byte;
+      
+      if (!expr(&addr,opd->a09,opd->buffer,opd->pass))
+        return false;
+      c = skip_space(opd->buffer);
+      if (c != ',')
+        return message(opd->a09,MSG_ERROR,"E0023: missing expected comma");
+      if (!expr(&byte,opd->a09,opd->buffer,opd->pass))
+        return false;
+        
+      if (data->intest)
+      {
+        struct Assert *Assert = get_Assert(opd->a09,data,opd->a09->pc);
+        if (Assert == NULL)
+          return false;
+          
+        struct vmcode *new = new_program(Assert);
+        if (new == NULL)
+          return false;
+          
+        new->prog[0]                   = VM_LIT;
+        new->prog[1]                   = byte.value;
+        new->prog[2]                   = VM_LIT;
+        new->prog[3]                   = addr.value;
+        new->prog[4]                   = VM_TO8;
+        new->prog[5]                   = VM_TRUE;
+        new->prog[6]                   = VM_EXIT;
+        data->prot[opd->a09->pc].check = true;
+      }
+      else
+        data->memory[addr.value] = byte.value & 255;
+    }
+    
+    else if ((tmp.len == 5) && (memcmp(tmp.text,"STACK",5) == 0))
+    {
+      struct value sp;
+      
+      if (!expr(&sp,opd->a09,opd->buffer,opd->pass))
+        return false;
+        
+      if (data->intest)
+        message(opd->a09,MSG_WARNING,"W0017: cannot assign the stack address within .TEST directive");
+        
+      data->sp = sp.value;
+    }
+    
+    else if ((tmp.len == 9) && (memcmp(tmp.text,"STACKSIZE",9) == 0))
+    {
+      struct value size;
+      
+      if (!expr(&size,opd->a09,opd->buffer,opd->pass))
+        return false;
+        
+      if (data->intest)
+        message(opd->a09,MSG_WARNING,"W0018: cannot assign the stack size within .TEST directive");
+        
+      if ((size.value < 2) || (size.value > 4096))
+        return message(opd->a09,MSG_ERROR,"E0088: stack size must be between 2 and 4096");
+        
+      data->stacksize = size.value;
+    }
+    
+    else if ((tmp.len == 9) && (memcmp(tmp.text,"RANDOMIZE",9) == 0))
+    {
+      if (data->intest)
+        return message(opd->a09,MSG_ERROR,"E0089: can only set outside a .TEST directive");
+      opd->a09->rndtests = true;
+    }
+    
+    else if ((tmp.len == 3) && (memcmp(tmp.text,"ORG",3) == 0))
+    {
+      struct value addr;
+      
+      if (!expr(&addr,opd->a09,opd->buffer,opd->pass))
+        return false;
+        
+      if (data->intest)
+        return message(opd->a09,MSG_ERROR,"E0100: Can only assign test code outside a .TEST directive");
+        
+      data->inittestpc = addr.value;
+      data->testpc     = addr.value;
+      message(opd->a09,MSG_DEBUG,"testloadpc=%04X",data->testpc);
+    }
+    
+    else if ((tmp.len == 6) && (memcmp(tmp.text,"DEVICE",6) == 0))
+      return ft_device_opt(opd,data);
+      
+    else if ((tmp.len == 3) && (memcmp(tmp.text,"IRQ",3) == 0))
+      return ft_int_opt(opd,data,INT_IRQ);
+      
+    else if ((tmp.len == 4) && (memcmp(tmp.text,"FIRQ",4) == 0))
+      return ft_int_opt(opd,data,INT_FIRQ);
+      
+    else if ((tmp.len == 3) && (memcmp(tmp.text,"NMI",3) == 0))
+      return ft_int_opt(opd,data,INT_NMI);
+      
+    else if ((tmp.len == 4) && (memcmp(tmp.text,"LOAD",4) == 0))
+    {
+      struct memprot prot     = { .read = true , .exec = true };
+      struct buffer  filename;
+      struct value   addr     = { .value = 0 };
+      bool           haveaddr = false;
+      
+      if (data->intest)
+        return message(opd->a09,MSG_ERROR,"E0089: can only set outside a .TEST directive");
+        
+      if (!parse_string(opd->a09,&filename,opd->buffer))
+        return false;
+      assert(filename.widx < sizeof(filename.buf));
+      filename.buf[filename.widx] = '\0';
+      
+      c = skip_space(opd->buffer);
+      if (c == ',')
+      {
+        if (!expr(&addr,opd->a09,opd->buffer,opd->pass))
+          return false;
+        haveaddr = true;
+        
+        c = skip_space(opd->buffer);
+        if (c == ',')
+        {
+          c    = skip_space(opd->buffer);
+          prot = (struct memprot){ .read = false };
+          read_label(opd->buffer,&tmp,c);
+          if (!ft_protbits(opd->a09,&prot,tmp.text,tmp.len))
+            return false;
+        }
+      }
+      
+      return ft_load_image(opd->a09,data,filename.buf,addr.value,haveaddr,prot);
+    }
+    
+    else if ((tmp.len == 7) && (memcmp(tmp.text,"MAXINST",7) == 0))
+    {
+      unsigned long limit;
+      
+      if (!ft_ulong(opd->a09,&limit,opd->buffer))
+        return false;
+        
+      if (data->intest)
+      {
+        assert(data->nunits > 0);
+        data->units[data->nunits-1].maxinst = limit;
+      }
+      else
+        data->maxinst = limit;
+    }
+    
+    else if ((tmp.len == 9) && (memcmp(tmp.text,"MAXCYCLES",9) == 0))
+    {
+      unsigned long limit;
+      
+      if (!ft_ulong(opd->a09,&limit,opd->buffer))
+        return false;
+        
+      if (data->intest)
+      {
+        assert(data->nunits > 0);
+        data->units[data->nunits-1].maxcycles = limit;
+      }
+      else
+        data->maxcycles = limit;
+    }
+    
+    else if ((tmp.len == 4) && (memcmp(tmp.text,"STUB",4) == 0))
+      return ft_stub_opt(opd,data);
+      
+    else if ((tmp.len == 5) && (memcmp(tmp.text,"TRACE",5) == 0))
+    {
+      struct value     size;
+      struct tracerec *trace;
+      
+      if (!expr(&size,opd->a09,opd->buffer,opd->pass))
+        return false;
+        
+      if (data->intest)
+        return message(opd->a09,MSG_ERROR,"E0089: can only set outside a .TEST directive");
+        
+      if (size.value == 0)
+      {
+        free(data->trace);
+        trace = NULL;
+      }
+      else
+      {
+        trace = realloc(data->trace,size.value * sizeof(struct tracerec));
+        if (trace == NULL)
+          return message(opd->a09,MSG_ERROR,"E0046: out of memory");
+      }
+      
+      data->trace     = trace;
+      data->tracesize = size.value;
+    }
+    
+    else if ((tmp.len == 5) && (memcmp(tmp.text,"DEBUG",5) == 0))
+      return message(opd->a09,MSG_DEBUG,"OPT TEST DEBUG");
+      
+    else if ((tmp.len == 4) && (memcmp(tmp.text,"TRON",4) == 0))
+    {
+      if (!data->intest)
+        return message(opd->a09,MSG_WARNING,"W0023: cannot set TRON outside a .TEST directive");
+      assert(data->nunits > 0);
+      data->units[data->nunits-1].tron = true;
+    }
+    
+    else
+      return message(opd->a09,MSG_ERROR,"E0087: option '%.*s' not supported",tmp.len,tmp.text);
+  }
+  
+  return true;
+}
+
+/**************************************************************************/
+
+static bool ftest_align(struct format *fmt,struct opcdata *opd)
+{
+  assert(fmt             != NULL);
+  assert(opd             != NULL);
+  assert(opd->a09        != NULL);
+  assert(opd->a09->tests != NULL);
+  assert(opd->a09->runtests);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  struct testdata *data = opd->a09->tests;
+  
+  if (opd->pass == 2)
+    data->addr += opd->datasz;
+    
+  if (!data->intest)
+    return opd->a09->tests->fmtalign(fmt,opd);
+  else
+    return true;
+}
+
+/**************************************************************************/
+
+static bool ftest_org(struct format *fmt,struct opcdata *opd)
+{
+  (void)fmt;
+  assert(opd             != NULL);
+  assert(opd->a09        != NULL);
+  assert(opd->a09->tests != NULL);
+  assert(opd->a09->runtests);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  struct testdata *data = opd->a09->tests;
+  
+  if (opd->pass == 2)
+    data->addr = opd->value.value;
+    
+  if (!data->intest)
+    return opd->a09->tests->fmtorg(fmt,opd);
+  else
+  {
+    opd->a09->pc = opd->value.value;
+    return true;
+  }
+}
+
+/**************************************************************************/
+
+static bool ftest_rmb(struct format *fmt,struct opcdata *opd)
+{
+  assert(fmt             != NULL);
+  assert(opd             != NULL);
+  assert(opd->a09        != NULL);
+  assert(opd->a09->tests != NULL);
+  assert(opd->a09->runtests);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  struct testdata *data = opd->a09->tests;
+  
+  if (opd->pass == 2)
+  {
+    if (opd->value.value == 0)
+      return message(opd->a09,MSG_ERROR,"E0099: Can't reserve 0 bytes of memory");
+      
+    for (size_t i = 0 ; i < opd->value.value ; i++)
+    {
+      data->prot[data->addr + i].read  = true;
+      data->prot[data->addr + i].write = true;
+    }
+    
+    data->addr += opd->value.value;
+  }
+  
+  if (!data->intest)
+    return opd->a09->tests->fmtrmb(fmt,opd);
+  else
+    return true;
+}
+
+/**************************************************************************/
+
+static bool ftest__test(struct format *fmt,struct opcdata *opd)
+{
+  (void)fmt;
+  assert(opd             != NULL);
+  assert(opd->a09->tests != NULL);
+  assert(opd->a09->runtests);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  struct testdata *data = opd->a09->tests;
+  
+  if (data->intest)
+    return message(opd->a09,MSG_ERROR,"E0078: cannot nest .TEST");
+    
+  data->intest     = true;
+  data->resumepc   = opd->a09->pc;
+  opd->value.value = data->testpc;
+  
+  if (!ftest_org(fmt,opd))
+    return false;
+    
+  message(opd->a09,MSG_DEBUG,"test resume=%04X new=%04X",data->resumepc,data->testpc);
+  
+  if (opd->pass == 2)
+  {
+    char c;
+    
+    struct unittest *new = realloc(data->units,(data->nunits + 1) * sizeof(struct unittest));
+    if (new == NULL)
+      return message(opd->a09,MSG_ERROR,"E0046: out of memory");
+    data->units                         = new;
+    data->units[data->nunits].addr      = opd->a09->pc;
+    data->units[data->nunits].filename  = opd->a09->infile;
+    data->units[data->nunits].line      = opd->a09->lnum;
+    data->units[data->nunits].cycles    = 0;
+    data->units[data->nunits].icount    = 0;
+    data->units[data->nunits].maxinst   = data->maxinst;
+    data->units[data->nunits].maxcycles = data->maxcycles;
+    memcpy(data->units[data->nunits].ints,data->intsched,sizeof(data->intsched));
+    data->units[data->nunits].hash      = 2166136261uL;
+    data->units[data->nunits].lines     = NULL;
+    data->units[data->nunits].nlines    = 0;
+    data->units[data->nunits].cache     = NULL;
+    data->units[data->nunits].tron      = false;
+    data->units[data->nunits].passed    = false;
+    data->units[data->nunits].setup     = opd->op->opcode == 0x01;
+    
+    /*--------------------------------------------------------------------
+    ; A .SETUP fixture applies to all the tests that follow it, up to the
+    ; next .SETUP.
+    ;---------------------------------------------------------------------*/
+    
+    if (data->units[data->nunits].setup)
+      data->fixture = ++data->nfixtures;
+    data->units[data->nunits].fixture   = data->fixture;
+    
+    c = skip_space(opd->buffer);
+    if ((c == '"') || (c == '\''))
+    {
+      if (!collect_esc_string(opd->a09,&data->units[data->nunits].name,opd->buffer,c))
+        return false;
+    }
+    else if (isEOL(c))
+    {
+      memcpy(data->units[data->nunits].name.buf,opd->a09->label.text,opd->a09->label.len);
+      data->units[data->nunits].name.widx = opd->a09->label.len;
+    }
+    else
+      return message(opd->a09,MSG_ERROR,"E0060: syntax error");
+      
+    data->nunits++;
+  }
+  return true;
+}
+
+/**************************************************************************/
+
+static bool ft_timingp(struct buffer *buffer)
+{
+  assert(buffer != NULL);
+  char c = skip_space(buffer);
+  if (isEOL(c))
+    return false;
+  buffer->ridx--;
+  return strncmp(buffer->buf,"timing",6);
+}
+
+/**************************************************************************/
+
+static bool ftest__tron(struct format *fmt,struct opcdata *opd)
+{
+  (void)fmt;
+  assert(opd             != NULL);
+  assert(opd->a09        != NULL);
+  assert(opd->a09->tests != NULL);
+  assert(opd->a09->runtests);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  if (opd->pass == 2)
+  {
+    struct testdata *data = opd->a09->tests;
+    
+    if (ft_timingp(opd->buffer))
+    {
+      struct vmcode *new;
+      struct Assert *Assert = get_Assert(opd->a09,data,opd->a09->pc);
+      
+      if (Assert == NULL)
+        return false;
+      new = new_program(Assert);
+      if (new == NULL)
+        return message(opd->a09,MSG_ERROR,"E0046: out of memory");
+        
+      if (data->nunits == 0)
+      {
+        snprintf(
+                  new->tag,
+                  sizeof(new->tag),
+                  "%s:%zu",
+                  opd->a09->infile,
+                  opd->a09->lnum
+                );
+      }
+      else
+      {
+        snprintf(
+                  new->tag,
+                  sizeof(new->tag),
+                  "%.*s:%zu",
+                  (int)data->units[data->nunits-1].name.widx,
+                  data->units[data->nunits-1].name.buf,
+                  opd->a09->lnum
+                );
+      }
+      
+      new->line                      = opd->a09->lnum;
+      new->prog[0]                   = VM_TIMEON;
+      new->prog[1]                   = VM_TRUE;
+      new->prog[2]                   = VM_EXIT;
+      data->prot[opd->a09->pc].check = true;
+      data->timing                   = true;
+    }
+    else
+      data->tron = true;
+  }
+  
+  return true;
+}
+
+/**************************************************************************/
+
+static bool ftest__troff(struct format *fmt,struct opcdata *opd)
+{
+  (void)fmt;
+  assert(opd             != NULL);
+  assert(opd->a09        != NULL);
+  assert(opd->a09->tests != NULL);
+  assert(opd->a09->runtests);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  if (opd->pass == 2)
+  {
+    struct testdata *data = opd->a09->tests;
+    
+    if (data->timing || ft_timingp(opd->buffer))
+    {
+      struct vmcode *new;
+      struct Assert *Assert = get_Assert(opd->a09,data,opd->a09->pc);
+      if (Assert == NULL)
+        return false;
+        
+      new = new_program(Assert);
+      if (new == NULL)
+        return message(opd->a09,MSG_ERROR,"E0046: out of memory");
+        
+      if (data->nunits == 0)
+      {
+        snprintf(
+                  new->tag,
+                  sizeof(new->tag),
+                  "%s:%zu",
+                  opd->a09->infile,
+                  opd->a09->lnum
+                );
+      }
+      else
+      {
+        snprintf(
+                  new->tag,
+                  sizeof(new->tag),
+                  "%.*s:%zu",
+                  (int)data->units[data->nunits-1].name.widx,
+                  data->units[data->nunits-1].name.buf,
+                  opd->a09->lnum
+                );
+      }
+      
+      new->line                      = opd->a09->lnum;
+      new->prog[0]                   = VM_TIMEOFF;
+      new->prog[1]                   = VM_TRUE;
+      new->prog[2]                   = VM_EXIT;
+      data->prot[opd->a09->pc].check = true;
+    }
+    else
+      data->tron = false;
+  }
+  
+  return true;
+}
+
+/**************************************************************************/
+
+static bool ftest__Assert(struct format *fmt,struct opcdata *opd)
+{
+  (void)fmt;
+  assert(opd             != NULL);
+  assert(opd->a09        != NULL);
+  assert(opd->a09->tests != NULL);
+  assert(opd->a09->runtests);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  if (opd->pass == 2)
+  {
+    struct testdata    *data       = opd->a09->tests;
+    data->prot[opd->a09->pc].check = true;
+    ft_impact_hash(data,opd->a09);
+    struct Assert *Assert          = get_Assert(opd->a09,data,opd->a09->pc);
+    
+    if (Assert == NULL)
+      return false;
+      
+    if (data->nunits == 0)
+    {
+      struct buffer name;
+      
+      /*-----------------------------------------------------------------
+      ; This .ASSERT directive was outside a .TEST directive, so use the
+      ; last non-local label as the "name".
+      ;------------------------------------------------------------------*/
+      
+      memcpy(name.buf,opd->a09->label.text,opd->a09->label.len);
+      name.widx = opd->a09->label.len;
+      if (!ft_compile(opd->a09,&name,data,Assert,opd->buffer,opd->pass))
+        return false;
+    }
+    else
+    {
+      if (!ft_compile(opd->a09,&data->units[data->nunits-1].name,data,Assert,opd->buffer,opd->pass))
+        return false;
+    }
+  }
+  
+  return true;
+}
+
+/**************************************************************************/
+
+static bool ftest__endtst(struct format *fmt,struct opcdata *opd)
+{
+  (void)fmt;
+  assert(opd             != NULL);
+  assert(opd->a09        != NULL);
+  assert(opd->a09->tests != NULL);
+  assert(opd->a09->runtests);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  struct testdata *test = opd->a09->tests;
+  
+  if (!test->intest)
+    return message(opd->a09,MSG_ERROR,"E0079: no matching .TEST");
+    
+  test->testpc     = opd->a09->pc;
+  opd->value.value = test->resumepc;
+  
+  if (!ftest_org(fmt,opd))
+    return false;
+  message(opd->a09,MSG_DEBUG,"endtst pc=%04X",opd->a09->pc);
+  
+  test->intest = false;
+  return true;
+}
+
+/**************************************************************************/
+
+static mc6809byte__t ft_trace_read(mc6809dis__t *dis,mc6809addr__t addr)
+{
+  assert(dis       != NULL);
+  assert(dis->user != NULL);
+  
+  struct tracerec *rec    = dis->user;
+  uint16_t         offset = addr - rec->pc;
+  
+  if (offset < sizeof(rec->bytes))
+    return rec->bytes[offset];
+  else
+    return 0;
+}
+
+/**************************************************************************/
+
+static void ft_trace_dump(struct a09 *a09,struct testdata *data,bool all)
+{
+  assert(a09  != NULL);
+  assert(data != NULL);
+  assert(data->trace != NULL);
+  
+  size_t count = data->tracecnt < data->tracesize ? data->tracecnt : data->tracesize;
+  size_t idx   = (data->tracenext + data->tracesize - count) % data->tracesize;
+  
+  /*-----------------------------------------------------------------------
+  ; The records are only decoded here, using a copy of the CPU for the
+  ; registers and the saved opcode bytes for the disassembler, as memory
+  ; may have changed since the instruction was executed.
+  ;------------------------------------------------------------------------*/
+  
+  if (data->symbols == NULL)
+    data->symbols = symbol_addrtable(a09,&data->nsymbols);
+    
+  for (size_t i = 0 ; i < count ; i++ , idx = (idx + 1) % data->tracesize)
+  {
+    struct tracerec *rec = &data->trace[idx];
+    struct symbol   *sym;
+    mc6809dis__t     dis;
+    mc6809__t        cpu;
+    char             inst[128];
+    char             regs[128];
+    
+    if (!all && !rec->traced)
+      continue;
+      
+    dis        = data->dis;
+    dis.pc     = rec->pc;
+    dis.user   = rec;
+    dis.read   = ft_trace_read;
+    cpu        = data->cpu;
+    cpu.pc.w   = rec->pc;
+    cpu.X.w    = rec->X;
+    cpu.Y.w    = rec->Y;
+    cpu.U.w    = rec->U;
+    cpu.S.w    = rec->S;
+    cpu.d.w    = rec->d;
+    cpu.dp     = rec->dp;
+    cpu.cycles = rec->cycles;
+    mc6809_bytetocc(&cpu,rec->cc);
+    
+    if (mc6809dis_step(&dis,&cpu) == 0)
+      mc6809dis_format(&dis,inst,sizeof(inst));
+    else
+      snprintf(inst,sizeof(inst),"%04X: ???",rec->pc);
+    mc6809dis_registers(&cpu,regs,sizeof(regs));
+    
+    if (a09->tapout)
+      printf("# ");
+      
+    sym = symbol_nearest(data->symbols,data->nsymbols,rec->pc);
+    if (sym != NULL)
+      printf("%s | %s ; %.*s+%u\n",regs,inst,sym->name.len,sym->name.text,(unsigned)(rec->pc - sym->value));
+    else
+      printf("%s | %s\n",regs,inst);
+  }
+}
+
+/**************************************************************************/
+
+static void ft_hot_range(struct a09 *a09,struct testdata *data)
+{
+  assert(a09  != NULL);
+  assert(data != NULL);
+  
+  struct symbol *sym;
+  unsigned long  total = 0;
+  size_t         hot   = 0;
+  size_t         len;
+  
+  for (size_t i = 0 ; i < ITEMS(data->hot) ; i++)
+  {
+    total += data->hot[i];
+    if (data->hot[i] > data->hot[hot])
+      hot = i;
+  }
+  
+  len = snprintf(
+          data->errbuf,
+          sizeof(data->errbuf),
+          "instructions=%lu cycles=%lu hot=%04zX-%04zX (%lu%%)",
+          data->baseicount + data->icount,
+          data->basecycles + data->cpu.cycles,
+          hot * HOT_RANGE,
+          hot * HOT_RANGE + HOT_RANGE - 1,
+          total > 0 ? data->hot[hot] * 100uL / total : 0uL
+        );
+        
+  if (data->symbols == NULL)
+    data->symbols = symbol_addrtable(a09,&data->nsymbols);
+  sym = symbol_nearest(data->symbols,data->nsymbols,(uint16_t)(hot * HOT_RANGE));
+  if ((sym != NULL) && (len < sizeof(data->errbuf)))
+  {
+    snprintf(
+              &data->errbuf[len],
+              sizeof(data->errbuf) - len,
+              " %.*s+%u",
+              sym->name.len,sym->name.text,
+              (unsigned)(hot * HOT_RANGE - sym->value)
+            );
+  }
+}
+
+/**************************************************************************/
+
+static int baselinecmp(void const *restrict needle,void const *restrict haystack)
+{
+  struct baseline const *key   = needle;
+  struct baseline const *value = haystack;
+  int                    rc    = strcmp(key->filename,value->filename);
+  
+  if (rc == 0)
+  {
+    if (key->line < value->line)
+      return -1;
+    else if (key->line > value->line)
+      return  1;
+    else
+      rc = strcmp(key->name,value->name);
+  }
+  
+  return rc;
+}
+
+/**************************************************************************/
+
+static char *ft_strcopy(char const *src,size_t len)
+{
+  assert(src != NULL);
+  
+  char *dest = malloc(len + 1);
+  if (dest != NULL)
+  {
+    memcpy(dest,src,len);
+    dest[len] = '\0';
+  }
+  
+  return dest;
+}
+
+/**************************************************************************/
+
+static void free_baselines(struct baseline *list,size_t num)
+{
+  for (size_t i = 0 ; i < num ; i++)
+  {
+    free(list[i].filename);
+    free(list[i].name);
+  }
+  free(list);
+}
+
+/**************************************************************************/
+
+static bool ft_read_baselines(
+        struct a09       *a09,
+        FILE             *fp,
+        struct baseline **plist,
+        size_t           *pnum
+)
+{
+  assert(a09   != NULL);
+  assert(fp    != NULL);
+  assert(plist != NULL);
+  assert(pnum  != NULL);
+  
+  struct baseline *list = NULL;
+  size_t           num  = 0;
+  size_t           lnum = 0;
+  char             line[BUFSIZ];
+  
+  /*-----------------------------------------------------------------------
+  ; Each line is "cycles<TAB>icount<TAB>filename:line<TAB>name".  The name
+  ; is last since it can contain nearly anything.
+  ;------------------------------------------------------------------------*/
+  
+  while(fgets(line,sizeof(line),fp) != NULL)
+  {
+    struct baseline *new;
+    char            *p;
+    char            *name;
+    char            *colon;
+    unsigned long    cycles;
+    unsigned long    icount;
+    
+    lnum++;
+    line[strcspn(line,"\n")] = '\0';
+    if ((line[0] == '#') || (line[0] == '\0'))
+      continue;
+      
+    cycles = strtoul(line,&p,10);
+    if (*p++ == '\t')
+    {
+      icount = strtoul(p,&p,10);
+      if (*p++ == '\t')
+      {
+        name  = strchr(p,'\t');
+        colon = strrchr(p,':');
+        if ((name != NULL) && (colon != NULL) && (colon < name))
+        {
+          new = realloc(list,(num + 1) * sizeof(struct baseline));
+          if (new == NULL)
+          {
+            free_baselines(list,num);
+            return message(a09,MSG_ERROR,"E0046: out of memory");
+          }
+          
+          list               = new;
+          list[num].filename = ft_strcopy(p,(size_t)(colon - p));
+          list[num].name     = ft_strcopy(name + 1,strlen(name + 1));
+          list[num].line     = strtoul(colon + 1,NULL,10);
+          list[num].cycles   = cycles;
+          list[num].icount   = icount;
+          num++;
+          
+          if ((list[num-1].filename == NULL) || (list[num-1].name == NULL))
+          {
+            free_baselines(list,num);
+            return message(a09,MSG_ERROR,"E0046: out of memory");
+          }
+          continue;
+        }
+      }
+    }
+    
+    free_baselines(list,num);
+    return message(a09,MSG_ERROR,"E0115: %s:%zu: malformed baseline entry",a09->baseline,lnum);
+  }
+  
+  qsort(list,num,sizeof(struct baseline),baselinecmp);
+  *plist = list;
+  *pnum  = num;
+  return true;
+}
+
+/**************************************************************************/
+
+static bool ft_write_baselines(struct a09 *a09,struct testdata *data)
+{
+  assert(a09  != NULL);
+  assert(data != NULL);
+  assert(a09->baseline != NULL);
+  
+  FILE *fp = fopen(a09->baseline,"w");
+  
+  if (fp == NULL)
+    return message(a09,MSG_ERROR,"E0070: %s: %s",a09->baseline,strerror(errno));
+    
+  fprintf(fp,"# cycles\ticount\tfile:line\tname\n");
+  for (size_t i = 0 ; i < data->nunits ; i++)
+  {
+    struct unittest *unit = &data->units[i];
+    
+    if (unit->passed && !unit->setup)
+    {
+      fprintf(
+               fp,
+               "%lu\t%lu\t%s:%zu\t%.*s\n",
+               unit->cycles,
+               unit->icount,
+               unit->filename,
+               unit->line,
+               (int)unit->name.widx,unit->name.buf
+             );
+    }
+  }
+  
+  fclose(fp);
+  return true;
+}
+
+/**************************************************************************/
+
+static void ft_heat_sum(
+        struct heatmap const *heat,
+        size_t                low,
+        size_t                high,
+        unsigned long long    sum[static 3]
+)
+{
+  assert(heat != NULL);
+  assert(low  <= high);
+  assert(high <= 65536u);
+  
+  sum[0] = sum[1] = sum[2] = 0;
+  for (size_t addr = low ; addr < high ; addr++)
+  {
+    sum[0] += heat->fetch[addr];
+    sum[1] += heat->read [addr];
+    sum[2] += heat->write[addr];
+  }
+}
+
+/**************************************************************************/
+
+static bool ft_write_heatmap(struct a09 *a09,struct testdata *data)
+{
+  assert(a09           != NULL);
+  assert(data          != NULL);
+  assert(data->heat    != NULL);
+  assert(a09->heatfile != NULL);
+  
+  unsigned long long  sum[3];
+  FILE               *fp = fopen(a09->heatfile,"w");
+  
+  if (fp == NULL)
+    return message(a09,MSG_ERROR,"E0070: %s: %s",a09->heatfile,strerror(errno));
+    
+  if (data->symbols == NULL)
+    data->symbols = symbol_addrtable(a09,&data->nsymbols);
+    
+  /*-----------------------------------------------------------------------
+  ; A symbol covers the memory up to the next symbol with a different
+  ; address.  Of symbols with the same address, only the first (shortest
+  ; name) is listed, and the last one stops at the test code.  Untouched
+  ; symbols are listed too, as candidates for removal.
+  ;------------------------------------------------------------------------*/
+  
+  fprintf(fp,"# fetch\tread\twrite\taddress\tsize\tsymbol\n");
+  for (size_t i = 0 ; i < data->nsymbols ; i++)
+  {
+    struct symbol *sym  = data->symbols[i];
+    size_t         next = i + 1;
+    size_t         high;
+    
+    if ((i > 0) && (data->symbols[i - 1]->value == sym->value))
+      continue;
+      
+    while((next < data->nsymbols) && (data->symbols[next]->value == sym->value))
+      next++;
+    if (next < data->nsymbols)
+      high = data->symbols[next]->value;
+    else if (sym->value < data->inittestpc)
+      high = data->inittestpc;
+    else
+      high = 65536u;
+    
+    ft_heat_sum(data->heat,sym->value,high,sum);
+    fprintf(
+             fp,
+             "%llu\t%llu\t%llu\t%04X\t%zu\t%.*s\n",
+             sum[0],sum[1],sum[2],
+             (unsigned)sym->value,
+             high - sym->value,
+             sym->name.len,sym->name.text
+           );
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; Variables placed in the direct page by .DPVAR are EQUates, so they're
+  ; not in the table above; list them too so '-D' sees their hits.
+  ;------------------------------------------------------------------------*/
+  
+  {
+    label    name;
+    uint16_t addr;
+    uint16_t size;
+    
+    for (size_t n = 0 ; dpvar_direct(a09,&n,&name,&addr,&size) ; n++)
+    {
+      ft_heat_sum(data->heat,addr,addr + size,sum);
+      fprintf(
+               fp,
+               "%llu\t%llu\t%llu\t%04X\t%u\t%.*s\n",
+               sum[0],sum[1],sum[2],
+               (unsigned)addr,
+               (unsigned)size,
+               name.len,name.text
+             );
+    }
+  }
+  
+  fprintf(fp,"\n# fetch\tread\twrite\tpage\n");
+  for (size_t page = 0 ; page < 256 ; page++)
+  {
+    ft_heat_sum(data->heat,page * 256,page * 256 + 256,sum);
+    if (sum[0] + sum[1] + sum[2] > 0)
+      fprintf(fp,"%llu\t%llu\t%llu\t%02zX\n",sum[0],sum[1],sum[2],page);
+  }
+  
+  fclose(fp);
+  return true;
+}
+
+/**************************************************************************/
+
+static int covlinecmp(void const *restrict needle,void const *restrict haystack)
+{
+  struct covline const *key   = needle;
+  struct covline const *value = haystack;
+  int                   rc    = strcmp(key->file,value->file);
+  
+  if (rc != 0)
+    return rc;
+  else if (key->line < value->line)
+    return -1;
+  else if (key->line > value->line)
+    return  1;
+  else
+    return (int)key->addr - (int)value->addr;
+}
+
+/**************************************************************************/
+
+static bool ft_isbranch(struct testdata *data,uint16_t addr)
+{
+  assert(data != NULL);
+  
+  uint8_t op = data->memory[addr];
+  
+  if (op == 0x10)
+    op = data->memory[(uint16_t)(addr + 1)];
+  return (op >= 0x22) && (op <= 0x2F);
+}
+
+/**************************************************************************/
+
+static bool ft_write_lcov(struct a09 *a09,struct testdata *data)
+{
+  assert(a09           != NULL);
+  assert(data          != NULL);
+  assert(data->cover   != NULL);
+  assert(a09->covfile  != NULL);
+  
+  struct covline *lines = malloc(65536u * sizeof(struct covline));
+  size_t          num   = 0;
+  FILE           *fp;
+  
+  if (lines == NULL)
+    return message(a09,MSG_ERROR,"E0046: out of memory");
+    
+  for (size_t addr = 0 ; addr < 65536u ; addr++)
+  {
+    if (data->cover->file[addr] != NULL)
+    {
+      lines[num].file = data->cover->file[addr];
+      lines[num].line = data->cover->line[addr];
+      lines[num].addr = addr;
+      num++;
+    }
+  }
+  
+  qsort(lines,num,sizeof(struct covline),covlinecmp);
+  
+  fp = fopen(a09->covfile,"w");
+  if (fp == NULL)
+  {
+    free(lines);
+    return message(a09,MSG_ERROR,"E0070: %s: %s",a09->covfile,strerror(errno));
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; One record per source file.  A line's count is that of its busiest
+  ; instruction (there can be several from a macro).  Each conditional
+  ; branch has two outcomes, taken and not taken, each with a count.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t i = 0 ; i < num ; )
+  {
+    char const *file  = lines[i].file;
+    size_t      lf    = 0;
+    size_t      lh    = 0;
+    size_t      brf   = 0;
+    size_t      brh   = 0;
+    size_t      block = 0;
+    
+    fprintf(fp,"TN:\nSF:%s\n",file);
+    
+    while((i < num) && (strcmp(lines[i].file,file) == 0))
+    {
+      uint32_t line = lines[i].line;
+      uint32_t hit  = 0;
       
-      for (size_t i = 0 ; i < tmp.len ; i++)
+      for ( ; (i < num) && (strcmp(lines[i].file,file) == 0) && (lines[i].line == line) ; i++)
       {
-        switch(toupper(tmp.text[i]))
+        uint16_t addr = lines[i].addr;
+        uint32_t exec = data->cover->exec[addr];
+        
+        if (exec > hit)
+          hit = exec;
+        if (ft_isbranch(data,addr))
         {
-          case 'R': prot.read  = true; break;
-          case 'W': prot.write = true; break;
-          case 'X': prot.exec  = true; break;
-          case 'T': prot.tron  = true; break;
-          case 'N':                    break;
-          default: return message(opd->a09,MSG_ERROR,"E0084: undefined protection bit '%c'",c);
+          uint32_t taken    = data->cover->taken[addr];
+          uint32_t nottaken = data->cover->nottaken[addr];
+          
+          if (exec > 0)
+          {
+            fprintf(fp,"BRDA:%lu,%zu,0,%lu\n",(unsigned long)line,block,(unsigned long)taken);
+            fprintf(fp,"BRDA:%lu,%zu,1,%lu\n",(unsigned long)line,block,(unsigned long)nottaken);
+          }
+          else
+          {
+            fprintf(fp,"BRDA:%lu,%zu,0,-\n",(unsigned long)line,block);
+            fprintf(fp,"BRDA:%lu,%zu,1,-\n",(unsigned long)line,block);
+          }
+          
+          block++;
+          brf += 2;
+          brh += (taken > 0) + (nottaken > 0);
         }
       }
       
-      c = skip_space(opd->buffer);
-      if (c != ',')
-        return message(opd->a09,MSG_ERROR,"E0023: missing expected comma");
-        
-      if (!expr(&low,opd->a09,opd->buffer,opd->pass))
-        return false;
-      c = skip_space(opd->buffer);
-      if (isEOL(c))
-        high = low;
-      else if (c != ',')
-        return message(opd->a09,MSG_ERROR,"E0023: missing expected comma");
+      fprintf(fp,"DA:%lu,%lu\n",(unsigned long)line,(unsigned long)hit);
+      lf++;
+      lh += hit > 0;
+    }
+    
+    fprintf(fp,"BRF:%zu\nBRH:%zu\nLF:%zu\nLH:%zu\nend_of_record\n",brf,brh,lf,lh);
+  }
+  
+  fclose(fp);
+  free(lines);
+  return true;
+}
+
+/**************************************************************************/
+
+static int srclinecmp(void const *restrict needle,void const *restrict haystack)
+{
+  struct srcline const *key   = needle;
+  struct srcline const *value = haystack;
+  int                   rc    = strcmp(key->file,value->file);
+  
+  if (rc != 0)
+    return rc;
+  else if (key->line < value->line)
+    return -1;
+  else if (key->line > value->line)
+    return  1;
+  else
+    return  0;
+}
+
+/**************************************************************************/
+
+static void free_cache(struct cached *list,size_t num)
+{
+  for (size_t i = 0 ; i < num ; i++)
+  {
+    for (size_t j = 0 ; j < list[i].nlines ; j++)
+      free((char *)list[i].lines[j].file);
+    free(list[i].lines);
+    free(list[i].filename);
+    free(list[i].name);
+  }
+  free(list);
+}
+
+/**************************************************************************/
+
+static bool ft_cache_entry(
+        char           *line,
+        struct cached **plist,
+        size_t         *pnum,
+        bool           *pnomem
+)
+{
+  assert(line   != NULL);
+  assert(plist  != NULL);
+  assert(pnum   != NULL);
+  assert(pnomem != NULL);
+  
+  struct cached *list = *plist;
+  size_t         num  = *pnum;
+  char          *p;
+  char          *tab;
+  unsigned long  hash;
+  
+  *pnomem = false;
+  
+  if (((line[0] != 'T') && (line[0] != 'L')) || (line[1] != '\t'))
+    return false;
+    
+  hash = strtoul(&line[2],&p,16);
+  if (*p++ != '\t')
+    return false;
+    
+  if (line[0] == 'T')
+  {
+    struct cached *new;
+    
+    if ((tab = strchr(p,'\t')) == NULL)
+      return false;
+      
+    new = realloc(list,(num + 1) * sizeof(struct cached));
+    if (new == NULL)
+    {
+      *pnomem = true;
+      return false;
+    }
+      
+    new[num].filename = ft_strcopy(p,(size_t)(tab - p));
+    new[num].name     = ft_strcopy(tab + 1,strlen(tab + 1));
+    new[num].hash     = hash;
+    new[num].lines    = NULL;
+    new[num].nlines   = 0;
+    *plist            = new;
+    *pnum             = num + 1;
+    
+    if ((new[num].filename == NULL) || (new[num].name == NULL))
+    {
+      *pnomem = true;
+      return false;
+    }
+  }
+  else
+  {
+    struct cached  *test;
+    struct srcline *new;
+    size_t          lineno;
+    
+    if (num == 0)
+      return false;
+      
+    test   = &list[num - 1];
+    lineno = strtoul(p,&p,10);
+    if (*p++ != '\t')
+      return false;
+      
+    new = realloc(test->lines,(test->nlines + 1) * sizeof(struct srcline));
+    if (new == NULL)
+    {
+      *pnomem = true;
+      return false;
+    }
+      
+    test->lines                    = new;
+    test->lines[test->nlines].file = ft_strcopy(p,strlen(p));
+    test->lines[test->nlines].line = lineno;
+    test->lines[test->nlines].hash = hash;
+    if (test->lines[test->nlines++].file == NULL)
+    {
+      *pnomem = true;
+      return false;
+    }
+  }
+  
+  return true;
+}
+
+/**************************************************************************/
+
+static bool ft_read_cache(
+        struct a09     *a09,
+        FILE           *fp,
+        struct cached **plist,
+        size_t         *pnum
+)
+{
+  assert(a09   != NULL);
+  assert(fp    != NULL);
+  assert(plist != NULL);
+  assert(pnum  != NULL);
+  
+  struct cached *list = NULL;
+  size_t         num  = 0;
+  size_t         lnum = 0;
+  char           line[BUFSIZ];
+  
+  /*-----------------------------------------------------------------------
+  ; A test is "T<TAB>hash<TAB>filename<TAB>name", followed by the source
+  ; lines it touched, each "L<TAB>hash<TAB>line<TAB>filename".
+  ;------------------------------------------------------------------------*/
+  
+  while(fgets(line,sizeof(line),fp) != NULL)
+  {
+    bool nomem;
+    
+    lnum++;
+    line[strcspn(line,"\n")] = '\0';
+    if ((line[0] == '#') || (line[0] == '\0'))
+      continue;
+      
+    if (!ft_cache_entry(line,&list,&num,&nomem))
+    {
+      free_cache(list,num);
+      if (nomem)
+        return message(a09,MSG_ERROR,"E0046: out of memory");
       else
-      {
-        if (!expr(&high,opd->a09,opd->buffer,opd->pass))
-          return false;
-      }
+        return message(a09,MSG_ERROR,"E0119: %s:%zu: malformed cache entry",a09->impactfile,lnum);
+    }
+  }
+  
+  *plist = list;
+  *pnum  = num;
+  return true;
+}
+
+/**************************************************************************/
+
+static uint32_t ft_unit_hash(struct testdata *data,struct unittest *unit)
+{
+  assert(data         != NULL);
+  assert(data->impact != NULL);
+  assert(unit         != NULL);
+  
+  uint32_t hash = ft_hash(unit->hash,&data->impact->opthash,sizeof(data->impact->opthash));
+  
+  if (unit->fixture > 0)
+    hash = ft_hash(hash,&data->snapshots[unit->fixture - 1].hash,sizeof(uint32_t));
+  return hash;
+}
+
+/**************************************************************************/
+
+static struct cached *ft_check_cache(
+        struct testdata *data,
+        struct unittest *unit,
+        struct cached   *list,
+        size_t           num
+)
+{
+  assert(data         != NULL);
+  assert(data->impact != NULL);
+  assert(unit         != NULL);
+  
+  uint32_t hash = ft_unit_hash(data,unit);
+  
+  /*-----------------------------------------------------------------------
+  ; The test can be skipped if neither it nor any line it touched the last
+  ; time it passed has changed.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t i = 0 ; i < num ; i++)
+  {
+    if (
+            (strcmp(list[i].filename,unit->filename) != 0)
+         || (strcmp(list[i].name,unit->name.buf)     != 0)
+       )
+      continue;
       
-      message(opd->a09,MSG_DEBUG,
-        "LOW=%04X HIGH=%04X r=%s w=%s x=%s t=%s",
-        low.value,
-        high.value,
-        prot.read  ? "true " : "false",
-        prot.write ? "true " : "false",
-        prot.exec  ? "true " : "false",
-        prot.tron  ? "true " : "false"
-      );
+    if (list[i].hash != hash)
+      return NULL;
       
-      if (data->intest)
-      {
-        struct Assert *Assert = get_Assert(opd->a09,data,opd->a09->pc);
-        if (Assert == NULL)
-          return false;
-          
-        struct vmcode *new = new_program(Assert);
-        if (new == NULL)
-          return false;
-          
-        assert(sizeof(struct memprot) <= sizeof(enum vmops));
-        
-        new->prog[0]                   = VM_LIT;
-        memcpy(&new->prog[1],&prot,sizeof(prot));
-        new->prog[2]                   = VM_LIT;
-        new->prog[3]                   = high.value;
-        new->prog[4]                   = VM_LIT;
-        new->prog[5]                   = low.value;
-        new->prog[6]                   = VM_PROT;
-        new->prog[7]                   = VM_TRUE;
-        new->prog[8]                   = VM_EXIT;
-        data->prot[opd->a09->pc].check = true;
-      }
-      else
-      {
-        for (size_t a = low.value ; a <= high.value ; a++)
-          data->prot[a] = prot;
-      }
+    for (size_t j = 0 ; j < list[i].nlines ; j++)
+    {
+      struct srcline *now = bsearch(
+                                     &list[i].lines[j],
+                                     data->impact->sorted,
+                                     data->impact->nlines,
+                                     sizeof(struct srcline),
+                                     srclinecmp
+                                   );
+      if ((now == NULL) || (now->hash != list[i].lines[j].hash))
+        return NULL;
     }
     
-    else if ((tmp.len == 5) && (memcmp(tmp.text,"POKEW",5) == 0))
+    return &list[i];
+  }
+  
+  return NULL;
+}
+
+/**************************************************************************/
+
+static bool ft_impact_record(struct a09 *a09,struct testdata *data,struct unittest *unit)
+{
+  assert(a09          != NULL);
+  assert(data         != NULL);
+  assert(data->impact != NULL);
+  assert(unit         != NULL);
+  
+  struct impact *impact = data->impact;
+  uint8_t       *seen   = calloc(impact->nlines + 1,1);
+  
+  if (seen == NULL)
+    return message(a09,MSG_ERROR,"E0046: out of memory");
+    
+  for (size_t addr = 0 ; addr < 65536u ; addr++)
+  {
+    if ((impact->touched[addr / CHAR_BIT] & (1u << (addr % CHAR_BIT))) && (impact->lineidx[addr] > 0))
     {
-      struct value addr;
-      struct value word;
+      size_t idx = impact->lineidx[addr];
       
-      if (!expr(&addr,opd->a09,opd->buffer,opd->pass))
-        return false;
-      c = skip_space(opd->buffer);
-      if (c != ',')
-        return message(opd->a09,MSG_ERROR,"E0023: missing expected comma");
-      if (!expr(&word,opd->a09,opd->buffer,opd->pass))
-        return false;
-        
-      if (data->intest)
+      if (!seen[idx])
       {
-        struct Assert *Assert = get_Assert(opd->a09,data,opd->a09->pc);
-        if (Assert == NULL)
-          return false;
-          
-        struct vmcode *new = new_program(Assert);
+        size_t *new = realloc(unit->lines,(unit->nlines + 1) * sizeof(size_t));
         if (new == NULL)
-          return false;
-          
-        new->prog[0]                   = VM_LIT;
-        new->prog[1]                   = word.value;
-        new->prog[2]                   = VM_LIT;
-        new->prog[3]                   = addr.value;
-        new->prog[4]                   = VM_TO16;
-        new->prog[5]                   = VM_TRUE;
-        new->prog[6]                   = VM_EXIT;
-        data->prot[opd->a09->pc].check = true;
-      }
-      else
-      {
-        data->memory[addr.value]     = word.value >> 8;
-        data->memory[addr.value + 1] = word.value & 255;
+        {
+          free(seen);
+          return message(a09,MSG_ERROR,"E0046: out of memory");
+        }
+        
+        seen[idx]                   = true;
+        unit->lines                 = new;
+        unit->lines[unit->nlines++] = idx - 1;
       }
     }
+  }
+  
+  free(seen);
+  return true;
+}
+
+/**************************************************************************/
+
+static bool ft_write_cache(struct a09 *a09,struct testdata *data)
+{
+  assert(a09              != NULL);
+  assert(data             != NULL);
+  assert(data->impact     != NULL);
+  assert(a09->impactfile  != NULL);
+  
+  FILE *fp = fopen(a09->impactfile,"w");
+  
+  if (fp == NULL)
+    return message(a09,MSG_ERROR,"E0070: %s: %s",a09->impactfile,strerror(errno));
     
-    else if ((tmp.len == 4) && (memcmp(tmp.text,"POKE",4) == 0))
-    {
-      struct value addr;
-      struct value byte;
+  fprintf(fp,"# test impact cache---T hash file name, then L hash line file\n");
+  
+  for (size_t i = 0 ; i < data->nunits ; i++)
+  {
+    struct unittest *unit = &data->units[i];
+    
+    if (unit->setup)
+      continue;
       
-      if (!expr(&addr,opd->a09,opd->buffer,opd->pass))
-        return false;
-      c = skip_space(opd->buffer);
-      if (c != ',')
-        return message(opd->a09,MSG_ERROR,"E0023: missing expected comma");
-      if (!expr(&byte,opd->a09,opd->buffer,opd->pass))
-        return false;
-        
-      if (data->intest)
+    if (unit->cache != NULL)
+    {
+      fprintf(fp,"T\t%08lX\t%s\t%s\n",(unsigned long)unit->cache->hash,unit->filename,unit->name.buf);
+      for (size_t j = 0 ; j < unit->cache->nlines ; j++)
+        fprintf(
+                 fp,
+                 "L\t%08lX\t%zu\t%s\n",
+                 (unsigned long)unit->cache->lines[j].hash,
+                 unit->cache->lines[j].line,
+                 unit->cache->lines[j].file
+               );
+    }
+    else if (unit->passed)
+    {
+      fprintf(fp,"T\t%08lX\t%s\t%s\n",(unsigned long)ft_unit_hash(data,unit),unit->filename,unit->name.buf);
+      for (size_t j = 0 ; j < unit->nlines ; j++)
       {
-        struct Assert *Assert = get_Assert(opd->a09,data,opd->a09->pc);
-        if (Assert == NULL)
-          return false;
-          
-        struct vmcode *new = new_program(Assert);
-        if (new == NULL)
-          return false;
-          
-        new->prog[0]                   = VM_LIT;
-        new->prog[1]                   = byte.value;
-        new->prog[2]                   = VM_LIT;
-        new->prog[3]                   = addr.value;
-        new->prog[4]                   = VM_TO8;
-        new->prog[5]                   = VM_TRUE;
-        new->prog[6]                   = VM_EXIT;
-        data->prot[opd->a09->pc].check = true;
+        struct srcline *line = &data->impact->lines[unit->lines[j]];
+        fprintf(fp,"L\t%08lX\t%zu\t%s\n",(unsigned long)line->hash,line->line,line->file);
       }
-      else
-        data->memory[addr.value] = byte.value & 255;
     }
-    
-    else if ((tmp.len == 5) && (memcmp(tmp.text,"STACK",5) == 0))
-    {
-      struct value sp;
-      
-      if (!expr(&sp,opd->a09,opd->buffer,opd->pass))
-        return false;
-        
-      if (data->intest)
-        message(opd->a09,MSG_WARNING,"W0017: cannot assign the stack address within .TEST directive");
+  }
+  
+  fclose(fp);
+  return true;
+}
+
+/**************************************************************************/
+
+static void ft_check_baseline(
+        struct a09      *a09,
+        struct unittest *unit,
+        struct baseline *list,
+        size_t           num
+)
+{
+  assert(a09  != NULL);
+  assert(unit != NULL);
+  
+  struct baseline *base;
+  struct baseline  key;
+  char             name[sizeof(unit->name.buf) + 1];
+  double           delta;
+  
+  memcpy(name,unit->name.buf,unit->name.widx);
+  name[unit->name.widx] = '\0';
+  key.filename          = (char *)unit->filename;
+  key.name              = name;
+  key.line              = unit->line;
+  base                  = num > 0
+                        ? bsearch(&key,list,num,sizeof(struct baseline),baselinecmp)
+                        : NULL
+                        ;
+  
+  if (base == NULL)
+  {
+    if (a09->tapout)
+      printf("# %s: no baseline\n",name);
+    return;
+  }
+  
+  delta = base->cycles == 0
+        ? 0.0
+        : 100.0 * ((double)unit->cycles - (double)base->cycles) / (double)base->cycles
+        ;
         
-      data->sp = sp.value;
-    }
+  if (a09->tapout)
+  {
+    printf(
+            "# %s: cycles=%lu baseline=%lu (%+.1f%%) instructions=%lu baseline=%lu\n",
+            name,
+            unit->cycles,
+            base->cycles,
+            delta,
+            unit->icount,
+            base->icount
+          );
+  }
+  
+  a09->lnum = unit->line;
+  if (delta > (double)a09->regress)
+    message(a09,MSG_WARNING,"W0029: %s: cycles increased from %lu to %lu (%+.1f%%)",name,base->cycles,unit->cycles,delta);
+}
+
+/**************************************************************************/
+
+static void ft_fault(struct a09 *a09,struct testdata *data,char const *tag,int rc)
+{
+  assert(a09  != NULL);
+  assert(data != NULL);
+  assert(tag  != NULL);
+  assert(rc   >  0);
+  assert(rc   <  TEST_max);
+  
+  static char const *const mfaults[] =
+  {
+    NULL,
+    "an internal error inside the MC6809 emulator",
+    "an illegal instruction was encountered",
+    "an illegal addressing mode was encountered",
+    "an undefined combination of registers was being exchanged",
+    "an undefined combination of registers was being transfered",
+    "test failed",
+    "reading from non-readable memory",
+    "code went into the weeds",
+    "writing to non-writable memory",
+    "executing non-code",
+    "execution limit exceeded",
+    "test setup failed",
+  };
+  
+  message(a09,MSG_WARNING,"W0015: %s: %s: %s",tag,mfaults[rc],data->errbuf);
+  data->errbuf[0] = '\0';
+}
+
+/**************************************************************************/
+
+static int ft_stub(struct testdata *data,struct stub const *stub)
+{
+  assert(data != NULL);
+  assert(stub != NULL);
+  
+  /*-----------------------------------------------------------------------
+  ; Do what the stubbed routine would have done, then emulate the RTS.
+  ;------------------------------------------------------------------------*/
+  
+  if ((stub->output != '\0') && (data->outlen < sizeof(data->output)))
+    data->output[data->outlen++] = stub->output == 'A' ? data->cpu.A : data->cpu.B;
+    
+  if (stub->set & (1u << STUB_D))  data->cpu.d.w = stub->value[STUB_D];
+  if (stub->set & (1u << STUB_A))  data->cpu.A   = stub->value[STUB_A];
+  if (stub->set & (1u << STUB_B))  data->cpu.B   = stub->value[STUB_B];
+  if (stub->set & (1u << STUB_X))  data->cpu.X.w = stub->value[STUB_X];
+  if (stub->set & (1u << STUB_Y))  data->cpu.Y.w = stub->value[STUB_Y];
+  if (stub->set & (1u << STUB_U))  data->cpu.U.w = stub->value[STUB_U];
+  if (stub->set & (1u << STUB_DP)) data->cpu.dp  = stub->value[STUB_DP];
+  if (stub->set & (1u << STUB_CC)) mc6809_bytetocc(&data->cpu,stub->value[STUB_CC]);
+  
+  data->cpu.pc.b[MSB]  = data->memory[data->cpu.S.w++];
+  data->cpu.pc.b[LSB]  = data->memory[data->cpu.S.w++];
+  data->cpu.cycles    += stub->cycles;
+  return 0;
+}
+
+/**************************************************************************/
+
+static void ft_output(struct testdata *data)
+{
+  assert(data != NULL);
+  
+  printf("# output: \"");
+  for (size_t i = 0 ; i < data->outlen ; i++)
+  {
+    unsigned char c = data->output[i];
     
-    else if ((tmp.len == 9) && (memcmp(tmp.text,"STACKSIZE",9) == 0))
+    if ((c == '"') || (c == '\\'))
+      printf("\\%c",c);
+    else if (isprint(c))
+      putchar(c);
+    else
+      printf("\\x%02X",c);
+  }
+  printf("\"%s\n",data->outlen == sizeof(data->output) ? " (truncated)" : "");
+}
+
+/**************************************************************************/
+
+static int ft_int_step(struct testdata *data)
+{
+  assert(data != NULL);
+  
+  static uint16_t const vectors[INT_max] =
+  {
+    MC6809_VECTOR_IRQ,
+    MC6809_VECTOR_FIRQ,
+    MC6809_VECTOR_NMI,
+  };
+  
+  unsigned long now = data->basecycles + data->cpu.cycles;
+  uint16_t      sp  = data->cpu.S.w;
+  int           rc;
+  
+  /*-----------------------------------------------------------------------
+  ; Assert any interrupt that is due.  The line is held until the CPU takes
+  ; the interrupt, and a source isn't raised again while its handler runs.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t i = 0 ; i < INT_max ; i++)
+  {
+    struct intstate *is = &data->ints[i];
+    
+    if (!is->pending && !is->inhandler && (now >= is->next))
     {
-      struct value size;
+      is->pending  = true;
+      is->asserted = now;
       
-      if (!expr(&size,opd->a09,opd->buffer,opd->pass))
-        return false;
-        
-      if (data->intest)
-        message(opd->a09,MSG_WARNING,"W0018: cannot assign the stack size within .TEST directive");
-        
-      if ((size.value < 2) || (size.value > 4096))
-        return message(opd->a09,MSG_ERROR,"E0088: stack size must be between 2 and 4096");
+      if (is->every > 0)
+        while(is->next <= now)
+          is->next += is->every;
+      else
+        is->next = ULONG_MAX;
         
-      data->stacksize = size.value;
+      switch(i)
+      {
+        case INT_IRQ:  data->cpu.irq  = true; break;
+        case INT_FIRQ: data->cpu.firq = true; break;
+        case INT_NMI:  data->cpu.nmi  = true; data->cpu.nmi_armed = true; break;
+      }
     }
+  }
+  
+  rc  = mc6809_step(&data->cpu);
+  now = data->basecycles + data->cpu.cycles;
+  
+  /*-----------------------------------------------------------------------
+  ; The handler has returned once the stack is back to where it was when
+  ; the interrupt was taken.  The interrupt was taken if we're now at the
+  ; start of the handler with more on the stack than before.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t i = 0 ; i < INT_max ; i++)
+  {
+    struct intstate *is = &data->ints[i];
     
-    else if ((tmp.len == 9) && (memcmp(tmp.text,"RANDOMIZE",9) == 0))
+    if (is->inhandler && (data->cpu.S.w == is->rets))
     {
-      if (data->intest)
-        return message(opd->a09,MSG_ERROR,"E0089: can only set outside a .TEST directive");
-      opd->a09->rndtests = true;
+      if (now - is->entered > is->cost)
+        is->cost = now - is->entered;
+      is->inhandler = false;
     }
-    
-    else if ((tmp.len == 3) && (memcmp(tmp.text,"ORG",3) == 0))
+    else if (
+                 is->pending
+              && (data->cpu.S.w < sp)
+              && (data->cpu.pc.w == ((data->memory[vectors[i]] << 8) | data->memory[vectors[i] + 1]))
+            )
     {
-      struct value addr;
+      if (now - is->asserted > is->latency)
+        is->latency = now - is->asserted;
+      is->pending   = false;
+      is->inhandler = true;
+      is->entered   = now;
+      is->rets      = sp;
+      is->taken++;
       
-      if (!expr(&addr,opd->a09,opd->buffer,opd->pass))
-        return false;
-        
-      if (data->intest)
-        return message(opd->a09,MSG_ERROR,"E0100: Can only assign test code outside a .TEST directive");
-        
-      data->inittestpc = addr.value;
-      data->testpc     = addr.value;
-      message(opd->a09,MSG_DEBUG,"testloadpc=%04X",data->testpc);
+      switch(i)
+      {
+        case INT_IRQ:  data->cpu.irq  = false; break;
+        case INT_FIRQ: data->cpu.firq = false; break;
+        case INT_NMI:  data->cpu.nmi  = false; break;
+      }
     }
+  }
+  
+  return rc;
+}
+
+/**************************************************************************/
+
+static bool ft_is_call(mc6809byte__t op)
+{
+  return (op == 0x8D)  /* BSR  */
+      || (op == 0x17)  /* LBSR */
+      || (op == 0x9D)  /* JSR direct   */
+      || (op == 0xAD)  /* JSR indexed  */
+      || (op == 0xBD); /* JSR extended */
+}
+
+/**************************************************************************/
+
+static void ft_stack_frames(struct testdata *data,bool called,uint16_t s)
+{
+  assert(data != NULL);
+  
+  /*-----------------------------------------------------------------------
+  ; Stack use is charged to each subroutine active at the time, measured
+  ; from S before it was called, so a subroutine's use includes what it
+  ; calls but not what its callers used.  A frame ends once S is back to
+  ; where it was before the call, however that happens.
+  ;------------------------------------------------------------------------*/
+  
+  if (called && (data->nframes < MAX_FRAME))
+  {
+    data->frames[data->nframes].entry = data->cpu.pc.w;
+    data->frames[data->nframes].base  = s;
+    data->frames[data->nframes].min   = data->cpu.S.w;
+    data->nframes++;
+  }
+  
+  if ((data->nframes > 0) && (data->cpu.S.w < data->frames[data->nframes - 1].min))
+    data->frames[data->nframes - 1].min = data->cpu.S.w;
     
-    else if ((tmp.len == 5) && (memcmp(tmp.text,"DEBUG",5) == 0))
-      return message(opd->a09,MSG_DEBUG,"OPT TEST DEBUG");
+  while((data->nframes > 0) && (data->cpu.S.w >= data->frames[data->nframes - 1].base))
+  {
+    struct sframe *frame = &data->frames[--data->nframes];
+    uint16_t       used  = frame->base - frame->min;
+    size_t         i;
+    
+    if ((data->nframes > 0) && (frame->min < data->frames[data->nframes - 1].min))
+      data->frames[data->nframes - 1].min = frame->min;
       
-    else if ((tmp.len == 4) && (memcmp(tmp.text,"TRON",4) == 0))
+    for (i = 0 ; i < data->nsubs ; i++)
+      if (data->subs[i].entry == frame->entry)
+        break;
+        
+    if (i == data->nsubs)
     {
-      if (!data->intest)
-        return message(opd->a09,MSG_WARNING,"W0023: cannot set TRON outside a .TEST directive");
-      assert(data->nunits > 0);
-      data->units[data->nunits-1].tron = true;
+      if (data->nsubs == MAX_SUBS)
+        continue;
+      data->subs[data->nsubs].entry = frame->entry;
+      data->subs[data->nsubs].used  = 0;
+      data->nsubs++;
     }
     
-    else
-      return message(opd->a09,MSG_ERROR,"E0087: option '%.*s' not supported",tmp.len,tmp.text);
+    if (used > data->subs[i].used)
+      data->subs[i].used = used;
   }
+}
+
+/**************************************************************************/
+
+static int subusecmp(void const *restrict needle,void const *restrict haystack)
+{
+  struct subuse const *l = needle;
+  struct subuse const *r = haystack;
   
-  return true;
+  if (l->used > r->used)
+    return -1;
+  else if (l->used < r->used)
+    return 1;
+  else if (l->entry < r->entry)
+    return -1;
+  else if (l->entry > r->entry)
+    return 1;
+  else
+    return 0;
 }
 
 /**************************************************************************/
 
-static bool ftest_align(struct format *fmt,struct opcdata *opd)
+static void ft_stack_report(struct a09 *a09,struct testdata *data)
 {
-  assert(fmt             != NULL);
-  assert(opd             != NULL);
-  assert(opd->a09        != NULL);
-  assert(opd->a09->tests != NULL);
-  assert(opd->a09->runtests);
-  assert((opd->pass == 1) || (opd->pass == 2));
+  assert(a09  != NULL);
+  assert(data != NULL);
   
-  struct testdata *data = opd->a09->tests;
+  struct symbol *sym;
   
-  if (opd->pass == 2)
-    data->addr += opd->datasz;
-    
-  if (!data->intest)
-    return opd->a09->tests->fmtalign(fmt,opd);
+  if (data->symbols == NULL)
+    data->symbols = symbol_addrtable(a09,&data->nsymbols);
+  sym = symbol_nearest(data->symbols,data->nsymbols,data->sminpc);
+  
+  printf("# stack: S used %u bytes",(unsigned)(data->sp - data->smin));
+  if (sym != NULL)
+    printf(" (deepest at %.*s+%u)",sym->name.len,sym->name.text,(unsigned)(data->sminpc - sym->value));
   else
-    return true;
+    printf(" (deepest at %04X)",data->sminpc);
+  if (data->upushed)
+    printf(", U used %u bytes",(unsigned)(data->ubase - data->umin));
+  putchar('\n');
+  
+  qsort(data->subs,data->nsubs,sizeof(struct subuse),subusecmp);
+  for (size_t i = 0 ; i < data->nsubs ; i++)
+  {
+    sym = symbol_nearest(data->symbols,data->nsymbols,data->subs[i].entry);
+    if ((sym != NULL) && (sym->value == data->subs[i].entry))
+      printf("# stack: %.*s used %u bytes\n",sym->name.len,sym->name.text,data->subs[i].used);
+    else
+      printf("# stack: %04X used %u bytes\n",data->subs[i].entry,data->subs[i].used);
+  }
 }
 
 /**************************************************************************/
 
-static bool ftest_org(struct format *fmt,struct opcdata *opd)
+static void ft_dev_report(struct testdata *data)
 {
-  (void)fmt;
-  assert(opd             != NULL);
-  assert(opd->a09        != NULL);
-  assert(opd->a09->tests != NULL);
-  assert(opd->a09->runtests);
-  assert((opd->pass == 1) || (opd->pass == 2));
-  
-  struct testdata *data = opd->a09->tests;
+  assert(data != NULL);
   
-  if (opd->pass == 2)
-    data->addr = opd->value.value;
+  for (size_t i = 0 ; i < data->ndevices ; i++)
+  {
+    struct device *dev = &data->devices[i];
     
-  if (!data->intest)
-    return opd->a09->tests->fmtorg(fmt,opd);
-  else
+    if ((dev->kind == DEV_TIMER) || (dev->writes == 0))
+      continue;
+      
+    printf(
+            "# %s $%04X: %lu %s, %.1f cycles each",
+            dev->kind == DEV_PIA ? "PIA" : "SERIAL",
+            dev->addr,
+            dev->writes,
+            dev->kind == DEV_PIA ? "writes" : "bytes",
+            dev->writes > 1 ? (double)(dev->last - dev->first) / (double)(dev->writes - 1) : 0.0
+          );
+    if (dev->kind == DEV_SERIAL)
+      printf(", %lu overruns",dev->overruns);
+    putchar('\n');
+  }
+}
+
+/**************************************************************************/
+
+static void ft_int_report(struct testdata *data)
+{
+  assert(data != NULL);
+  
+  static char const *const names[INT_max] = { "IRQ" , "FIRQ" , "NMI" };
+  
+  for (size_t i = 0 ; i < INT_max ; i++)
+    if (data->ints[i].taken > 0)
+      printf(
+              "# %s: taken=%zu latency=%lu handler=%lu\n",
+              names[i],
+              data->ints[i].taken,
+              data->ints[i].latency,
+              data->ints[i].cost
+            );
+}
+
+/**************************************************************************/
+
+static void ft_cover(struct testdata *data,uint16_t pc)
+{
+  assert(data        != NULL);
+  assert(data->cover != NULL);
+  
+  uint8_t  op  = data->memory[pc];
+  uint16_t len = 2;
+  
+  data->cover->exec[pc]++;
+  
+  /*-----------------------------------------------------------------------
+  ; Conditional branches are $22 to $2F, or the same on page 2 for the long
+  ; versions.  If the PC isn't at the next instruction, it was taken.
+  ;------------------------------------------------------------------------*/
+  
+  if (op == 0x10)
   {
-    opd->a09->pc = opd->value.value;
-    return true;
+    op  = data->memory[(uint16_t)(pc + 1)];
+    len = 4;
+  }
+  
+  if ((op >= 0x22) && (op <= 0x2F))
+  {
+    if (data->cpu.pc.w == (uint16_t)(pc + len))
+      data->cover->nottaken[pc]++;
+    else
+      data->cover->taken[pc]++;
   }
 }
 
 /**************************************************************************/
 
-static bool ftest_rmb(struct format *fmt,struct opcdata *opd)
+static int ft_run_unit(
+        struct a09       *a09,
+        struct testdata  *data,
+        struct unittest  *unit,
+        char const      **ptag
+)
 {
-  assert(fmt             != NULL);
-  assert(opd             != NULL);
-  assert(opd->a09        != NULL);
-  assert(opd->a09->tests != NULL);
-  assert(opd->a09->runtests);
-  assert((opd->pass == 1) || (opd->pass == 2));
+  assert(a09  != NULL);
+  assert(data != NULL);
+  assert(unit != NULL);
+  assert(ptag != NULL);
   
-  struct testdata *data = opd->a09->tests;
+  bool ints = false;
+  int  rc;
   
-  if (opd->pass == 2)
+  a09->infile = unit->filename;
+  for (size_t j = 0 ; j < data->stacksize ; j++)
   {
-    if (opd->value.value == 0)
-      return message(opd->a09,MSG_ERROR,"E0099: Can't reserve 0 bytes of memory");
+    data->prot[data->sp - j].read  = true;
+    data->prot[data->sp - j].write = true;
+  }
+  
+  data->cpu.pc.w   = unit->addr;
+  data->cpu.S.w    = data->sp - 2;
+  data->smin       = data->cpu.S.w;
+  data->sminpc     = unit->addr;
+  data->upushed    = false;
+  data->nframes    = 0;
+  data->nsubs      = 0;
+  data->cpu.dp     = a09->dp;
+  data->cpu.cycles = 0;
+  data->icount     = 0;
+  data->basecycles = 0;
+  data->baseicount = 0;
+  data->tracenext  = 0;
+  data->tracecnt   = 0;
+  data->outlen     = 0;
+  data->cpu.irq    = false;
+  data->cpu.firq   = false;
+  data->cpu.nmi    = false;
+  
+  /*-----------------------------------------------------------------------
+  ; Devices start each test freshly reset.  They're mapped in here, after
+  ; any PROT directives have been applied.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t i = 0 ; i < data->ndevices ; i++)
+  {
+    struct device *dev = &data->devices[i];
+    
+    dev->base     = 0;
+    dev->busy     = 0;
+    dev->writes   = 0;
+    dev->first    = 0;
+    dev->last     = 0;
+    dev->overruns = 0;
+    dev->latch    = 0;
+    memset(dev->ddr, 0,sizeof(dev->ddr));
+    memset(dev->ctl, 0,sizeof(dev->ctl));
+    memset(dev->port,0,sizeof(dev->port));
+    
+    for (size_t a = dev->addr ; a < (size_t)dev->addr + dev->size ; a++)
+    {
+      data->prot[a].read   = true;
+      data->prot[a].write  = true;
+      data->prot[a].device = true;
+    }
+  }
+  
+  for (size_t i = 0 ; i < INT_max ; i++)
+  {
+    memset(&data->ints[i],0,sizeof(data->ints[i]));
+    data->ints[i].next  = unit->ints[i].on ? unit->ints[i].at : ULONG_MAX;
+    data->ints[i].every = unit->ints[i].every;
+    ints               |= unit->ints[i].on;
+  }
+  
+  if ((unit->maxinst > 0) || (unit->maxcycles > 0))
+    memset(data->hot,0,sizeof(data->hot));
+  if (data->impact != NULL)
+    memset(data->impact->touched,0,sizeof(data->impact->touched));
+    
+  /*----------------------------------------------------
+  ; initialize other registers with semi-random data
+  ;-----------------------------------------------------*/
+  
+  data->cpu.U.w  = data->cpu.pc.w ^ data->cpu.S.w;
+  data->cpu.Y.w  = data->cpu.U.w;
+  data->cpu.X.w  = data->cpu.Y.w;
+  data->cpu.d.w  = data->cpu.X.w;
+  a09->lnum      = unit->line;
+  
+  /*-----------------------------------------------------------------------
+  ; A test using a fixture starts with the memory and registers as they
+  ; were when the fixture finished.
+  ;------------------------------------------------------------------------*/
+  
+  if ((unit->fixture > 0) && !unit->setup)
+  {
+    struct snapshot *snap = &data->snapshots[unit->fixture - 1];
+    
+    memcpy(data->memory,snap->memory,sizeof(data->memory));
+    if (data->impact != NULL)
+      memcpy(data->impact->touched,snap->touched,sizeof(snap->touched));
+    data->cpu.X.w = snap->cpu.X.w;
+    data->cpu.Y.w = snap->cpu.Y.w;
+    data->cpu.U.w = snap->cpu.U.w;
+    data->cpu.d.w = snap->cpu.d.w;
+    data->cpu.dp  = snap->cpu.dp;
+    data->cpu.cc  = snap->cpu.cc;
+  }
+  
+  message(a09,MSG_DEBUG,"Running test %s",unit->name.buf);
+  
+  do
+  {
+    struct stub *stub = NULL;
+    bool         pshu = data->memory[data->cpu.pc.w] == 0x36;
+    bool         call = ft_is_call(data->memory[data->cpu.pc.w]);
+    uint16_t     s    = data->cpu.S.w;
+    uint16_t     u    = data->cpu.U.w;
+    uint16_t     ipc  = data->cpu.pc.w;
+    
+    if (data->nstubs > 0)
+      stub = bsearch(&data->cpu.pc.w,data->stubs,data->nstubs,sizeof(struct stub),stubcmp);
       
-    for (size_t i = 0 ; i < opd->value.value ; i++)
+    if (data->trace != NULL)
+    {
+      struct tracerec *rec = &data->trace[data->tracenext];
+      
+      rec->cycles = data->basecycles + data->cpu.cycles;
+      rec->pc     = data->cpu.pc.w;
+      rec->X      = data->cpu.X.w;
+      rec->Y      = data->cpu.Y.w;
+      rec->U      = data->cpu.U.w;
+      rec->S      = data->cpu.S.w;
+      rec->d      = data->cpu.d.w;
+      rec->dp     = data->cpu.dp;
+      rec->cc     = mc6809_cctobyte(&data->cpu);
+      rec->traced = unit->tron || data->prot[data->cpu.pc.w].tron;
+      
+      for (size_t j = 0 ; j < sizeof(rec->bytes) ; j++)
+        rec->bytes[j] = data->memory[(uint16_t)(rec->pc + j)];
+        
+      if (++data->tracenext == data->tracesize)
+        data->tracenext = 0;
+      data->tracecnt++;
+    }
+    
+    if ((stub == NULL) && (data->memory[data->cpu.pc.w] == data->fill))
+    {
+      snprintf(data->errbuf,sizeof(data->errbuf),"PC=%04X",data->cpu.pc.w);
+      rc = TEST_WEEDS;
+      break;
+    }
+    
+    if ((data->trace == NULL) && (unit->tron || data->prot[data->cpu.pc.w].tron))
+    {
+      char inst[128];
+      char regs[128];
+      
+      data->dis.pc = data->cpu.pc.w;
+      rc = mc6809dis_step(&data->dis,&data->cpu);
+      if (rc != 0)
+        break;
+      mc6809dis_format(&data->dis,inst,sizeof(inst));
+      mc6809dis_registers(&data->cpu,regs,sizeof(regs));
+      if (a09->tapout)
+        printf("# ");
+      printf("%s | %s\n",regs,inst);
+    }
+    
+    if (data->prot[data->cpu.pc.w].check)
+    {
+      bool     okay = false;
+      uint16_t addr = data->cpu.pc.w;
+      tree__s *tree = tree_find(data->Asserts,&addr,Assertaddrcmp);
+      
+      if (tree != NULL)
+      {
+        struct Assert *Assert = tree2Assert(tree);
+        
+        assert(Assert->here == addr);
+        for (size_t j = 0 ; j < Assert->cnt ; j++)
+        {
+          message(a09,MSG_DEBUG,"checking %s",Assert->Asserts[j].tag);
+          okay = runvm(data->a09,&data->cpu,&Assert->Asserts[j]);
+          if (!okay)
+          {
+            *ptag = Assert->Asserts[j].tag;
+            break;
+          }
+        }
+      }
+      
+      if (!okay)
+      {
+        rc = TEST_FAILED;
+        break;
+      }
+    }
+    
+    /*-----------------------------------------------------------------
+    ; The watchdog.  Sample the PC every so often so that if the limit is
+    ; hit, we can report where the code was spending its time.
+    ;------------------------------------------------------------------*/
+    
+    if ((unit->maxinst > 0) || (unit->maxcycles > 0))
+    {
+      if ((data->icount % HOT_RATE) == 0)
+        data->hot[data->cpu.pc.w / HOT_RANGE]++;
+        
+      if (
+              ((unit->maxinst   > 0) && (data->baseicount + data->icount     >= unit->maxinst))
+           || ((unit->maxcycles > 0) && (data->basecycles + data->cpu.cycles >= unit->maxcycles))
+         )
+      {
+        ft_hot_range(a09,data);
+        rc = TEST_LIMIT;
+        break;
+      }
+    }
+    
+    data->icount++;
+    if (stub != NULL)
+      rc = ft_stub(data,stub);
+    else if (ints)
+      rc = ft_int_step(data);
+    else
+      rc = mc6809_step(&data->cpu);
+      
+    if ((data->cover != NULL) && (stub == NULL) && (rc == 0) && (data->cpu.instpc == ipc))
+      ft_cover(data,ipc);
+      
+    /*-----------------------------------------------------------------
+    ; Stack high-water marks.  The runner sets S, so its use is measured
+    ; from the top of the test stack.  U is only known to be a stack once
+    ; it's pushed on, so its use is measured from there.
+    ;------------------------------------------------------------------*/
+    
+    if (data->cpu.S.w < data->smin)
     {
-      data->prot[data->addr + i].read  = true;
-      data->prot[data->addr + i].write = true;
+      data->smin   = data->cpu.S.w;
+      data->sminpc = data->cpu.instpc;
     }
     
-    data->addr += opd->value.value;
+    if (pshu && !data->upushed)
+    {
+      data->upushed = true;
+      data->ubase   = u;
+      data->umin    = u;
+    }
+    if (data->upushed && (data->cpu.U.w < data->umin))
+      data->umin = data->cpu.U.w;
+      
+    if (rc == 0)
+      ft_stack_frames(data,call && !ints && (stub == NULL) && (data->cpu.S.w == (uint16_t)(s - 2)),s);
   }
+  while((rc == 0) && (data->cpu.S.w != data->sp));
   
-  if (!data->intest)
-    return opd->a09->tests->fmtrmb(fmt,opd);
-  else
-    return true;
+  unit->cycles = data->basecycles + data->cpu.cycles;
+  unit->icount = data->baseicount + data->icount;
+  unit->passed = rc == 0;
+  return rc;
 }
 
 /**************************************************************************/
 
-static bool ftest__test(struct format *fmt,struct opcdata *opd)
+static bool ft_selmatch(struct testsel const *sel,struct unittest const *unit,size_t num)
 {
-  (void)fmt;
-  assert(opd             != NULL);
-  assert(opd->a09->tests != NULL);
-  assert(opd->a09->runtests);
-  assert((opd->pass == 1) || (opd->pass == 2));
+  assert(sel  != NULL);
+  assert(unit != NULL);
   
-  struct testdata *data = opd->a09->tests;
+  switch(sel->kind)
+  {
+    case SEL_INDEX:
+         return (sel->low <= num) && (num <= sel->high);
+         
+    case SEL_NAME:
+         return fnmatch(sel->pattern,unit->name.buf,0) == 0;
+         
+    case SEL_FILE:
+         return (sel->low <= unit->line)
+             && (unit->line <= sel->high)
+             && (fnmatch(sel->pattern,unit->filename,0) == 0);
+  }
   
-  if (data->intest)
-    return message(opd->a09,MSG_ERROR,"E0078: cannot nest .TEST");
-    
-  data->intest     = true;
-  data->resumepc   = opd->a09->pc;
-  opd->value.value = data->testpc;
+  assert(0);
+  return false;
+}
+
+/**************************************************************************/
+
+static bool ft_selected(struct a09 const *a09,struct unittest const *unit,size_t num)
+{
+  assert(a09  != NULL);
+  assert(unit != NULL);
   
-  if (!ftest_org(fmt,opd))
-    return false;
-    
-  message(opd->a09,MSG_DEBUG,"test resume=%04X new=%04X",data->resumepc,data->testpc);
+  /*-----------------------------------------------------------------------
+  ; With no -y given, every test is included.  An exclusion always wins.
+  ;------------------------------------------------------------------------*/
   
-  if (opd->pass == 2)
+  bool include = false;
+  
+  for (size_t i = 0 ; i < a09->nselects ; i++)
   {
-    char c;
-    
-    struct unittest *new = realloc(data->units,(data->nunits + 1) * sizeof(struct unittest));
-    if (new == NULL)
-      return message(opd->a09,MSG_ERROR,"E0046: out of memory");
-    data->units                         = new;
-    data->units[data->nunits].addr      = opd->a09->pc;
-    data->units[data->nunits].filename  = opd->a09->infile;
-    data->units[data->nunits].line      = opd->a09->lnum;
-    data->units[data->nunits].tron = false;
+    if (!a09->selects[i].exclude)
+      include = true;
+    else if (ft_selmatch(&a09->selects[i],unit,num))
+      return false;
+  }
+  
+  if (!include)
+    return true;
     
-    c = skip_space(opd->buffer);
-    if ((c == '"') || (c == '\''))
-    {
-      if (!collect_esc_string(opd->a09,&data->units[data->nunits].name,opd->buffer,c))
-        return false;
-    }
-    else if (isEOL(c))
-    {
-      memcpy(data->units[data->nunits].name.buf,opd->a09->label.text,opd->a09->label.len);
-      data->units[data->nunits].name.widx = opd->a09->label.len;
-    }
-    else
-      return message(opd->a09,MSG_ERROR,"E0060: syntax error");
+  for (size_t i = 0 ; i < a09->nselects ; i++)
+    if (!a09->selects[i].exclude && ft_selmatch(&a09->selects[i],unit,num))
+      return true;
       
-    data->nunits++;
-  }
-  return true;
+  return false;
 }
 
 /**************************************************************************/
 
-static bool ft_timingp(struct buffer *buffer)
+static uint32_t ft_random(uint64_t *state)
 {
-  assert(buffer != NULL);
-  char c = skip_space(buffer);
-  if (isEOL(c))
-    return false;
-  buffer->ridx--;
-  return strncmp(buffer->buf,"timing",6);
+  assert(state != NULL);
+  
+  /*-----------------------------------------------------------------------
+  ; SplitMix64---small, fast, and each caller has its own state, unlike
+  ; rand().
+  ;------------------------------------------------------------------------*/
+  
+  uint64_t z = (*state += 0x9E3779B97F4A7C15uLL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9uLL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBuLL;
+  return (uint32_t)((z ^ (z >> 31)) >> 32);
 }
 
 /**************************************************************************/
 
-static bool ftest__tron(struct format *fmt,struct opcdata *opd)
+static void ft_shuffle(struct unittest *units,size_t *order,size_t num,unsigned int seed)
 {
-  (void)fmt;
-  assert(opd             != NULL);
-  assert(opd->a09        != NULL);
-  assert(opd->a09->tests != NULL);
-  assert(opd->a09->runtests);
-  assert((opd->pass == 1) || (opd->pass == 2));
+  assert((units != NULL) || (num == 0));
   
-  if (opd->pass == 2)
+  uint64_t state = seed;
+  
+  /*-----------------------------------------------------------------------
+  ; A simple way to randomize the tests array, based upon:
+  ; https://en.wikipedia.org/wiki/Fisher%E2%80%93Yates_shuffle
+  ; If given, order[] is permuted along with the tests.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t i = num ; i > 1 ; i--)
   {
-    struct testdata *data = opd->a09->tests;
-    
-    if (ft_timingp(opd->buffer))
+    size_t j = ft_random(&state) % i;
+    if (j != i - 1)
     {
-      struct vmcode *new;
-      struct Assert *Assert = get_Assert(opd->a09,data,opd->a09->pc);
+      struct unittest tmp = units[i-1];
+      units[i-1]          = units[j];
+      units[j]            = tmp;
       
-      if (Assert == NULL)
-        return false;
-      new = new_program(Assert);
-      if (new == NULL)
-        return message(opd->a09,MSG_ERROR,"E0046: out of memory");
-        
-      if (data->nunits == 0)
-      {
-        snprintf(
-                  new->tag,
-                  sizeof(new->tag),
-                  "%s:%zu",
-                  opd->a09->infile,
-                  opd->a09->lnum
-                );
-      }
-      else
+      if (order != NULL)
       {
-        snprintf(
-                  new->tag,
-                  sizeof(new->tag),
-                  "%.*s:%zu",
-                  (int)data->units[data->nunits-1].name.widx,
-                  data->units[data->nunits-1].name.buf,
-                  opd->a09->lnum
-                );
+        size_t o   = order[i-1];
+        order[i-1] = order[j];
+        order[j]   = o;
       }
-      
-      new->line                      = opd->a09->lnum;
-      new->prog[0]                   = VM_TIMEON;
-      new->prog[1]                   = VM_TRUE;
-      new->prog[2]                   = VM_EXIT;
-      data->prot[opd->a09->pc].check = true;
-      data->timing                   = true;
     }
-    else
-      data->tron = true;
   }
-  
-  return true;
 }
 
 /**************************************************************************/
 
-static bool ftest__troff(struct format *fmt,struct opcdata *opd)
+static void *ft_worker(void *arg)
 {
-  (void)fmt;
-  assert(opd             != NULL);
-  assert(opd->a09        != NULL);
-  assert(opd->a09->tests != NULL);
-  assert(opd->a09->runtests);
-  assert((opd->pass == 1) || (opd->pass == 2));
+  assert(arg != NULL);
   
-  if (opd->pass == 2)
+  struct worker *worker = arg;
+  
+  /*-----------------------------------------------------------------------
+  ; Faults are kept with the test they came from and reported by the main
+  ; thread once all the workers are done, in test order.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t i = 0 ; i < worker->ntests ; i++)
   {
-    struct testdata *data = opd->a09->tests;
+    struct unittest *unit  = &worker->units[i];
+    struct wfault   *fault = &worker->faults[worker->order[i]];
     
-    if (data->timing || ft_timingp(opd->buffer))
+    fault->tag       = "";
+    fault->lnum      = unit->line;
+    fault->rc        = 0;
+    fault->errbuf[0] = '\0';
+    
+    if (!unit->selected)
+      fault->rc = 0;
+    else if ((unit->fixture > 0) && !worker->data->snapshots[unit->fixture - 1].okay)
     {
-      struct vmcode *new;
-      struct Assert *Assert = get_Assert(opd->a09,data,opd->a09->pc);
-      if (Assert == NULL)
-        return false;
-        
-      new = new_program(Assert);
-      if (new == NULL)
-        return message(opd->a09,MSG_ERROR,"E0046: out of memory");
-        
-      if (data->nunits == 0)
-      {
-        snprintf(
-                  new->tag,
-                  sizeof(new->tag),
-                  "%s:%zu",
-                  opd->a09->infile,
-                  opd->a09->lnum
-                );
-      }
-      else
+      snprintf(fault->errbuf,sizeof(fault->errbuf),"%s",worker->data->snapshots[unit->fixture - 1].name);
+      fault->rc = TEST_SETUP;
+    }
+    else
+    {
+      fault->rc = ft_run_unit(&worker->a09,worker->data,unit,&fault->tag);
+      if (fault->rc != 0)
       {
-        snprintf(
-                  new->tag,
-                  sizeof(new->tag),
-                  "%.*s:%zu",
-                  (int)data->units[data->nunits-1].name.widx,
-                  data->units[data->nunits-1].name.buf,
-                  opd->a09->lnum
-                );
+        memcpy(fault->errbuf,worker->data->errbuf,sizeof(fault->errbuf));
+        fault->lnum = worker->a09.lnum;
       }
-      
-      new->line                      = opd->a09->lnum;
-      new->prog[0]                   = VM_TIMEOFF;
-      new->prog[1]                   = VM_TRUE;
-      new->prog[2]                   = VM_EXIT;
-      data->prot[opd->a09->pc].check = true;
+      worker->data->errbuf[0] = '\0';
     }
-    else
-      data->tron = false;
+    
+    worker->passed[worker->order[i]] = fault->rc == 0;
   }
   
-  return true;
+  return NULL;
 }
 
 /**************************************************************************/
 
-static bool ftest__Assert(struct format *fmt,struct opcdata *opd)
+static bool ft_worker_init(
+        struct a09      *a09,
+        struct testdata *data,
+        struct worker   *worker,
+        size_t           ntests,
+        unsigned int     seed
+)
 {
-  (void)fmt;
-  assert(opd             != NULL);
-  assert(opd->a09        != NULL);
-  assert(opd->a09->tests != NULL);
-  assert(opd->a09->runtests);
-  assert((opd->pass == 1) || (opd->pass == 2));
+  assert(a09    != NULL);
+  assert(data   != NULL);
+  assert(worker != NULL);
   
-  if (opd->pass == 2)
+  /*-----------------------------------------------------------------------
+  ; Each worker gets its own copy of everything a test can change---the
+  ; memory image as left by assembly (loaded images included, since tests
+  ; can write over them), the CPU, devices and the tests themselves.  The
+  ; assertions, stubs, symbols and fixture snapshots are only read, so
+  ; they're shared.  Tracing and the reports that span all tests are
+  ; turned off.
+  ;------------------------------------------------------------------------*/
+  
+  worker->ntests  = ntests;
+  worker->seed    = seed;
+  worker->started = false;
+  worker->data    = malloc(sizeof(struct testdata));
+  worker->units   = malloc((ntests + 1) * sizeof(struct unittest));
+  worker->order   = malloc((ntests + 1) * sizeof(size_t));
+  worker->passed  = malloc((ntests + 1) * sizeof(bool));
+  worker->faults  = malloc((ntests + 1) * sizeof(struct wfault));
+  
+  if (
+          (worker->data   == NULL)
+       || (worker->units  == NULL)
+       || (worker->order  == NULL)
+       || (worker->passed == NULL)
+       || (worker->faults == NULL)
+     )
+    return message(a09,MSG_ERROR,"E0046: out of memory");
+    
+  memcpy(worker->data,data,sizeof(struct testdata));
+  memcpy(worker->units,data->units,ntests * sizeof(struct unittest));
+  for (size_t i = 0 ; i < ntests ; i++)
   {
-    struct testdata    *data       = opd->a09->tests;
-    data->prot[opd->a09->pc].check = true;
-    struct Assert *Assert          = get_Assert(opd->a09,data,opd->a09->pc);
+    worker->order[i]        = i;
+    worker->units[i].tron   = false;
+  }
+  for (size_t a = 0 ; a < 65536u ; a++)
+    worker->data->prot[a].tron = false;
     
-    if (Assert == NULL)
-      return false;
-      
-    if (data->nunits == 0)
-    {
-      struct buffer name;
-      
-      /*-----------------------------------------------------------------
-      ; This .ASSERT directive was outside a .TEST directive, so use the
-      ; last non-local label as the "name".
-      ;------------------------------------------------------------------*/
-      
-      memcpy(name.buf,opd->a09->label.text,opd->a09->label.len);
-      name.widx = opd->a09->label.len;
-      if (!ft_compile(opd->a09,&name,data,Assert,opd->buffer,opd->pass))
-        return false;
-    }
-    else
+  worker->a09           = *a09;
+  worker->a09.tests     = worker->data;
+  worker->data->a09     = &worker->a09;
+  worker->data->cpu.user = worker->data;
+  worker->data->dis.user = worker->data;
+  worker->data->trace   = NULL;
+  worker->data->heat    = NULL;
+  worker->data->cover   = NULL;
+  worker->data->impact  = NULL;
+  worker->data->devices = NULL;
+  
+  if (data->ndevices > 0)
+  {
+    worker->data->devices = malloc(data->ndevices * sizeof(struct device));
+    if (worker->data->devices == NULL)
+      return message(a09,MSG_ERROR,"E0046: out of memory");
+    memcpy(worker->data->devices,data->devices,data->ndevices * sizeof(struct device));
+  }
+  
+  ft_shuffle(worker->units,worker->order,ntests,seed);
+  return true;
+}
+
+/**************************************************************************/
+
+static bool ft_run_workers(struct a09 *a09,struct testdata *data,size_t ntests)
+{
+  assert(a09  != NULL);
+  assert(data != NULL);
+  
+  struct worker *workers = calloc(a09->workers,sizeof(struct worker));
+  bool           okay    = workers != NULL;
+  
+  if (!okay)
+    return message(a09,MSG_ERROR,"E0046: out of memory");
+    
+  if (a09->seed == 0)
+    a09->seed = time(NULL);
+  if (data->symbols == NULL)
+    data->symbols = symbol_addrtable(a09,&data->nsymbols);
+    
+  /*-----------------------------------------------------------------------
+  ; Worker n runs the tests in the order given by seed+n, which is the
+  ; same order "-r -s seed+n" would run them in.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t w = 0 ; okay && (w < a09->workers) ; w++)
+  {
+    okay = ft_worker_init(a09,data,&workers[w],ntests,a09->seed + (unsigned int)w);
+    if (okay)
     {
-      if (!ft_compile(opd->a09,&data->units[data->nunits-1].name,data,Assert,opd->buffer,opd->pass))
-        return false;
+      int rc = pthread_create(&workers[w].thread,NULL,ft_worker,&workers[w]);
+      if (rc != 0)
+        okay = message(a09,MSG_ERROR,"E0070: %s: %s","pthread_create",strerror(rc));
+      else
+        workers[w].started = true;
     }
   }
   
-  return true;
-}
-
-/**************************************************************************/
-
-static bool ftest__endtst(struct format *fmt,struct opcdata *opd)
-{
-  (void)fmt;
-  assert(opd             != NULL);
-  assert(opd->a09        != NULL);
-  assert(opd->a09->tests != NULL);
-  assert(opd->a09->runtests);
-  assert((opd->pass == 1) || (opd->pass == 2));
+  /*-----------------------------------------------------------------------
+  ; A warning or error in a worker was flagged in its own copy of struct
+  ; a09, so carry those back for -w and the exit status.
+  ;------------------------------------------------------------------------*/
   
-  struct testdata *test = opd->a09->tests;
+  for (size_t w = 0 ; w < a09->workers ; w++)
+  {
+    if (workers[w].started)
+    {
+      pthread_join(workers[w].thread,NULL);
+      a09->warning |= workers[w].a09.warning;
+      a09->error   |= workers[w].a09.error;
+    }
+  }
   
-  if (!test->intest)
-    return message(opd->a09,MSG_ERROR,"E0079: no matching .TEST");
+  /*-----------------------------------------------------------------------
+  ; A test that passes under some orderings but not others depends on the
+  ; order, so list the seeds it fails under.
+  ;------------------------------------------------------------------------*/
+  
+  if (okay)
+  {
+    for (size_t i = 0 ; i < ntests ; i++)
+    {
+      struct unittest *unit   = &data->units[i];
+      size_t           passed = 0;
+      
+      if (!unit->selected)
+      {
+        if (a09->tapout)
+          printf("ok %zu - # SKIP %s %s:%zu\n",i + 1,unit->name.buf,unit->filename,unit->line);
+        continue;
+      }
+      
+      for (size_t w = 0 ; w < a09->workers ; w++)
+        passed += workers[w].passed[i];
+        
+      unit->passed = passed == a09->workers;
+      if (!unit->passed)
+        data->failed++;
+        
+      if (a09->tapout)
+      {
+        printf("%s %zu - %s %s:%zu",unit->passed ? "ok" : "not ok",i + 1,unit->name.buf,unit->filename,unit->line);
+        if ((passed > 0) && !unit->passed)
+        {
+          printf(" # order dependent, fails with seeds");
+          for (size_t w = 0 ; w < a09->workers ; w++)
+            if (!workers[w].passed[i])
+              printf(" %u",workers[w].seed);
+        }
+        putchar('\n');
+      }
+      
+      a09->infile = unit->filename;
+      a09->lnum   = unit->line;
+      
+      for (size_t w = 0 ; w < a09->workers ; w++)
+      {
+        if (!workers[w].passed[i])
+        {
+          struct wfault *fault = &workers[w].faults[i];
+          
+          memcpy(data->errbuf,fault->errbuf,sizeof(data->errbuf));
+          a09->lnum = fault->lnum;
+          ft_fault(a09,data,fault->tag,fault->rc);
+          break;
+        }
+      }
+      
+      a09->lnum = unit->line;
+      if ((passed > 0) && !unit->passed)
+        message(a09,MSG_WARNING,"W0030: %s: result depends on test order",unit->name.buf);
+    }
     
-  test->testpc     = opd->a09->pc;
-  opd->value.value = test->resumepc;
+    if (a09->tapout)
+      printf("# seeds=%u-%u\n",a09->seed,a09->seed + a09->workers - 1);
+  }
   
-  if (!ftest_org(fmt,opd))
-    return false;
-  message(opd->a09,MSG_DEBUG,"endtst pc=%04X",opd->a09->pc);
+  for (size_t w = 0 ; w < a09->workers ; w++)
+  {
+    if (workers[w].data != NULL)
+      free(workers[w].data->devices);
+    free(workers[w].data);
+    free(workers[w].units);
+    free(workers[w].order);
+    free(workers[w].passed);
+    free(workers[w].faults);
+  }
   
-  test->intest = false;
-  return true;
+  free(workers);
+  return okay;
 }
 
 /**************************************************************************/
@@ -1958,36 +5150,70 @@ bool test_run(struct a09 *a09)
   assert(a09->tests != NULL);
   assert(a09->runtests);
   
-  struct testdata *data   = a09->tests;
+  struct testdata *data      = a09->tests;
+  struct baseline *baselines = NULL;
+  size_t           nbaseline = 0;
+  struct cached   *cache     = NULL;
+  size_t           ncache    = 0;
+  bool             newbase   = false;
   
-  message(a09,MSG_DEBUG,"number of tests: %zu",data->nunits);
-  if (a09->tapout)
-    printf("TAP version 14\n1..%zu\n",data->nunits);
+  /*-----------------------------------------------------------------------
+  ; If a baseline file was given but doesn't exist, we'll create it with the
+  ; results of this run.  Otherwise, compare each test against it.
+  ;------------------------------------------------------------------------*/
+  
+  if (a09->baseline != NULL)
+  {
+    FILE *fp = fopen(a09->baseline,"r");
     
+    if (fp != NULL)
+    {
+      bool okay = ft_read_baselines(a09,fp,&baselines,&nbaseline);
+      fclose(fp);
+      if (!okay)
+        return false;
+    }
+    else if (errno == ENOENT)
+      newbase = true;
+    else
+      return message(a09,MSG_ERROR,"E0070: %s: %s",a09->baseline,strerror(errno));
+  }
+  
   /*-----------------------------------------------------------------------
-  ; A simple way to randomize the tests array, based upon:
-  ; https://en.wikipedia.org/wiki/Fisher%E2%80%93Yates_shuffle
-  ; We check if we have more than one test; 0 or 1 tests, there's no need
-  ; for this step at all.
+  ; Likewise, a missing test impact cache just means every test runs.  The
+  ; source lines from this assembly are sorted to check the cache against.
   ;------------------------------------------------------------------------*/
   
-  if ((a09->rndtests) && (data->nunits > 1))
+  if (data->impact != NULL)
   {
-    message(a09,MSG_DEBUG,"Randomizing tests");
+    FILE *fp = fopen(a09->impactfile,"r");
     
-    if (a09->seed == 0)
-      a09->seed = time(NULL); /* XXX is there a better way? */
-    srand(a09->seed);
-    for (size_t i = data->nunits ; i > 1 ; i--)
+    if (fp != NULL)
     {
-      size_t j = rand() % i;
-      if (j != i - 1)
+      bool okay = ft_read_cache(a09,fp,&cache,&ncache);
+      fclose(fp);
+      if (!okay)
       {
-        struct unittest tmp = data->units[i-1];
-        data->units[i-1]    = data->units[j];
-        data->units[j]      = tmp;
+        free_baselines(baselines,nbaseline);
+        return false;
       }
     }
+    else if (errno != ENOENT)
+    {
+      free_baselines(baselines,nbaseline);
+      return message(a09,MSG_ERROR,"E0070: %s: %s",a09->impactfile,strerror(errno));
+    }
+    
+    data->impact->sorted = malloc((data->impact->nlines + 1) * sizeof(struct srcline));
+    if (data->impact->sorted == NULL)
+    {
+      free_cache(cache,ncache);
+      free_baselines(baselines,nbaseline);
+      return message(a09,MSG_ERROR,"E0046: out of memory");
+    }
+    
+    memcpy(data->impact->sorted,data->impact->lines,data->impact->nlines * sizeof(struct srcline));
+    qsort(data->impact->sorted,data->impact->nlines,sizeof(struct srcline),srclinecmp);
   }
   
   /*-----------------------------------------------------------------------
@@ -1997,105 +5223,174 @@ bool test_run(struct a09 *a09)
   ; this field and restore it after the tests have run.
   ;------------------------------------------------------------------------*/
   
+  size_t      ntests = data->nunits;
   char const *infile = a09->infile;
   
-  for (size_t i = 0 ; i < data->nunits ; i++)
+  /*-----------------------------------------------------------------------
+  ; Move the .SETUP fixtures past the tests, keeping their relative order,
+  ; and run each one once, saving the resulting state.
+  ;------------------------------------------------------------------------*/
+  
+  if (data->nfixtures > 0)
   {
-    struct unittest *unit = &data->units[i];
-    char const      *tag  = "";
-    int              rc;
+    struct unittest *units = malloc(data->nunits * sizeof(struct unittest));
     
-    if (i < sizeof(a09->notest) * CHAR_BIT)
+    data->snapshots = malloc(data->nfixtures * sizeof(struct snapshot));
+    if ((units == NULL) || (data->snapshots == NULL))
     {
-      div_t            res = div((int)i,CHAR_BIT);
-      if (a09->notest[res.quot] & (1 << res.rem))
-      {
-        printf("ok %zu - # SKIP %s %s:%zu %s\n",i + 1,unit->name.buf,unit->filename,unit->line,tag);
-        continue;
-      }
+      free(units);
+      free_cache(cache,ncache);
+      free_baselines(baselines,nbaseline);
+      return message(a09,MSG_ERROR,"E0046: out of memory");
     }
     
-    a09->infile = unit->filename;
-    for (size_t j = 0 ; j < data->stacksize ; j++)
-    {
-      data->prot[data->sp - j].read  = true;
-      data->prot[data->sp - j].write = true;
-    }
+    ntests = 0;
+    for (size_t i = 0 ; i < data->nunits ; i++)
+      if (!data->units[i].setup)
+        units[ntests++] = data->units[i];
+    for (size_t i = 0 , f = ntests ; i < data->nunits ; i++)
+      if (data->units[i].setup)
+        units[f++] = data->units[i];
+        
+    free(data->units);
+    data->units = units;
+  }
+  
+  message(a09,MSG_DEBUG,"number of tests: %zu",ntests);
+  if (a09->tapout)
+    printf("TAP version 14\n1..%zu\n",ntests);
+    
+  /*-----------------------------------------------------------------------
+  ; We check if we have more than one test; 0 or 1 tests, there's no need
+  ; for this step at all.  The workers do their own shuffling.
+  ;------------------------------------------------------------------------*/
+  
+  if ((a09->rndtests) && (a09->workers == 0) && (ntests > 1))
+  {
+    message(a09,MSG_DEBUG,"Randomizing tests");
     
-    data->cpu.pc.w = unit->addr;
-    data->cpu.S.w  = data->sp - 2;
-    data->cpu.dp   = a09->dp;
+    if (a09->seed == 0)
+      a09->seed = time(NULL); /* XXX is there a better way? */
+    ft_shuffle(data->units,NULL,ntests,a09->seed);
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; Apply the -x and -y selections once, up front.  A fixture is only run
+  ; if a selected test uses it; fixture n is unit ntests + n - 1.
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t i = ntests ; i < data->nunits ; i++)
+    data->units[i].selected = false;
     
-    /*----------------------------------------------------
-    ; initialize other registers with semi-random data
-    ;-----------------------------------------------------*/
+  for (size_t i = 0 ; i < ntests ; i++)
+  {
+    struct unittest *unit = &data->units[i];
     
-    data->cpu.U.w  = data->cpu.pc.w ^ data->cpu.S.w;
-    data->cpu.Y.w  = data->cpu.U.w;
-    data->cpu.X.w  = data->cpu.Y.w;
-    data->cpu.d.w  = data->cpu.X.w;
-    a09->lnum      = unit->line;
-    message(a09,MSG_DEBUG,"Running test %s",unit->name.buf);
+    unit->selected = ft_selected(a09,unit,i + 1);
+    if (unit->selected && (unit->fixture > 0))
+      data->units[ntests + unit->fixture - 1].selected = true;
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; Each fixture starts from the assembled memory image, which is restored
+  ; once they've all run.  The snapshots are what the tests start with.
+  ;------------------------------------------------------------------------*/
+  
+  if (data->nfixtures > 0)
+  {
+    mc6809byte__t *base = malloc(sizeof(data->memory));
     
-    do
+    if (base == NULL)
     {
-      if (data->memory[data->cpu.pc.w] == data->fill)
-      {
-        snprintf(data->errbuf,sizeof(data->errbuf),"PC=%04X",data->cpu.pc.w);
-        rc = TEST_WEEDS;
-        break;
-      }
+      free_cache(cache,ncache);
+      free_baselines(baselines,nbaseline);
+      return message(a09,MSG_ERROR,"E0046: out of memory");
+    }
+    
+    memcpy(base,data->memory,sizeof(data->memory));
+    
+    for (size_t i = ntests ; i < data->nunits ; i++)
+    {
+      struct unittest *unit = &data->units[i];
+      struct snapshot *snap = &data->snapshots[unit->fixture - 1];
+      char const      *tag  = "";
+      int              rc;
       
-      if (unit->tron || data->prot[data->cpu.pc.w].tron)
-      {
-        char inst[128];
-        char regs[128];
+      snap->okay = false;
+      snap->name = unit->name.buf;
+      if (!unit->selected)
+        continue;
         
-        data->dis.pc = data->cpu.pc.w;
-        rc = mc6809dis_step(&data->dis,&data->cpu);
-        if (rc != 0)
-          break;
-        mc6809dis_format(&data->dis,inst,sizeof(inst));
-        mc6809dis_registers(&data->cpu,regs,sizeof(regs));
-        if (a09->tapout)
-          printf("# ");
-        printf("%s | %s\n",regs,inst);
-      }
+      rc         = ft_run_unit(a09,data,unit,&tag);
+      snap->okay = rc == 0;
+      snap->name = unit->name.buf;
+      snap->cpu  = data->cpu;
+      snap->hash = unit->hash;
+      if (data->impact != NULL)
+        memcpy(snap->touched,data->impact->touched,sizeof(snap->touched));
+      memcpy(snap->memory,data->memory,sizeof(snap->memory));
+      memcpy(data->memory,base,sizeof(data->memory));
       
-      if (data->prot[data->cpu.pc.w].check)
+      if (rc != 0)
       {
-        bool     okay = false;
-        uint16_t addr = data->cpu.pc.w;
-        tree__s *tree = tree_find(data->Asserts,&addr,Assertaddrcmp);
-        
-        if (tree != NULL)
-        {
-          struct Assert *Assert = tree2Assert(tree);
-          
-          assert(Assert->here == addr);
-          for (size_t j = 0 ; j < Assert->cnt ; j++)
-          {
-            message(a09,MSG_DEBUG,"checking %s",Assert->Asserts[j].tag);
-            okay = runvm(data->a09,&data->cpu,&Assert->Asserts[j]);
-            if (!okay)
-            {
-              tag = Assert->Asserts[j].tag;
-              break;
-            }
-          }
-        }
-        
-        if (!okay)
-        {
-          rc = TEST_FAILED;
-          break;
-        }
+        if (a09->tapout)
+          printf("# SETUP %s %s:%zu failed\n",unit->name.buf,unit->filename,unit->line);
+        if (data->trace != NULL)
+          ft_trace_dump(a09,data,true);
+        ft_fault(a09,data,tag,rc);
       }
-      
-      data->icount++;
-      rc = mc6809_step(&data->cpu);
     }
-    while((rc == 0) && (data->cpu.S.w != data->sp));
+    
+    free(base);
+  }
+    
+  /*-----------------------------------------------------------------------
+  ; With workers, the whole suite is run once per worker, each in its own
+  ; order, looking for tests that only pass (or fail) in some orders.
+  ;------------------------------------------------------------------------*/
+  
+  if (a09->workers > 0)
+  {
+    bool okay = ft_run_workers(a09,data,ntests);
+    
+    message(a09,MSG_DEBUG,"failed tests: %zu",data->failed);
+    a09->infile = infile;
+    a09->lnum   = 0;
+    free_cache(cache,ncache);
+    free_baselines(baselines,nbaseline);
+    return okay && (data->failed == 0);
+  }
+  
+  for (size_t i = 0 ; i < ntests ; i++)
+  {
+    struct unittest *unit = &data->units[i];
+    char const      *tag  = "";
+    int              rc;
+    
+    if (!unit->selected)
+    {
+      printf("ok %zu - # SKIP %s %s:%zu %s\n",i + 1,unit->name.buf,unit->filename,unit->line,tag);
+      continue;
+    }
+    
+    if ((unit->fixture > 0) && !data->snapshots[unit->fixture - 1].okay)
+    {
+      snprintf(data->errbuf,sizeof(data->errbuf),"%s",data->snapshots[unit->fixture - 1].name);
+      a09->infile = unit->filename;
+      a09->lnum   = unit->line;
+      rc          = TEST_SETUP;
+    }
+    else if ((data->impact != NULL) && ((unit->cache = ft_check_cache(data,unit,cache,ncache)) != NULL))
+    {
+      printf("ok %zu - # SKIP cached %s %s:%zu\n",i + 1,unit->name.buf,unit->filename,unit->line);
+      continue;
+    }
+    else
+      rc = ft_run_unit(a09,data,unit,&tag);
+      
+    if ((rc == 0) && (data->impact != NULL))
+      if (!ft_impact_record(a09,data,unit))
+        rc = TEST_FAILED;
     
     if (a09->tapout)
     {
@@ -2105,43 +5400,163 @@ bool test_run(struct a09 *a09)
         printf("not ok %zu - %s %s:%zu %s\n",i + 1,unit->name.buf,unit->filename,unit->line,tag);
     }
     
-    if (rc != 0)
+    if (a09->tapout && (data->outlen > 0))
+      ft_output(data);
+    if (a09->tapout && (rc != TEST_SETUP))
     {
-      static char const *const mfaults[] =
-      {
-        NULL,
-        "an internal error inside the MC6809 emulator",
-        "an illegal instruction was encountered",
-        "an illegal addressing mode was encountered",
-        "an undefined combination of registers was being exchanged",
-        "an undefined combination of registers was being transfered",
-        "test failed",
-        "reading from non-readable memory",
-        "code went into the weeds",
-        "writing to non-writable memory",
-        "executing non-code",
-      };
+      ft_stack_report(a09,data);
+      ft_dev_report(data);
+      ft_int_report(data);
+    }
       
-      assert(rc < TEST_max);
-      message(a09,MSG_WARNING,"W0015: %s: %s: %s",tag,mfaults[rc],data->errbuf);
-      data->errbuf[0] = '\0';
+    if ((rc == 0) && (a09->baseline != NULL) && !newbase)
+      ft_check_baseline(a09,unit,baselines,nbaseline);
+      
+    if (data->trace != NULL)
+      ft_trace_dump(a09,data,rc != 0);
+    
+    if (rc != 0)
+    {
+      ft_fault(a09,data,tag,rc);
       data->failed++;
     }
   }
   
   if (a09->tapout)
   {
-    if (a09->tapout && a09->rndtests && (data->nunits > 1))
+    if (a09->tapout && a09->rndtests && (ntests > 1))
       printf("# seed=%u\n",a09->seed);
   }
   
   message(a09,MSG_DEBUG,"failed tests: %zu",data->failed);
   a09->infile = infile;
+  a09->lnum   = 0;
+  free_baselines(baselines,nbaseline);
+  
+  if (data->impact != NULL)
+  {
+    bool okay = ft_write_cache(a09,data);
+    
+    free_cache(cache,ncache);
+    for (size_t i = 0 ; i < data->nunits ; i++)
+      data->units[i].cache = NULL;
+    if (!okay)
+      return false;
+  }
+  
+  if (newbase)
+    if (!ft_write_baselines(a09,data))
+      return false;
+      
+  if (data->heat != NULL)
+    if (!ft_write_heatmap(a09,data))
+      return false;
+      
+  if (data->cover != NULL)
+    if (!ft_write_lcov(a09,data))
+      return false;
+      
   return data->failed == 0;
 }
 
 /**************************************************************************/
 
+bool test_annotate(struct a09 *a09)
+{
+  assert(a09 != NULL);
+  
+  if ((a09->tests == NULL) || (a09->tests->cover == NULL) || (a09->listfile == NULL))
+    return true;
+    
+  struct coverage *cover = a09->tests->cover;
+  char            *text  = NULL;
+  size_t           size  = 0;
+  FILE            *fp    = fopen(a09->listfile,"r");
+  
+  if (fp == NULL)
+    return message(a09,MSG_ERROR,"E0070: %s: %s",a09->listfile,strerror(errno));
+    
+  while(true)
+  {
+    char   *new = realloc(text,size + 65536u);
+    size_t  bytes;
+    
+    if (new == NULL)
+    {
+      free(text);
+      fclose(fp);
+      return message(a09,MSG_ERROR,"E0046: out of memory");
+    }
+    
+    text   = new;
+    bytes  = fread(&text[size],1,65536u,fp);
+    size  += bytes;
+    if (bytes < 65536u)
+      break;
+  }
+  
+  fclose(fp);
+  
+  fp = fopen(a09->listfile,"w");
+  if (fp == NULL)
+  {
+    free(text);
+    return message(a09,MSG_ERROR,"E0070: %s: %s",a09->listfile,strerror(errno));
+  }
+  
+  /*-----------------------------------------------------------------------
+  ; Prefix each line that starts an instruction with its coverage:
+  ;
+  ;	#####	never executed
+  ;	    +	executed
+  ;	   +T	conditional branch, always taken
+  ;	   +N	conditional branch, never taken
+  ;------------------------------------------------------------------------*/
+  
+  for (size_t pos = 0 ; pos < size ; )
+  {
+    char const *line = &text[pos];
+    char const *mark = "      ";
+    size_t      len  = 0;
+    
+    while((pos + len < size) && (line[len] != '\n'))
+      len++;
+    if (pos + len < size)
+      len++;
+      
+    if (
+            (len > 5)
+         && isxdigit(line[0]) && isxdigit(line[1])
+         && isxdigit(line[2]) && isxdigit(line[3])
+         && (line[4] == ':')
+       )
+    {
+      uint16_t addr = strtoul(line,NULL,16);
+      
+      if (cover->file[addr] != NULL)
+      {
+        if (cover->exec[addr] == 0)
+          mark = "##### ";
+        else if (ft_isbranch(a09->tests,addr) && (cover->nottaken[addr] == 0))
+          mark = "   +T ";
+        else if (ft_isbranch(a09->tests,addr) && (cover->taken[addr] == 0))
+          mark = "   +N ";
+        else
+          mark = "    + ";
+      }
+    }
+    
+    fprintf(fp,"%s%.*s",mark,(int)len,line);
+    pos += len;
+  }
+  
+  fclose(fp);
+  free(text);
+  return true;
+}
+
+/**************************************************************************/
+
 static void free_Asserts(tree__s *tree)
 {
   if (tree != NULL)
@@ -2156,6 +5571,14 @@ static void free_Asserts(tree__s *tree)
 
 /**************************************************************************/
 
+bool test_intest(struct a09 const *a09)
+{
+  assert(a09 != NULL);
+  return a09->runtests && (a09->tests != NULL) && a09->tests->intest;
+}
+
+/**************************************************************************/
+
 bool test_fini(struct a09 *a09)
 {
   assert(a09        != NULL);
@@ -2191,6 +5614,21 @@ bool test_fini(struct a09 *a09)
   }
   
   free_Asserts(data->Asserts);
+  free(data->symbols);
+  free(data->stubs);
+  free(data->devices);
+  free(data->heat);
+  free(data->cover);
+  if (data->impact != NULL)
+  {
+    free(data->impact->lines);
+    free(data->impact->sorted);
+    free(data->impact);
+  }
+  for (size_t i = 0 ; i < data->nunits ; i++)
+    free(data->units[i].lines);
+  free(data->trace);
+  free(data->snapshots);
   free(data->units);
   free(data);
   return true;
@@ -2213,6 +5651,9 @@ bool test_init(struct a09 *a09)
     a09->tests->Asserts    = NULL;
     a09->tests->units      = NULL;
     a09->tests->nunits     = 0;
+    a09->tests->snapshots  = NULL;
+    a09->tests->nfixtures  = 0;
+    a09->tests->fixture    = 0;
     a09->tests->failed     = 0;
     a09->tests->icount     = 0;
     a09->tests->cpu.user   = a09->tests;
@@ -2222,10 +5663,33 @@ bool test_init(struct a09 *a09)
     a09->tests->dis.user   = a09->tests;
     a09->tests->dis.read   = ft_dis_read;
     a09->tests->dis.fault  = ft_dis_fault;
+    a09->tests->trace      = NULL;
+    a09->tests->tracesize  = 0;
+    a09->tests->tracenext  = 0;
+    a09->tests->tracecnt   = 0;
+    a09->tests->symbols    = NULL;
+    a09->tests->nsymbols   = 0;
+    a09->tests->stubs      = NULL;
+    a09->tests->nstubs     = 0;
+    a09->tests->devices    = NULL;
+    a09->tests->ndevices   = 0;
+    a09->tests->heat       = NULL;
+    a09->tests->cover      = NULL;
+    a09->tests->impact     = NULL;
+    a09->tests->outlen     = 0;
+    a09->tests->maxinst    = a09->maxinst;
+    a09->tests->maxcycles  = 0;
+    memset(a09->tests->intsched,0,sizeof(a09->tests->intsched));
+    memset(a09->tests->ints,0,sizeof(a09->tests->ints));
     a09->tests->passinit   = 0;
     a09->tests->addr       = 0;
     a09->tests->sp         = 0xFFF0;
     a09->tests->stacksize  = 1024;
+    a09->tests->smin       = 0xFFF0;
+    a09->tests->sminpc     = 0;
+    a09->tests->ubase      = 0;
+    a09->tests->umin       = 0;
+    a09->tests->upushed    = false;
     a09->tests->inittestpc = 0xE000;
     a09->tests->testpc     = 0xE000;
     a09->tests->resumepc   = 0x0000;
@@ -2251,6 +5715,32 @@ bool test_init(struct a09 *a09)
       a09->tests->prot[addr].read = true;
     mc6809_reset(&a09->tests->cpu);
     
+    if (a09->heatfile != NULL)
+    {
+      a09->tests->heat = calloc(1,sizeof(struct heatmap));
+      if (a09->tests->heat == NULL)
+        return message(a09,MSG_ERROR,"E0046: out of memory");
+    }
+    
+    if (a09->impactfile != NULL)
+    {
+      a09->tests->impact = calloc(1,sizeof(struct impact));
+      if (a09->tests->impact == NULL)
+        return message(a09,MSG_ERROR,"E0046: out of memory");
+      a09->tests->impact->opthash = 2166136261uL;
+    }
+    
+    for (size_t i = 0 ; i < a09->nloads ; i++)
+      if (!ft_load_spec(a09,a09->tests,a09->loads[i]))
+        return false;
+        
+    if (a09->covfile != NULL)
+    {
+      a09->tests->cover = calloc(1,sizeof(struct coverage));
+      if (a09->tests->cover == NULL)
+        return message(a09,MSG_ERROR,"E0046: out of memory");
+    }
+    
     return true;
   }
   else
@@ -0,0 +1,214 @@
+/****************************************************************************
+*
+*   Check the cycle counts of straight-line code at assembly time
+*   Copyright (C) 2023 Sean Conner
+*
+*   This program is free software: you can redistribute it and/or modify
+*   it under the terms of the GNU General Public License as published by
+*   the Free Software Foundation, either version 3 of the License, or
+*   (at your option) any later version.
+*
+*   This program is distributed in the hope that it will be useful,
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*   GNU General Public License for more details.
+*
+*   You should have received a copy of the GNU General Public License
+*   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*   Comments, questions and criticisms can be sent to: sean@conman.org
+*
+****************************************************************************/
+
+#include <stdlib.h>
+
+#include "a09.h"
+
+/*--------------------------------------------------------------------------
+; A .CYCLES starts a region and its .ENDCYC ends it; regions can nest, and
+; every instruction counts towards each open region.  An instruction with
+; two timings (a long conditional branch, RTI) adds the lower to the best
+; case and the higher to the worst case.  The totals are only checked on
+; pass 2, when the addressing modes (and thus the cycles) are settled.
+;--------------------------------------------------------------------------*/
+
+struct cycregion
+{
+  struct cycregion *next;
+  char const       *filename;
+  size_t            lnum;
+  size_t            best;
+  size_t            worst;
+};
+
+struct cycdata
+{
+  struct cycregion *regions;
+};
+
+/**************************************************************************/
+
+bool timing_init(struct a09 *a09)
+{
+  assert(a09 != NULL);
+  
+  a09->timing = calloc(1,sizeof(struct cycdata));
+  if (a09->timing == NULL)
+    return message(a09,MSG_ERROR,"E0046: out of memory");
+  return true;
+}
+
+/**************************************************************************/
+
+bool timing_start(struct opcdata *opd)
+{
+  assert(opd              != NULL);
+  assert(opd->a09         != NULL);
+  assert(opd->a09->timing != NULL);
+  assert(opd->buffer      != NULL);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  struct cycregion *region;
+  
+  if (!isEOL(skip_space(opd->buffer)))
+    return message(opd->a09,MSG_ERROR,"E0024: operands found for op with no operands");
+    
+  region = malloc(sizeof(struct cycregion));
+  if (region == NULL)
+    return message(opd->a09,MSG_ERROR,"E0046: out of memory");
+    
+  region->next              = opd->a09->timing->regions;
+  region->filename          = opd->a09->infile;
+  region->lnum              = opd->a09->lnum;
+  region->best              = 0;
+  region->worst             = 0;
+  opd->a09->timing->regions = region;
+  return true;
+}
+
+/**************************************************************************/
+
+bool timing_end(struct opcdata *opd)
+{
+  assert(opd              != NULL);
+  assert(opd->a09         != NULL);
+  assert(opd->a09->timing != NULL);
+  assert(opd->buffer      != NULL);
+  assert((opd->pass == 1) || (opd->pass == 2));
+  
+  struct cycregion *region = opd->a09->timing->regions;
+  struct value      most;
+  struct value      least;
+  bool              rc     = true;
+  char              c;
+  
+  if (region == NULL)
+    return message(opd->a09,MSG_ERROR,"E0131: .ENDCYC without .CYCLES");
+    
+  opd->a09->timing->regions = region->next;
+  
+  if (!expr(&most,opd->a09,opd->buffer,opd->pass))
+    rc = false;
+  else if ((c = skip_space(opd->buffer)) == ',')
+  {
+    if (!expr(&least,opd->a09,opd->buffer,opd->pass))
+      rc = false;
+  }
+  else if (isEOL(c))
+    least.value = 0;
+  else
+    rc = message(opd->a09,MSG_ERROR,"E0034: missing comma");
+    
+  if (rc && (opd->pass == 2))
+  {
+    if (region->worst > most.value)
+      rc = message(opd->a09,MSG_ERROR,"E0132: worst case of %zu cycles over the limit of %u",region->worst,most.value);
+    else if (region->best < least.value)
+      rc = message(opd->a09,MSG_ERROR,"E0133: best case of %zu cycles under the limit of %u",region->best,least.value);
+  }
+  
+  free(region);
+  return rc;
+}
+
+/**************************************************************************/
+
+void timing_add(struct a09 *a09,size_t best,size_t worst)
+{
+  assert(a09         != NULL);
+  assert(a09->timing != NULL);
+  assert(best        <= worst);
+  
+  for (struct cycregion *region = a09->timing->regions ; region != NULL ; region = region->next)
+  {
+    region->best  += best;
+    region->worst += worst;
+  }
+}
+
+/**************************************************************************/
+
+void timing_record(struct opcdata *opd)
+{
+  assert(opd              != NULL);
+  assert(opd->a09         != NULL);
+  assert(opd->a09->timing != NULL);
+  
+  size_t cycles = opd->cycles + opd->ecycles;
+  size_t taken  = opd->acycles > 0 ? opd->acycles + opd->ecycles : cycles;
+  
+  if (opd->a09->timing->regions == NULL)
+    return;
+  if (cycles < taken)
+    timing_add(opd->a09,cycles,taken);
+  else
+    timing_add(opd->a09,taken,cycles);
+}
+
+/**************************************************************************/
+
+bool timing_check(struct a09 *a09)
+{
+  assert(a09         != NULL);
+  assert(a09->timing != NULL);
+  
+  bool rc = true;
+  
+  while(a09->timing->regions != NULL)
+  {
+    struct cycregion *region = a09->timing->regions;
+    char const       *infile = a09->infile;
+    size_t            lnum   = a09->lnum;
+    
+    a09->infile          = region->filename;
+    a09->lnum            = region->lnum;
+    rc                   = message(a09,MSG_ERROR,"E0134: missing .ENDCYC");
+    a09->infile          = infile;
+    a09->lnum            = lnum;
+    a09->timing->regions = region->next;
+    free(region);
+  }
+  
+  return rc;
+}
+
+/**************************************************************************/
+
+bool timing_fini(struct a09 *a09)
+{
+  assert(a09         != NULL);
+  assert(a09->timing != NULL);
+  
+  while(a09->timing->regions != NULL)
+  {
+    struct cycregion *region = a09->timing->regions;
+    a09->timing->regions = region->next;
+    free(region);
+  }
+  
+  free(a09->timing);
+  a09->timing = NULL;
+  return true;
+}
+
+/**************************************************************************/